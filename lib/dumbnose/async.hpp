@@ -0,0 +1,254 @@
+#pragma once
+
+//
+//	async
+//
+//	Awaitables that connect task<> coroutines to the library's executors
+//	and synchronization objects.  Each one suspends the coroutine without
+//	blocking a thread and later resumes it on an executor, either a
+//	thread_pool<> or a work_stealing_pool, so thousands of operations can
+//	be in flight on a handful of workers.
+//
+//		task<void> pump(thread_pool<>& pool, event_source<int,int>& source)
+//		{
+//			co_await schedule_on(pool);						// continue on a worker
+//			int value = co_await next_raise(source, pool);	// wait for the next raise
+//			co_await delay(pool, std::chrono::milliseconds(10));
+//		}
+//
+
+#include <chrono>
+#include <coroutine>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <type_traits>
+#include <utility>
+#include <dumbnose/task.hpp>
+#include <dumbnose/thread_pool.hpp>
+#include <dumbnose/work_stealing_pool.hpp>
+#include <dumbnose/timer_queue.hpp>
+#include <dumbnose/event_source.hpp>
+
+#if defined(_WIN32) || defined(__linux__)
+#include <dumbnose/waiter.hpp>
+#endif
+
+
+namespace dumbnose {
+
+
+/* ---------------------------------------------------------------------------------*\
+	executors
+\* ---------------------------------------------------------------------------------*/
+
+template<class work_item_t>
+void post(thread_pool<work_item_t>& pool, std::function<void()> func)
+{
+	pool.add_work_item(typename thread_pool<work_item_t>::work_item_ptr(new work_item_t(std::move(func))));
+}
+
+inline void post(work_stealing_pool& pool, std::function<void()> func)
+{
+	pool.submit(std::move(func));
+}
+
+template<class executor_t>
+void resume_on(executor_t& executor, std::coroutine_handle<> handle)
+{
+	post(executor, [handle]{ handle.resume(); });
+}
+
+
+/* ---------------------------------------------------------------------------------*\
+	co_await schedule_on(executor): continue on one of the executor's threads
+\* ---------------------------------------------------------------------------------*/
+
+template<class executor_t>
+class schedule_awaiter
+{
+public:
+	explicit schedule_awaiter(executor_t& executor) : executor_(executor) {}
+
+	bool await_ready() const noexcept { return false; }
+	void await_suspend(std::coroutine_handle<> handle) { resume_on(executor_, handle); }
+	void await_resume() const noexcept {}
+
+private:
+	executor_t& executor_;
+};
+
+template<class executor_t>
+schedule_awaiter<executor_t> schedule_on(executor_t& executor)
+{
+	return schedule_awaiter<executor_t>(executor);
+}
+
+
+/* ---------------------------------------------------------------------------------*\
+	co_await delay(executor, duration) / resume_at(executor, time)
+	If the time has already passed the coroutine simply continues.
+\* ---------------------------------------------------------------------------------*/
+
+template<class executor_t>
+class timer_awaiter
+{
+public:
+	timer_awaiter(executor_t& executor, timer_queue::clock_t::time_point when, timer_queue& timers)
+		: executor_(executor), when_(when), timers_(timers) {}
+
+	bool await_ready() const { return when_<=timer_queue::clock_t::now(); }
+
+	void await_suspend(std::coroutine_handle<> handle)
+	{
+		executor_t* executor = &executor_;
+		timers_.schedule_at(when_, [executor, handle]{ resume_on(*executor, handle); });
+	}
+
+	void await_resume() const noexcept {}
+
+private:
+	executor_t& executor_;
+	timer_queue::clock_t::time_point when_;
+	timer_queue& timers_;
+};
+
+template<class executor_t>
+timer_awaiter<executor_t> resume_at(executor_t& executor, timer_queue::clock_t::time_point when, timer_queue& timers = timer_queue::shared())
+{
+	return timer_awaiter<executor_t>(executor, when, timers);
+}
+
+template<class executor_t, class rep_t, class period_t>
+timer_awaiter<executor_t> delay(executor_t& executor, std::chrono::duration<rep_t,period_t> duration, timer_queue& timers = timer_queue::shared())
+{
+	return resume_at(executor, timer_queue::clock_t::now()+std::chrono::duration_cast<timer_queue::clock_t::duration>(duration), timers);
+}
+
+
+/* ---------------------------------------------------------------------------------*\
+	co_await next_raise(source, executor): the args of the source's next raise
+\* ---------------------------------------------------------------------------------*/
+
+template<class sender_t, class event_args_t, class executor_t>
+class raise_awaiter
+{
+public:
+	typedef event_source<sender_t,event_args_t> source_t;
+	typedef typename source_t::cookie_t cookie_t;
+	typedef typename std::decay<event_args_t>::type args_t;
+
+	raise_awaiter(source_t& source, executor_t& executor)
+		: source_(source), executor_(executor), state_(std::make_shared<state_t>()) {}
+
+	raise_awaiter(raise_awaiter&&) = default;
+
+	// A coroutine destroyed while suspended here must not be resumed later
+	~raise_awaiter()
+	{
+		if(!state_) return;
+
+		std::unique_ptr<cookie_t> registration;
+		{
+			std::lock_guard<std::mutex> lock(state_->lock_);
+			state_->fired_ = true;
+			registration = std::move(state_->cookie_);
+		}
+	}
+
+	bool await_ready() const noexcept { return false; }
+
+	void await_suspend(std::coroutine_handle<> handle)
+	{
+		std::shared_ptr<state_t> state = state_;
+		executor_t* executor = &executor_;
+
+		cookie_t cookie = source_.register_listener([state, executor, handle](sender_t, event_args_t args){
+			std::unique_ptr<cookie_t> registration;
+			{
+				std::lock_guard<std::mutex> lock(state->lock_);
+				if(state->fired_) return;
+
+				state->fired_ = true;
+				state->args_.emplace(args);
+				registration = std::move(state->cookie_);
+			}
+
+			resume_on(*executor, handle);
+		});
+
+		// From here on the listener may already have resumed the coroutine,
+		// so only the shared state may be touched, never this awaiter.
+		std::lock_guard<std::mutex> lock(state->lock_);
+		if(!state->fired_) {
+			// copying a cookie transfers the registration to the copy
+			state->cookie_.reset(new cookie_t(cookie));
+		}
+	}
+
+	args_t await_resume()
+	{
+		return std::move(*state_->args_);
+	}
+
+private:
+	struct state_t
+	{
+		std::mutex lock_;
+		bool fired_ = false;
+		std::optional<args_t> args_;
+		std::unique_ptr<cookie_t> cookie_;
+	};
+
+	source_t& source_;
+	executor_t& executor_;
+	std::shared_ptr<state_t> state_;
+};
+
+template<class sender_t, class event_args_t, class executor_t>
+raise_awaiter<sender_t,event_args_t,executor_t> next_raise(event_source<sender_t,event_args_t>& source, executor_t& executor)
+{
+	return raise_awaiter<sender_t,event_args_t,executor_t>(source, executor);
+}
+
+
+#if defined(_WIN32) || defined(__linux__)
+
+/* ---------------------------------------------------------------------------------*\
+	co_await async_wait(object, executor): wait for an event, semaphore or
+	waitable_timer (or, on Windows, a mutex).  Like waiter::wait, this
+	acquires the object.
+\* ---------------------------------------------------------------------------------*/
+
+template<class lock_t, class executor_t>
+class wait_awaiter
+{
+public:
+	wait_awaiter(lock_t& lock, executor_t& executor) : lock_(lock), executor_(executor) {}
+
+	bool await_ready() const noexcept { return false; }
+
+	void await_suspend(std::coroutine_handle<> handle)
+	{
+		executor_t* executor = &executor_;
+		waiter::register_wait(lock_, [executor, handle]{ resume_on(*executor, handle); });
+	}
+
+	void await_resume() const noexcept {}
+
+private:
+	lock_t& lock_;
+	executor_t& executor_;
+};
+
+template<class lock_t, class executor_t>
+wait_awaiter<lock_t,executor_t> async_wait(lock_t& lock, executor_t& executor)
+{
+	return wait_awaiter<lock_t,executor_t>(lock, executor);
+}
+
+#endif
+
+
+} // namespace dumbnose
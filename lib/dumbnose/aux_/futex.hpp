@@ -0,0 +1,145 @@
+#pragma once
+
+//
+//	futex
+//
+//	Minimal wait-on-address primitives over a 32-bit atomic word.  Linux
+//	uses the futex syscall, Windows uses WaitOnAddress, and anything else
+//	falls back to C++20 atomic wait.  All waits may return spuriously, so
+//	callers must re-check their condition in a loop.
+//
+//	Words in memory shared between processes need process_shared, which is
+//	only honoured on Linux; elsewhere waits are process-local.
+//
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <thread>
+
+#if defined(_WIN32)
+#include <windows.h>
+#pragma comment(lib, "synchronization.lib")
+#elif defined(__linux__)
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <cerrno>
+#include <climits>
+#include <ctime>
+#endif
+
+
+namespace dumbnose { namespace aux {
+
+
+typedef std::atomic<std::uint32_t> futex_word;
+
+static_assert(sizeof(futex_word)==sizeof(std::uint32_t), "futex_word must be a plain 32-bit word");
+static_assert(futex_word::is_always_lock_free, "futex_word must be lock free");
+
+
+#if defined(__linux__)
+
+inline long futex_call(futex_word& word, int op, std::uint32_t val, const timespec* timeout, bool process_shared)
+{
+	if(!process_shared) op |= FUTEX_PRIVATE_FLAG;
+	return syscall(SYS_futex, reinterpret_cast<std::uint32_t*>(&word), op, val, timeout, nullptr, 0);
+}
+
+#endif
+
+
+//
+//	Block while word==expected.
+//
+inline void futex_wait(futex_word& word, std::uint32_t expected, bool process_shared = false)
+{
+#if defined(_WIN32)
+	(void)process_shared;
+	WaitOnAddress(&word, &expected, sizeof(expected), INFINITE);
+#elif defined(__linux__)
+	futex_call(word, FUTEX_WAIT, expected, nullptr, process_shared);
+#else
+	(void)process_shared;
+	word.wait(expected);
+#endif
+}
+
+//
+//	Block while word==expected, for at most timeout.  Returns false if the
+//	timeout expired.
+//
+inline bool futex_wait_for(futex_word& word, std::uint32_t expected, std::chrono::nanoseconds timeout, bool process_shared = false)
+{
+	if(timeout.count()<=0) return word.load(std::memory_order_acquire)!=expected;
+
+#if defined(_WIN32)
+	(void)process_shared;
+	DWORD ms = static_cast<DWORD>(std::chrono::ceil<std::chrono::milliseconds>(timeout).count());
+	if(WaitOnAddress(&word, &expected, sizeof(expected), ms)) return true;
+	return GetLastError()!=ERROR_TIMEOUT;
+#elif defined(__linux__)
+	timespec ts;
+	ts.tv_sec = static_cast<time_t>(timeout.count() / 1000000000);
+	ts.tv_nsec = static_cast<long>(timeout.count() % 1000000000);
+	if(futex_call(word, FUTEX_WAIT, expected, &ts, process_shared)==0) return true;
+	return errno!=ETIMEDOUT;
+#else
+	(void)process_shared;
+	// no timed atomic wait in the standard; poll with a short sleep
+	std::this_thread::sleep_for(std::min<std::chrono::nanoseconds>(timeout, std::chrono::microseconds(50)));
+	return word.load(std::memory_order_acquire)!=expected;
+#endif
+}
+
+//
+//	Block while word==expected, until deadline.  Returns false if the
+//	deadline passed.
+//
+inline bool futex_wait_until(futex_word& word, std::uint32_t expected, std::chrono::steady_clock::time_point deadline, bool process_shared = false)
+{
+	return futex_wait_for(word, expected, deadline-std::chrono::steady_clock::now(), process_shared);
+}
+
+inline void futex_wake_one(futex_word& word, bool process_shared = false)
+{
+#if defined(_WIN32)
+	(void)process_shared;
+	WakeByAddressSingle(&word);
+#elif defined(__linux__)
+	futex_call(word, FUTEX_WAKE, 1, nullptr, process_shared);
+#else
+	(void)process_shared;
+	word.notify_one();
+#endif
+}
+
+inline void futex_wake_all(futex_word& word, bool process_shared = false)
+{
+#if defined(_WIN32)
+	(void)process_shared;
+	WakeByAddressAll(&word);
+#elif defined(__linux__)
+	futex_call(word, FUTEX_WAKE, INT_MAX, nullptr, process_shared);
+#else
+	(void)process_shared;
+	word.notify_all();
+#endif
+}
+
+// Wake at most count waiters
+inline void futex_wake(futex_word& word, unsigned int count, bool process_shared = false)
+{
+#if defined(__linux__)
+	futex_call(word, FUTEX_WAKE, count>static_cast<unsigned int>(INT_MAX) ? INT_MAX : count, nullptr, process_shared);
+#else
+	// no counted wake; past a handful of waiters waking everybody is cheaper
+	if(count>8) { futex_wake_all(word, process_shared); return; }
+	for(unsigned int i=0 ; i<count ; ++i) futex_wake_one(word, process_shared);
+#endif
+}
+
+
+}} // namespace dumbnose::aux
@@ -0,0 +1,333 @@
+#pragma once
+
+//
+//	futex_sync
+//
+//	User-space synchronization objects over futex words, used for the
+//	POSIX implementations of critical_section, mutex, semaphore and event.
+//	Uncontended operations are a single atomic instruction; a thread only
+//	enters the kernel when it actually has to sleep, and a waker only makes
+//	a syscall when somebody is asleep.
+//
+//	Timed operations take an optional steady_clock deadline; an empty
+//	deadline waits forever.
+//
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <optional>
+#include <thread>
+#include <dumbnose/noncopyable.hpp>
+#include <dumbnose/aux_/futex.hpp>
+#include <dumbnose/aux_/spin_wait.hpp>
+
+
+namespace dumbnose { namespace aux {
+
+
+typedef std::optional<std::chrono::steady_clock::time_point> futex_deadline;
+
+
+// Deadline for a Win32-style millisecond timeout, where 0xFFFFFFFF (INFINITE) means none
+inline futex_deadline deadline_after_ms(unsigned int wait_time)
+{
+	if(wait_time==0xFFFFFFFFu) return std::nullopt;
+	return std::chrono::steady_clock::now()+std::chrono::milliseconds(wait_time);
+}
+
+// Returns false once the deadline has passed
+inline bool futex_wait(futex_word& word, std::uint32_t expected, futex_deadline const & deadline, bool process_shared = false)
+{
+	if(!deadline) {
+		futex_wait(word, expected, process_shared);
+		return true;
+	}
+	return futex_wait_until(word, expected, *deadline, process_shared);
+}
+
+// Spinning is pointless when the lock holder cannot run at the same time
+inline unsigned int max_adaptive_spins()
+{
+	static const unsigned int spins = std::thread::hardware_concurrency()>1 ? 100 : 0;
+	return spins;
+}
+
+
+//
+//	Three-state futex lock (0 unlocked, 1 locked, 2 locked with sleepers)
+//	with adaptive spinning: each lock tracks how long recent acquisitions
+//	spun before succeeding and bounds its next spin to about twice that.
+//
+class futex_lock : dumbnose::noncopyable
+{
+public:
+	void lock() { lock(std::nullopt); }
+
+	bool try_lock()
+	{
+		std::uint32_t expected = unlocked;
+		return state_.compare_exchange_strong(expected, locked, std::memory_order_acquire, std::memory_order_relaxed);
+	}
+
+	// Returns false if the deadline passed first
+	bool lock(futex_deadline const & deadline)
+	{
+		if(try_lock() || spin_lock()) return true;
+
+		// announce a sleeper; whoever unlocks from state 2 has to wake one
+		while(state_.exchange(contended, std::memory_order_acquire)!=unlocked) {
+			if(!futex_wait(state_, contended, deadline)) return false;
+		}
+		return true;
+	}
+
+	void unlock()
+	{
+		if(state_.exchange(unlocked, std::memory_order_release)==contended) futex_wake_one(state_);
+	}
+
+private:
+	enum : std::uint32_t { unlocked = 0, locked = 1, contended = 2 };
+
+	bool spin_lock()
+	{
+		unsigned int limit = max_adaptive_spins();
+		if(limit==0) return false;
+
+		int average = spins_.load(std::memory_order_relaxed);
+		limit = std::min(limit, static_cast<unsigned int>(average)*2+10);
+
+		unsigned int count = 0;
+		bool acquired = false;
+		for( ; count<limit ; ++count) {
+			cpu_relax();
+			if(state_.load(std::memory_order_relaxed)==unlocked && try_lock()) {
+				acquired = true;
+				break;
+			}
+		}
+
+		// running average, as in glibc's adaptive mutexes; racy updates are harmless
+		spins_.store(average+(static_cast<int>(count)-average)/8, std::memory_order_relaxed);
+		return acquired;
+	}
+
+	futex_word state_{unlocked};
+	std::atomic<int> spins_{0};
+};
+
+
+//
+//	futex_lock that its owner may acquire again
+//
+class recursive_futex_lock : dumbnose::noncopyable
+{
+public:
+	void lock() { lock(std::nullopt); }
+
+	bool try_lock()
+	{
+		if(owned()) { ++depth_; return true; }
+		if(!lock_.try_lock()) return false;
+		take_ownership();
+		return true;
+	}
+
+	bool lock(futex_deadline const & deadline)
+	{
+		if(owned()) { ++depth_; return true; }
+		if(!lock_.lock(deadline)) return false;
+		take_ownership();
+		return true;
+	}
+
+	void unlock()
+	{
+		if(--depth_>0) return;
+		owner_.store(std::thread::id(), std::memory_order_relaxed);
+		lock_.unlock();
+	}
+
+private:
+	// only the owner itself can ever observe its own id here
+	bool owned() const { return owner_.load(std::memory_order_relaxed)==std::this_thread::get_id(); }
+
+	void take_ownership()
+	{
+		owner_.store(std::this_thread::get_id(), std::memory_order_relaxed);
+		depth_ = 1;
+	}
+
+	futex_lock lock_;
+	std::atomic<std::thread::id> owner_{};
+	unsigned int depth_ = 0;
+};
+
+
+//
+//	Counting semaphore bounded by max_count.  A process_shared semaphore
+//	may be placed in shared memory and used from several processes.
+//
+class futex_semaphore : dumbnose::noncopyable
+{
+public:
+	futex_semaphore(std::uint32_t initial_count, std::uint32_t max_count, bool process_shared = false)
+		: count_(initial_count), max_count_(max_count), process_shared_(process_shared) {}
+
+	bool try_acquire()
+	{
+		std::uint32_t count = count_.load(std::memory_order_relaxed);
+		while(count>0) {
+			if(count_.compare_exchange_weak(count, count-1, std::memory_order_acquire, std::memory_order_relaxed)) return true;
+		}
+		return false;
+	}
+
+	bool acquire(futex_deadline const & deadline = std::nullopt)
+	{
+		spin_wait spinner;
+		for(;;) {
+			if(try_acquire()) return true;
+			if(spinner.spin()) continue;
+
+			waiters_.fetch_add(1, std::memory_order_seq_cst);
+			bool in_time = futex_wait(count_, 0, deadline, process_shared_);
+			waiters_.fetch_sub(1, std::memory_order_relaxed);
+
+			if(!in_time) return try_acquire();
+		}
+	}
+
+	std::uint32_t count() const { return count_.load(std::memory_order_acquire); }
+
+	// Returns false, releasing nothing, if the count would exceed max_count
+	bool release(std::uint32_t count = 1)
+	{
+		std::uint32_t current = count_.load(std::memory_order_relaxed);
+		do {
+			if(count>max_count_-current) return false;
+		} while(!count_.compare_exchange_weak(current, current+count, std::memory_order_seq_cst, std::memory_order_relaxed));
+
+		if(waiters_.load(std::memory_order_seq_cst)!=0) futex_wake(count_, count, process_shared_);
+		return true;
+	}
+
+private:
+	futex_word count_;
+	const std::uint32_t max_count_;
+	const bool process_shared_;
+	futex_word waiters_{0};
+};
+
+
+//
+//	Manual or auto-reset event.  Bit 0 of the state is the signaled flag and
+//	the remaining bits count pulses, so that a manual-reset pulse releases
+//	exactly the threads that were waiting when it happened.
+//
+class futex_event : dumbnose::noncopyable
+{
+public:
+	futex_event(bool manual_reset, bool initial_state)
+		: manual_reset_(manual_reset), state_(initial_state ? std::uint32_t(signaled) : 0) {}
+
+	bool wait(futex_deadline const & deadline = std::nullopt)
+	{
+		return wait_from(ticket(), deadline);
+	}
+
+	//
+	//	Snapshot for wait_from().  Taking it before signaling something else
+	//	closes the gap between the two, so a pulse in between isn't lost.
+	//
+	std::uint32_t ticket() const { return state_.load(std::memory_order_acquire); }
+
+	bool wait_from(std::uint32_t ticket, futex_deadline const & deadline = std::nullopt)
+	{
+		const std::uint32_t generation = ticket>>1;
+		std::uint32_t state = state_.load(std::memory_order_acquire);
+
+		spin_wait spinner;
+		bool in_time = true;
+		for(;;) {
+			if(state & signaled) {
+				if(manual_reset_ || consume(state)) return true;
+				continue;
+			}
+			if((state>>1)!=generation) return true;
+			if(!in_time) return false;
+
+			if(!spinner.spin()) {
+				waiters_.fetch_add(1, std::memory_order_seq_cst);
+				in_time = futex_wait(state_, state, deadline);
+				waiters_.fetch_sub(1, std::memory_order_relaxed);
+			}
+			state = state_.load(std::memory_order_acquire);
+		}
+	}
+
+	bool try_wait()
+	{
+		std::uint32_t state = state_.load(std::memory_order_acquire);
+		while(state & signaled) {
+			if(manual_reset_ || consume(state)) return true;
+		}
+		return false;
+	}
+
+	bool is_set() const { return (state_.load(std::memory_order_acquire) & signaled)!=0; }
+
+	void set()
+	{
+		std::uint32_t previous = state_.fetch_or(signaled, std::memory_order_seq_cst);
+		if(manual_reset_ && (previous & signaled)) return;
+		wake();
+	}
+
+	void reset()
+	{
+		state_.fetch_and(~static_cast<std::uint32_t>(signaled), std::memory_order_release);
+	}
+
+	//
+	//	Release the threads waiting right now and leave the event reset.  An
+	//	auto-reset event releases at most one of them, and only if somebody
+	//	is waiting, like Win32's PulseEvent.
+	//
+	void pulse()
+	{
+		if(!manual_reset_) {
+			if(waiters_.load(std::memory_order_seq_cst)!=0) set();
+			return;
+		}
+
+		std::uint32_t state = state_.load(std::memory_order_relaxed);
+		while(!state_.compare_exchange_weak(state, (state+2) & ~static_cast<std::uint32_t>(signaled), std::memory_order_seq_cst, std::memory_order_relaxed)) {}
+		wake();
+	}
+
+private:
+	enum : std::uint32_t { signaled = 1 };
+
+	// Auto-reset: clear the signal we saw; on failure state is reloaded
+	bool consume(std::uint32_t& state)
+	{
+		return state_.compare_exchange_weak(state, state & ~signaled, std::memory_order_acquire, std::memory_order_acquire);
+	}
+
+	void wake()
+	{
+		if(waiters_.load(std::memory_order_seq_cst)==0) return;
+		if(manual_reset_) futex_wake_all(state_);
+		else futex_wake_one(state_);
+	}
+
+	const bool manual_reset_;
+	futex_word state_;
+	futex_word waiters_{0};
+};
+
+
+}} // namespace dumbnose::aux
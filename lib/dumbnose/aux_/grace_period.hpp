@@ -0,0 +1,129 @@
+#pragma once
+
+//
+//	grace_period
+//
+//	Minimal read-copy-update style reclamation.  Readers bracket their use
+//	of shared data with enter()/leave(), which only touch a per-CPU counter
+//	and never wait.  A writer that has unpublished something calls
+//	synchronize() to wait until every reader that might still see it has
+//	left; after that it may be destroyed or reused.
+//
+//	Readers are counted in one of two phases.  synchronize() flips the
+//	phase and waits for the old one to drain, so a steady stream of new
+//	readers cannot hold a writer up, and nested read sections are fine.
+//	Waiting for readers from inside a read section deadlocks, of course.
+//	read_section keeps an intrusive per-thread list of the sections open on
+//	the calling thread, so a writer can ask reading() (this grace_period)
+//	or reading_any() (any at all) and defer its reclamation rather than
+//	wait for itself.  Bare enter()/leave() are not tracked.
+//
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <thread>
+#include <dumbnose/noncopyable.hpp>
+#include <dumbnose/thread_affinity.hpp>
+#include <dumbnose/aux_/spin_wait.hpp>
+
+
+namespace dumbnose { namespace aux {
+
+
+class grace_period : dumbnose::noncopyable
+{
+public:
+	// Identifies the counter a reader went to
+	typedef std::size_t token;
+
+	grace_period() : slot_mask_(cpu_shard_count()-1), slots_(new slot_t[slot_mask_+1]) {}
+
+	token enter() const
+	{
+		std::size_t slot = current_cpu() & slot_mask_;
+		for(;;) {
+			std::uint32_t phase = phase_.load(std::memory_order_seq_cst) & 1;
+			std::atomic<std::uint32_t>& readers = slots_[slot].readers_[phase];
+
+			readers.fetch_add(1, std::memory_order_seq_cst);
+			// if the phase moved on, a writer may already have found this count drained
+			if((phase_.load(std::memory_order_seq_cst) & 1)==phase) return slot*2+phase;
+			readers.fetch_sub(1, std::memory_order_release);
+		}
+	}
+
+	void leave(token reader) const
+	{
+		slots_[reader/2].readers_[reader%2].fetch_sub(1, std::memory_order_release);
+	}
+
+	// Callers must serialize synchronize() among themselves
+	void synchronize() const
+	{
+		std::uint32_t old_phase = phase_.fetch_add(1, std::memory_order_seq_cst) & 1;
+
+		for(std::size_t slot=0 ; slot<=slot_mask_ ; ++slot) {
+			std::atomic<std::uint32_t>& readers = slots_[slot].readers_[old_phase];
+
+			spin_wait spinner;
+			while(readers.load(std::memory_order_seq_cst)!=0) {
+				if(!spinner.spin()) std::this_thread::yield();
+			}
+		}
+	}
+
+	// enter()/leave() for a scope
+	class read_section : dumbnose::noncopyable
+	{
+	public:
+		explicit read_section(grace_period const & period) : period_(period), reader_(period.enter()), outer_(innermost_)
+		{
+			innermost_ = this;
+		}
+
+		~read_section()
+		{
+			innermost_ = outer_;
+			period_.leave(reader_);
+		}
+
+	private:
+		friend class grace_period;
+
+		grace_period const & period_;
+		const token reader_;
+		read_section const * const outer_;
+
+		static inline thread_local read_section const * innermost_ = nullptr;
+	};
+
+	// Whether the calling thread has a read_section of this grace_period open
+	bool reading() const
+	{
+		for(read_section const * section=read_section::innermost_ ; section ; section=section->outer_) {
+			if(&section->period_==this) return true;
+		}
+		return false;
+	}
+
+	// Whether the calling thread has any read_section open
+	static bool reading_any()
+	{
+		return read_section::innermost_!=nullptr;
+	}
+
+private:
+	struct alignas(cache_line_size) slot_t
+	{
+		std::atomic<std::uint32_t> readers_[2] = {};
+	};
+
+	const std::size_t slot_mask_;
+	std::unique_ptr<slot_t[]> slots_;
+	alignas(cache_line_size) mutable std::atomic<std::uint32_t> phase_{0};
+};
+
+
+}} // namespace dumbnose::aux
@@ -0,0 +1,36 @@
+#pragma once
+
+//
+//	handle_wait
+//
+//	WaitForSingleObject against a steady_clock deadline.  Waits longer than
+//	a DWORD of milliseconds are split up, and the remaining time is
+//	re-measured after each slice.
+//
+
+#include <chrono>
+#include <windows.h>
+
+
+namespace dumbnose { namespace aux {
+
+
+// Returns WAIT_OBJECT_0, WAIT_ABANDONED, WAIT_TIMEOUT or WAIT_FAILED
+inline DWORD wait_for_handle_until(HANDLE handle, std::chrono::steady_clock::time_point deadline)
+{
+	using namespace std::chrono;
+
+	for(;;) {
+		steady_clock::duration remaining = deadline-steady_clock::now();
+		if(remaining.count()<0) remaining = steady_clock::duration::zero();
+
+		long long ms = ceil<milliseconds>(remaining).count();
+		DWORD slice = ms>=INFINITE ? INFINITE-1 : static_cast<DWORD>(ms);
+
+		DWORD result = WaitForSingleObject(handle, slice);
+		if(WAIT_TIMEOUT!=result || slice==static_cast<DWORD>(ms)) return result;
+	}
+}
+
+
+}} // namespace dumbnose::aux
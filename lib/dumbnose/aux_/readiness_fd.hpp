@@ -0,0 +1,89 @@
+#pragma once
+
+//
+//	readiness_fd
+//
+//	Lazily created eventfd that mirrors whether a user-space object (an
+//	event or a semaphore) is signaled, so the object can take part in
+//	poll/epoll waits.  Objects nobody waits on that way never create one
+//	and pay only an atomic load per state change.
+//
+//	The owner calls sync() after every change of its state.  The descriptor
+//	is only a hint: it can briefly be readable while the object is not
+//	signaled, so waiters must try to take the object and call sync()
+//	themselves when that fails.
+//
+
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <system_error>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <dumbnose/noncopyable.hpp>
+#include <dumbnose/aux_/futex_sync.hpp>
+
+
+namespace dumbnose { namespace aux {
+
+
+class readiness_fd : dumbnose::noncopyable
+{
+public:
+	~readiness_fd()
+	{
+		int fd = fd_.load(std::memory_order_relaxed);
+		if(fd>=0) close(fd);
+	}
+
+	// Descriptor that polls readable while signaled() holds, created on first use
+	template<class signaled_t>
+	int get(signaled_t signaled)
+	{
+		if(fd_.load(std::memory_order_acquire)<0) {
+			lock_.lock();
+			if(fd_.load(std::memory_order_relaxed)<0) {
+				int fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+				if(fd<0) {
+					lock_.unlock();
+					throw std::system_error(errno, std::system_category(), "eventfd failed");
+				}
+				readable_ = false;
+				fd_.store(fd, std::memory_order_seq_cst);
+			}
+			lock_.unlock();
+		}
+
+		sync(signaled);
+		return fd_.load(std::memory_order_relaxed);
+	}
+
+	// Bring the descriptor in line with signaled()
+	template<class signaled_t>
+	void sync(signaled_t signaled)
+	{
+		// pairs with the owner's seq_cst state change: either it sees the
+		// descriptor or get() sees its new state
+		int fd = fd_.load(std::memory_order_seq_cst);
+		if(fd<0) return;
+
+		lock_.lock();
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		bool ready = signaled();
+		if(ready!=readable_) {
+			std::uint64_t value = 1;
+			if(ready) (void)!write(fd, &value, sizeof(value));
+			else (void)!read(fd, &value, sizeof(value));
+			readable_ = ready;
+		}
+		lock_.unlock();
+	}
+
+private:
+	std::atomic<int> fd_{-1};
+	futex_lock lock_;
+	bool readable_ = false;
+};
+
+
+}} // namespace dumbnose::aux
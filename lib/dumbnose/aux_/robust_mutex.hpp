@@ -0,0 +1,110 @@
+#pragma once
+
+//
+//	robust_mutex
+//
+//	Recursive, process-shared, robust pthread mutex for use in shared
+//	memory.  If its owner dies while holding it, the next locker gets it
+//	with lock_result::abandoned (like WAIT_ABANDONED) instead of blocking
+//	forever, and the mutex is made usable again.
+//
+
+#include <cerrno>
+#include <chrono>
+#include <ctime>
+#include <system_error>
+#include <pthread.h>
+#include <dumbnose/noncopyable.hpp>
+#include <dumbnose/aux_/futex_sync.hpp>
+
+
+namespace dumbnose { namespace aux {
+
+
+enum class lock_result { acquired, abandoned, timed_out };
+
+
+class robust_mutex : dumbnose::noncopyable
+{
+public:
+	robust_mutex()
+	{
+		pthread_mutexattr_t attributes;
+		pthread_mutexattr_init(&attributes);
+		pthread_mutexattr_setpshared(&attributes, PTHREAD_PROCESS_SHARED);
+		pthread_mutexattr_setrobust(&attributes, PTHREAD_MUTEX_ROBUST);
+		pthread_mutexattr_settype(&attributes, PTHREAD_MUTEX_RECURSIVE);
+		int error = pthread_mutex_init(&mutex_, &attributes);
+		pthread_mutexattr_destroy(&attributes);
+
+		if(error) throw std::system_error(error, std::system_category(), "pthread_mutex_init failed");
+	}
+
+	lock_result lock(futex_deadline const & deadline = std::nullopt)
+	{
+		int error;
+		if(!deadline) {
+			error = pthread_mutex_lock(&mutex_);
+		} else {
+			timespec until = to_timespec(*deadline);
+#if defined(__GLIBC__) && (__GLIBC__>2 || (__GLIBC__==2 && __GLIBC_MINOR__>=30))
+			error = pthread_mutex_clocklock(&mutex_, CLOCK_MONOTONIC, &until);
+#else
+			error = pthread_mutex_timedlock(&mutex_, &until);
+#endif
+		}
+		return result_of(error);
+	}
+
+	// A mutex held by somebody else comes back as timed_out
+	lock_result try_lock()
+	{
+		int error = pthread_mutex_trylock(&mutex_);
+		if(EBUSY==error) return lock_result::timed_out;
+		return result_of(error);
+	}
+
+	void unlock()
+	{
+		pthread_mutex_unlock(&mutex_);
+	}
+
+private:
+	lock_result result_of(int error)
+	{
+		switch(error) {
+		case 0:
+			return lock_result::acquired;
+		case ETIMEDOUT:
+			return lock_result::timed_out;
+		case EOWNERDEAD:
+			// whatever the dead owner protected may be half-updated; the caller is told
+			pthread_mutex_consistent(&mutex_);
+			return lock_result::abandoned;
+		default:
+			throw std::system_error(error, std::system_category(), "pthread_mutex_lock failed");
+		}
+	}
+
+	static timespec to_timespec(std::chrono::steady_clock::time_point deadline)
+	{
+		using namespace std::chrono;
+#if defined(__GLIBC__) && (__GLIBC__>2 || (__GLIBC__==2 && __GLIBC_MINOR__>=30))
+		// steady_clock is CLOCK_MONOTONIC
+		nanoseconds since = duration_cast<nanoseconds>(deadline.time_since_epoch());
+#else
+		nanoseconds since = duration_cast<nanoseconds>((system_clock::now()+(deadline-steady_clock::now())).time_since_epoch());
+#endif
+		if(since.count()<0) since = nanoseconds(0);
+
+		timespec result;
+		result.tv_sec = static_cast<time_t>(since.count() / 1000000000);
+		result.tv_nsec = static_cast<long>(since.count() % 1000000000);
+		return result;
+	}
+
+	pthread_mutex_t mutex_;
+};
+
+
+}} // namespace dumbnose::aux
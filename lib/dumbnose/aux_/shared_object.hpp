@@ -0,0 +1,107 @@
+#pragma once
+
+//
+//	shared_object
+//
+//	An object that lives in named shared memory.  The first process to open
+//	the name constructs it there; everybody else waits until that is done
+//	and then uses the same instance.  The object is never destroyed, so it
+//	must not own anything outside the shared block (futex words and robust
+//	pthread mutexes are fine).
+//
+//	While the object is being built, the state word holds the creator's
+//	pid.  If the constructor throws, the state goes back to uninitialized
+//	and the next opener tries again; if the creator dies half way, waiters
+//	notice within a poll interval and one of them takes over.
+//
+//	The name outlives every process that opened it, object state
+//	included, until remove() deletes it.
+//
+
+#include <cerrno>
+#include <chrono>
+#include <new>
+#include <string>
+#include <utility>
+#include <signal.h>
+#include <unistd.h>
+#include <dumbnose/noncopyable.hpp>
+#include <dumbnose/shared_memory.hpp>
+#include <dumbnose/aux_/futex.hpp>
+#include <dumbnose/aux_/spin_wait.hpp>
+
+
+namespace dumbnose { namespace aux {
+
+
+template<class object_t>
+class shared_object : dumbnose::noncopyable
+{
+public:
+	template<class... args_t>
+	explicit shared_object(std::wstring const & name, args_t&&... args)
+		: memory_(sizeof(block_t), name), block_(static_cast<block_t*>(memory_.mem_start()))
+	{
+		// fresh shared memory is zero-filled, i.e. uninitialized
+		const std::uint32_t self = static_cast<std::uint32_t>(getpid());
+		for(;;) {
+			std::uint32_t state = block_->state_.load(std::memory_order_acquire);
+			if(state==ready) return;
+
+			if(state==uninitialized) {
+				if(!block_->state_.compare_exchange_strong(state, self, std::memory_order_acquire)) continue;
+				construct(std::forward<args_t>(args)...);
+				return;
+			}
+
+			// being constructed by process state
+			if(futex_wait_for(block_->state_, state, creator_poll, true)) continue;
+			if(kill(static_cast<pid_t>(state), 0)!=0 && errno==ESRCH) {
+				if(block_->state_.compare_exchange_strong(state, uninitialized, std::memory_order_relaxed)) futex_wake_all(block_->state_, true);
+			}
+		}
+	}
+
+	object_t& get() const
+	{
+		return *std::launder(reinterpret_cast<object_t*>(&block_->storage_));
+	}
+
+	// Delete the name; processes that have it open keep using the object
+	static bool remove(std::wstring const & name)
+	{
+		return shared_memory::remove(name);
+	}
+
+private:
+	// uninitialized, ready, or the pid of the process constructing the object
+	enum : std::uint32_t { uninitialized = 0, ready = 0xFFFFFFFF };
+
+	static constexpr std::chrono::milliseconds creator_poll{100};
+
+	template<class... args_t>
+	void construct(args_t&&... args)
+	{
+		try {
+			new (&block_->storage_) object_t(std::forward<args_t>(args)...);
+		} catch(...) {
+			block_->state_.store(uninitialized, std::memory_order_release);
+			futex_wake_all(block_->state_, true);
+			throw;
+		}
+		block_->state_.store(ready, std::memory_order_release);
+		futex_wake_all(block_->state_, true);
+	}
+
+	struct block_t
+	{
+		futex_word state_;
+		alignas(cache_line_size) alignas(object_t) unsigned char storage_[sizeof(object_t)];
+	};
+
+	shared_memory memory_;
+	block_t* block_;
+};
+
+
+}} // namespace dumbnose::aux
@@ -0,0 +1,66 @@
+#pragma once
+
+//
+//	spin_wait
+//
+//	Bounded exponential backoff used before falling back to a futex wait.
+//	The spin budget is a runtime value so that callers can tune it (or set
+//	it to zero on oversubscribed machines).
+//
+
+#include <cstddef>
+#include <thread>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+
+namespace dumbnose { namespace aux {
+
+
+// Size used to pad hot atomics onto their own cache line
+const std::size_t cache_line_size = 64;
+
+
+inline void cpu_relax()
+{
+#if defined(_MSC_VER) && (defined(_M_IX86) || defined(_M_X64))
+	_mm_pause();
+#elif defined(__i386__) || defined(__x86_64__)
+	__builtin_ia32_pause();
+#elif defined(__aarch64__)
+	asm volatile("yield" ::: "memory");
+#endif
+}
+
+
+class spin_wait
+{
+public:
+	static constexpr unsigned int default_spin_count = 40;
+
+	explicit spin_wait(unsigned int spin_count = default_spin_count) : limit_(spin_count), count_(0) {}
+
+	// Returns false once the spin budget is exhausted and the caller should block
+	bool spin()
+	{
+		if(count_>=limit_) return false;
+
+		// back off exponentially, capped so that a single spin stays short
+		unsigned int pauses = 1u << (count_<4 ? count_ : 4);
+		for(unsigned int i=0 ; i<pauses ; ++i) cpu_relax();
+
+		++count_;
+		return true;
+	}
+
+	void reset() { count_ = 0; }
+
+private:
+	unsigned int limit_;
+	unsigned int count_;
+};
+
+
+}} // namespace dumbnose::aux
@@ -0,0 +1,158 @@
+#pragma once
+
+//
+//	wait_reactor
+//
+//	One epoll thread that runs a callback once a descriptor-backed object
+//	has been taken, the Linux counterpart of RegisterWaitForSingleObject.
+//	Registrations are one-shot; when the descriptor turns readable the
+//	reactor tries to take the object and re-arms if somebody beat it to
+//	it.  Callbacks run on the reactor thread, so they should only hand
+//	work off.  Pending registrations are dropped when the reactor goes.
+//
+
+#include <cerrno>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <system_error>
+#include <thread>
+#include <unordered_set>
+#include <utility>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <dumbnose/noncopyable.hpp>
+
+
+namespace dumbnose { namespace aux {
+
+
+class wait_reactor : dumbnose::noncopyable
+{
+public:
+	wait_reactor()
+	{
+		epoll_ = epoll_create1(EPOLL_CLOEXEC);
+		if(epoll_<0) throw std::system_error(errno, std::system_category(), "epoll_create1 failed");
+
+		stop_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+		if(stop_<0) {
+			close(epoll_);
+			throw std::system_error(errno, std::system_category(), "eventfd failed");
+		}
+
+		epoll_event event = {};
+		event.events = EPOLLIN;
+		event.data.ptr = nullptr;
+		epoll_ctl(epoll_, EPOLL_CTL_ADD, stop_, &event);
+
+		thread_ = std::thread(&wait_reactor::run, this);
+	}
+
+	~wait_reactor()
+	{
+		std::uint64_t value = 1;
+		(void)!write(stop_, &value, sizeof(value));
+		thread_.join();
+
+		for(registration_t* registration : registrations_) {
+			close(registration->fd_);
+			delete registration;
+		}
+		close(stop_);
+		close(epoll_);
+	}
+
+	// Process-wide reactor for waiter::register_wait
+	static wait_reactor& shared()
+	{
+		static wait_reactor reactor;
+		return reactor;
+	}
+
+	//
+	//	Once fd is readable and take() succeeds, run callback.  fd is
+	//	duplicated, so one object can have several registrations.
+	//
+	void add(int fd, std::function<bool()> take, std::function<void()> callback)
+	{
+		registration_t* registration = new registration_t{dup(fd), std::move(take), std::move(callback)};
+		if(registration->fd_<0) {
+			delete registration;
+			throw std::system_error(errno, std::system_category(), "dup failed");
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(lock_);
+			registrations_.insert(registration);
+		}
+
+		if(!arm(registration, EPOLL_CTL_ADD)) {
+			int error = errno;
+			forget(registration);
+			throw std::system_error(error, std::system_category(), "epoll_ctl failed");
+		}
+	}
+
+private:
+	struct registration_t
+	{
+		int fd_;
+		std::function<bool()> take_;
+		std::function<void()> callback_;
+	};
+
+	bool arm(registration_t* registration, int op)
+	{
+		epoll_event event = {};
+		event.events = EPOLLIN | EPOLLONESHOT;
+		event.data.ptr = registration;
+		return epoll_ctl(epoll_, op, registration->fd_, &event)==0;
+	}
+
+	void forget(registration_t* registration)
+	{
+		{
+			std::lock_guard<std::mutex> lock(lock_);
+			registrations_.erase(registration);
+		}
+		close(registration->fd_);	// also removes it from the epoll set
+		delete registration;
+	}
+
+	void run()
+	{
+		epoll_event events[64];
+		for(;;) {
+			int count = epoll_wait(epoll_, events, 64, -1);
+			if(count<0) {
+				if(errno==EINTR) continue;
+				return;
+			}
+
+			for(int i=0 ; i<count ; ++i) {
+				registration_t* registration = static_cast<registration_t*>(events[i].data.ptr);
+				if(!registration) return;
+
+				if(!registration->take_()) {
+					arm(registration, EPOLL_CTL_MOD);
+					continue;
+				}
+
+				std::function<void()> callback = std::move(registration->callback_);
+				forget(registration);
+				callback();
+			}
+		}
+	}
+
+	int epoll_;
+	int stop_;
+	std::mutex lock_;
+	std::unordered_set<registration_t*> registrations_;
+	std::thread thread_;
+};
+
+
+}} // namespace dumbnose::aux
@@ -0,0 +1,215 @@
+#pragma once
+
+//
+//	barrier
+//
+//	In-process barriers built on atomics.  Arriving threads never enter the
+//	kernel unless they have run out of spinning and have to sleep, and the
+//	last arrival only makes a wake-up syscall when somebody is asleep.
+//
+//	sense_barrier	one shared counter; the simplest and fastest choice for
+//					up to a dozen or so threads
+//	tree_barrier	combining tree of small counters, so arrivals contend
+//					on their own node instead of one cache line; for large
+//					thread counts.  Each thread passes its index.
+//
+//	Both are reusable: a thread may call wait() again as soon as it returns.
+//	wait() returns true in exactly one thread per phase (the last to arrive),
+//	which is handy for serial work between phases.
+//
+//	spin_count sets how often a waiter polls before it sleeps on a futex:
+//	0 sleeps straight away (oversubscribed machines), spin_forever never
+//	sleeps (dedicated cores, lowest latency).
+//
+//	A process_shared sense_barrier may live in shared memory and be used
+//	by several processes; see thread_barrier's named constructor.
+//
+
+#include <atomic>
+#include <climits>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <dumbnose/noncopyable.hpp>
+#include <dumbnose/aux_/futex.hpp>
+#include <dumbnose/aux_/spin_wait.hpp>
+
+
+namespace dumbnose {
+
+
+namespace aux {
+
+
+//
+// The phase word shared by both barriers.  Waiters wait for it to move on;
+// the thread completing a phase advances it.
+//
+class barrier_phase
+{
+public:
+	static constexpr unsigned int spin_forever = UINT_MAX;
+
+	explicit barrier_phase(unsigned int spin_count, bool process_shared = false)
+		: spin_count_(spin_count), process_shared_(process_shared) {}
+
+	std::uint32_t current() const { return phase_.load(std::memory_order_acquire); }
+
+	void wait_past(std::uint32_t phase)
+	{
+		if(spin_count_==spin_forever) {
+			while(phase_.load(std::memory_order_acquire)==phase) cpu_relax();
+			return;
+		}
+
+		spin_wait spinner(spin_count_);
+		while(phase_.load(std::memory_order_acquire)==phase) {
+			if(spinner.spin()) continue;
+
+			sleepers_.fetch_add(1, std::memory_order_seq_cst);
+			futex_wait(phase_, phase, process_shared_);
+			sleepers_.fetch_sub(1, std::memory_order_relaxed);
+		}
+	}
+
+	void advance()
+	{
+		phase_.fetch_add(1, std::memory_order_seq_cst);
+		if(sleepers_.load(std::memory_order_seq_cst)!=0) futex_wake_all(phase_, process_shared_);
+	}
+
+private:
+	const unsigned int spin_count_;
+	const bool process_shared_;
+	alignas(cache_line_size) futex_word phase_{0};
+	futex_word sleepers_{0};
+};
+
+
+} // namespace aux
+
+
+//
+// Centralized sense-reversing barrier.  The "sense" is the phase number:
+// each thread notes it on arrival and waits for it to change, so no
+// per-thread state is needed.
+//
+class sense_barrier : dumbnose::noncopyable
+{
+public:
+	static constexpr unsigned int spin_forever = aux::barrier_phase::spin_forever;
+
+	explicit sense_barrier(unsigned int thread_count, unsigned int spin_count = aux::spin_wait::default_spin_count, bool process_shared = false)
+		: thread_count_(thread_count), remaining_(thread_count), phase_(spin_count, process_shared) {}
+
+	bool wait()
+	{
+		std::uint32_t phase = phase_.current();
+
+		if(remaining_.fetch_sub(1, std::memory_order_acq_rel)==1) {
+			// nobody can arrive for the next phase before we advance
+			remaining_.store(thread_count_, std::memory_order_relaxed);
+			phase_.advance();
+			return true;
+		}
+
+		phase_.wait_past(phase);
+		return false;
+	}
+
+	unsigned int thread_count() const { return thread_count_; }
+
+private:
+	const unsigned int thread_count_;
+	alignas(aux::cache_line_size) std::atomic<unsigned int> remaining_;
+	aux::barrier_phase phase_;
+};
+
+
+//
+// Combining-tree barrier.  Threads arrive at leaf nodes shared by at most
+// fan_in threads; the last arrival at a node carries on to its parent, and
+// the last arrival at the root releases everyone through the phase word.
+//
+class tree_barrier : dumbnose::noncopyable
+{
+public:
+	static constexpr unsigned int spin_forever = aux::barrier_phase::spin_forever;
+
+	explicit tree_barrier(unsigned int thread_count, unsigned int fan_in = 4, unsigned int spin_count = aux::spin_wait::default_spin_count)
+		: thread_count_(thread_count), fan_in_(fan_in<2 ? 2 : fan_in), phase_(spin_count)
+	{
+		build();
+	}
+
+	// thread_index must be unique among the waiting threads and below thread_count()
+	bool wait(unsigned int thread_index)
+	{
+		std::uint32_t phase = phase_.current();
+
+		std::size_t node = thread_index/fan_in_;
+		for(;;) {
+			node_t& current = nodes_[node];
+			if(current.arrived_.fetch_add(1, std::memory_order_acq_rel)+1!=current.expected_) break;
+
+			// last one here: reset the node for the next phase and move up
+			current.arrived_.store(0, std::memory_order_relaxed);
+			if(current.parent_==root_parent) {
+				phase_.advance();
+				return true;
+			}
+			node = current.parent_;
+		}
+
+		phase_.wait_past(phase);
+		return false;
+	}
+
+	unsigned int thread_count() const { return thread_count_; }
+
+private:
+	static constexpr std::size_t root_parent = ~static_cast<std::size_t>(0);
+
+	struct alignas(aux::cache_line_size) node_t
+	{
+		std::atomic<unsigned int> arrived_{0};
+		unsigned int expected_ = 0;
+		std::size_t parent_ = root_parent;
+	};
+
+	// Levels are stored leaves first; each level has ceil(previous/fan_in) nodes
+	void build()
+	{
+		std::size_t node_count = 0;
+		for(std::size_t width=thread_count_ ; ; ) {
+			width = (width+fan_in_-1)/fan_in_;
+			node_count += width;
+			if(width<=1) break;
+		}
+		nodes_.reset(new node_t[node_count ? node_count : 1]);
+
+		std::size_t level_start = 0, children = thread_count_;
+		for(;;) {
+			std::size_t width = (children+fan_in_-1)/fan_in_;
+			if(width==0) width = 1;
+			for(std::size_t i=0 ; i<width ; ++i) {
+				std::size_t first = i*fan_in_;
+				std::size_t last = first+fan_in_<children ? first+fan_in_ : children;
+				nodes_[level_start+i].expected_ = static_cast<unsigned int>(last-first);
+				if(width>1) nodes_[level_start+i].parent_ = level_start+width+i/fan_in_;
+			}
+			if(width==1) break;
+
+			level_start += width;
+			children = width;
+		}
+	}
+
+	const unsigned int thread_count_;
+	const unsigned int fan_in_;
+	std::unique_ptr<node_t[]> nodes_;
+	aux::barrier_phase phase_;
+};
+
+
+} // namespace dumbnose
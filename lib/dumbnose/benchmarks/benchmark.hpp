@@ -0,0 +1,375 @@
+#pragma once
+
+//
+//	benchmark
+//
+//	A small self-contained microbenchmark harness.  A benchmark is a
+//	function that builds whatever it needs for one configuration (a data
+//	size and a thread count) and then hands the operation to measure():
+//
+//		void safe_map_find(dumbnose::benchmark::state& state)
+//		{
+//			map_t map;
+//			fill(map, state.size());
+//			state.measure([&](unsigned int thread, std::uint64_t iterations) {
+//				for(std::uint64_t i=0 ; i<iterations ; ++i) map.find(key(thread, i));
+//			});
+//		}
+//
+//		DUMBNOSE_BENCHMARK("safe_map/find", safe_map_find).sizes({1<<10, 1<<20}).threads({1, 2, 4});
+//
+//	measure() starts state.threads() threads together and times them from
+//	release until the last one finishes.  Until a run takes at least
+//	--min-time it scales the iteration count by what the last run suggests,
+//	aiming a little past --min-time but growing at most tenfold per round.
+//	It then repeats that run --repetitions times.  Results are reported
+//	per operation: ns_per_op is wall time divided by the iterations each
+//	thread ran, ops_per_sec counts the operations of every thread.
+//
+//	run_benchmarks() parses the command line:
+//
+//		--filter=text		run benchmarks whose name contains text
+//		--format=text|json|csv
+//		--out=path			write results there instead of stdout
+//		--min-time=ms		per measured run (default 100)
+//		--repetitions=n		(default 3; the median is reported)
+//		--list				print the configurations and stop
+//
+//	The suite builds as the dumbnose_benchmarks target when
+//	DUMBNOSE_BUILD_BENCHMARKS is on; see benchmarks/CMakeLists.txt.
+//
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdlib>
+#include <ctime>
+#include <deque>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <ostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include <dumbnose/preprocessor.hpp>
+
+
+namespace dumbnose {
+namespace benchmark {
+
+
+struct options
+{
+	std::string filter;
+	std::string format = "text";
+	std::string out;
+	std::chrono::milliseconds min_time{100};
+	unsigned int repetitions = 3;
+	bool list = false;
+};
+
+struct result
+{
+	std::string name;
+	std::int64_t size = 0;
+	unsigned int threads = 1;
+	std::uint64_t iterations = 0;		// per thread, per repetition
+	double ns_per_op = 0;				// median of the repetitions
+	double min_ns_per_op = 0;
+	double max_ns_per_op = 0;
+	double ops_per_sec = 0;
+};
+
+
+class state
+{
+public:
+	typedef std::function<void(unsigned int thread, std::uint64_t iterations)> body_t;
+
+	state(std::int64_t size, unsigned int threads, options const & options) : size_(size), threads_(threads), options_(options) {}
+
+	std::int64_t size() const { return size_; }
+	unsigned int threads() const { return threads_; }
+
+	// Time body on every thread; call once per benchmark function
+	void measure(body_t const & body)
+	{
+		std::uint64_t iterations = 1;
+		double elapsed = run(body, iterations);
+		double min_time = std::chrono::duration<double>(options_.min_time).count();
+		while(elapsed<min_time && iterations<(std::uint64_t(1) << 40)) {
+			// aim just past min_time, at most 10 times further per round
+			double factor = elapsed>0 ? std::min(10.0, 1.2*min_time/elapsed) : 10.0;
+			iterations = std::max(iterations+1, static_cast<std::uint64_t>(iterations*factor));
+			elapsed = run(body, iterations);
+		}
+
+		std::vector<double> ns_per_op;
+		for(unsigned int i=0 ; i<std::max(1u, options_.repetitions) ; ++i) {
+			if(i>0) elapsed = run(body, iterations);
+			ns_per_op.push_back(elapsed*1e9/iterations);
+		}
+		std::sort(ns_per_op.begin(), ns_per_op.end());
+
+		result_.iterations = iterations;
+		result_.ns_per_op = ns_per_op[ns_per_op.size()/2];
+		result_.min_ns_per_op = ns_per_op.front();
+		result_.max_ns_per_op = ns_per_op.back();
+		result_.ops_per_sec = result_.ns_per_op>0 ? threads_*1e9/result_.ns_per_op : 0;
+		measured_ = true;
+	}
+
+	bool measured() const { return measured_; }
+	result const & outcome() const { return result_; }
+
+private:
+	// Seconds from releasing the threads until the last one finishes
+	double run(body_t const & body, std::uint64_t iterations)
+	{
+		if(threads_==1) {
+			auto start = std::chrono::steady_clock::now();
+			body(0, iterations);
+			return std::chrono::duration<double>(std::chrono::steady_clock::now()-start).count();
+		}
+
+		std::mutex lock;
+		std::condition_variable changed;
+		unsigned int ready = 0;
+		bool go = false;
+
+		std::vector<std::thread> workers;
+		for(unsigned int thread=0 ; thread<threads_ ; ++thread) {
+			workers.emplace_back([&, thread]{
+				{
+					std::unique_lock<std::mutex> hold(lock);
+					++ready;
+					changed.notify_all();
+					changed.wait(hold, [&]{ return go; });
+				}
+				body(thread, iterations);
+			});
+		}
+
+		{
+			std::unique_lock<std::mutex> hold(lock);
+			changed.wait(hold, [&]{ return ready==threads_; });
+			go = true;
+		}
+		auto start = std::chrono::steady_clock::now();
+		changed.notify_all();
+		for(std::thread& worker : workers) worker.join();
+		return std::chrono::duration<double>(std::chrono::steady_clock::now()-start).count();
+	}
+
+	std::int64_t size_;
+	unsigned int threads_;
+	options const & options_;
+	result result_;
+	bool measured_ = false;
+};
+
+
+class definition
+{
+public:
+	typedef std::function<void(state&)> function_t;
+
+	definition(std::string name, function_t function) : name_(std::move(name)), function_(std::move(function)) {}
+
+	definition& sizes(std::vector<std::int64_t> sizes) { sizes_ = std::move(sizes); return *this; }
+	definition& threads(std::vector<unsigned int> threads) { threads_ = std::move(threads); return *this; }
+
+	std::string const & name() const { return name_; }
+	std::vector<std::int64_t> const & sizes() const { return sizes_; }
+	std::vector<unsigned int> const & threads() const { return threads_; }
+	function_t const & function() const { return function_; }
+
+private:
+	std::string name_;
+	function_t function_;
+	std::vector<std::int64_t> sizes_{0};
+	std::vector<unsigned int> threads_{1};
+};
+
+
+inline std::deque<definition>& definitions()
+{
+	static std::deque<definition> all;
+	return all;
+}
+
+inline definition& add(std::string name, definition::function_t function)
+{
+	definitions().emplace_back(std::move(name), std::move(function));
+	return definitions().back();
+}
+
+
+namespace aux {
+
+
+inline std::string json_escaped(std::string const & text)
+{
+	std::string escaped;
+	for(char c : text) {
+		if(c=='"' || c=='\\') escaped += '\\';
+		escaped += c;
+	}
+	return escaped;
+}
+
+inline void write_text(std::ostream& out, std::vector<result> const & results)
+{
+	out << std::left << std::setw(40) << "benchmark" << std::right
+		<< std::setw(10) << "size" << std::setw(8) << "threads"
+		<< std::setw(14) << "iterations" << std::setw(14) << "ns/op"
+		<< std::setw(14) << "min ns/op" << std::setw(16) << "ops/s" << "\n";
+
+	for(result const & r : results) {
+		out << std::left << std::setw(40) << r.name << std::right
+			<< std::setw(10) << r.size << std::setw(8) << r.threads
+			<< std::setw(14) << r.iterations
+			<< std::setw(14) << std::fixed << std::setprecision(2) << r.ns_per_op
+			<< std::setw(14) << r.min_ns_per_op
+			<< std::setw(16) << std::setprecision(0) << r.ops_per_sec << "\n";
+	}
+}
+
+inline void write_json(std::ostream& out, std::vector<result> const & results)
+{
+	std::time_t now = std::time(nullptr);
+	char date[32] = {};
+	std::strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%SZ", std::gmtime(&now));
+
+	out << "{\n  \"context\": {\"date\": \"" << date << "\", \"hardware_concurrency\": " << std::thread::hardware_concurrency() << "},\n"
+		<< "  \"benchmarks\": [";
+	for(std::size_t i=0 ; i<results.size() ; ++i) {
+		result const & r = results[i];
+		out << (i ? ",\n" : "\n") << std::setprecision(6)
+			<< "    {\"name\": \"" << json_escaped(r.name) << "\", \"size\": " << r.size << ", \"threads\": " << r.threads
+			<< ", \"iterations\": " << r.iterations << ", \"ns_per_op\": " << r.ns_per_op
+			<< ", \"min_ns_per_op\": " << r.min_ns_per_op << ", \"max_ns_per_op\": " << r.max_ns_per_op
+			<< ", \"ops_per_sec\": " << r.ops_per_sec << "}";
+	}
+	out << "\n  ]\n}\n";
+}
+
+inline void write_csv(std::ostream& out, std::vector<result> const & results)
+{
+	out << "name,size,threads,iterations,ns_per_op,min_ns_per_op,max_ns_per_op,ops_per_sec\n" << std::setprecision(6);
+	for(result const & r : results) {
+		out << r.name << "," << r.size << "," << r.threads << "," << r.iterations << ","
+			<< r.ns_per_op << "," << r.min_ns_per_op << "," << r.max_ns_per_op << "," << r.ops_per_sec << "\n";
+	}
+}
+
+inline bool option_value(std::string const & argument, std::string const & option, std::string& value)
+{
+	if(argument.compare(0, option.size()+1, option+"=")!=0) return false;
+	value = argument.substr(option.size()+1);
+	return true;
+}
+
+inline options parse(int argc, char* argv[])
+{
+	options parsed;
+	for(int i=1 ; i<argc ; ++i) {
+		std::string argument = argv[i], value;
+		if(argument=="--list") parsed.list = true;
+		else if(option_value(argument, "--filter", value)) parsed.filter = value;
+		else if(option_value(argument, "--format", value)) parsed.format = value;
+		else if(option_value(argument, "--out", value)) parsed.out = value;
+		else if(option_value(argument, "--min-time", value)) parsed.min_time = std::chrono::milliseconds(std::stoll(value));
+		else if(option_value(argument, "--repetitions", value)) parsed.repetitions = static_cast<unsigned int>(std::stoul(value));
+		else throw std::invalid_argument("unknown option " + argument);
+	}
+
+	if(parsed.format!="text" && parsed.format!="json" && parsed.format!="csv") throw std::invalid_argument("unknown format " + parsed.format);
+	return parsed;
+}
+
+
+} // namespace aux
+
+
+//
+// Run every matching configuration and report; returns a process exit code
+//
+inline int run_benchmarks(int argc, char* argv[])
+{
+	options parsed;
+	try {
+		parsed = aux::parse(argc, argv);
+	} catch(std::exception const & error) {
+		std::cerr << error.what() << "\n";
+		return 2;
+	}
+
+	std::vector<result> results;
+	for(definition const & benchmark : definitions()) {
+		if(benchmark.name().find(parsed.filter)==std::string::npos) continue;
+
+		for(std::int64_t size : benchmark.sizes()) {
+			for(unsigned int threads : benchmark.threads()) {
+				if(parsed.list) {
+					std::cout << benchmark.name() << " size=" << size << " threads=" << threads << "\n";
+					continue;
+				}
+
+				state run(size, threads, parsed);
+				benchmark.function()(run);
+				if(!run.measured()) continue;
+
+				result outcome = run.outcome();
+				outcome.name = benchmark.name();
+				outcome.size = size;
+				outcome.threads = threads;
+				results.push_back(outcome);
+				std::cerr << outcome.name << " size=" << size << " threads=" << threads << ": " << outcome.ns_per_op << " ns/op\n";
+			}
+		}
+	}
+	if(parsed.list) return 0;
+
+	std::ofstream file;
+	if(!parsed.out.empty()) {
+		file.open(parsed.out, std::ios::trunc);
+		if(!file) {
+			std::cerr << "cannot write " << parsed.out << "\n";
+			return 1;
+		}
+	}
+	std::ostream& out = parsed.out.empty() ? std::cout : file;
+
+	if(parsed.format=="json") aux::write_json(out, results);
+	else if(parsed.format=="csv") aux::write_csv(out, results);
+	else aux::write_text(out, results);
+
+	return 0;
+}
+
+
+// Keeps the optimizer from discarding a value a benchmark computes
+template<class value_t>
+inline void do_not_optimize(value_t const & value)
+{
+#if defined(__GNUC__) || defined(__clang__)
+	asm volatile("" : : "r,m"(value) : "memory");
+#else
+	static volatile char sink;
+	sink = *reinterpret_cast<volatile const char*>(&value);
+#endif
+}
+
+
+}} // namespace dumbnose::benchmark
+
+
+#define DUMBNOSE_BENCHMARK(name, function) \
+	static dumbnose::benchmark::definition& ANONYMOUS_VARIABLE(benchmark_) = dumbnose::benchmark::add(name, function)
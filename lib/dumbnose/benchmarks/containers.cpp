@@ -0,0 +1,248 @@
+//
+//	Benchmarks for the containers: safe_map, safe_list (with std::allocator
+//	and pool_allocator), job_queue, tree234 and, where mmap_file is
+//	available, btree.
+//
+
+#include <dumbnose/benchmarks/benchmark.hpp>
+#include <dumbnose/safe_map.hpp>
+#include <dumbnose/safe_list.hpp>
+#include <dumbnose/job_queue.hpp>
+#include <dumbnose/pool_allocator.hpp>
+#if defined(_WIN32)
+#include <dumbnose/mmap_file.hpp>
+#include <dumbnose/btree/btree.hpp>
+#endif
+#include <cstdint>
+#include <vector>
+
+extern "C" {
+#include <dumbnose/btree/tree234.h>
+}
+
+
+namespace {
+
+
+using dumbnose::benchmark::state;
+using dumbnose::benchmark::do_not_optimize;
+
+const std::vector<std::int64_t> data_sizes = { 1 << 10, 1 << 16, 1 << 20 };
+const std::vector<unsigned int> thread_counts = { 1, 2, 4, 8 };
+
+// Spreads consecutive indices over the key space so lookups miss the cache like real ones
+inline std::uint64_t scrambled(std::uint64_t index)
+{
+	index ^= index >> 33;
+	index *= 0xFF51AFD7ED558CCDull;
+	index ^= index >> 33;
+	return index;
+}
+
+inline std::int64_t key_at(std::uint64_t index, std::int64_t size)
+{
+	return static_cast<std::int64_t>(scrambled(index) % static_cast<std::uint64_t>(size));
+}
+
+
+typedef dumbnose::safe_map<std::int64_t, std::int64_t> map_t;
+typedef dumbnose::safe_map<std::int64_t, std::int64_t, std::less<std::int64_t>, dumbnose::pool_allocator<std::pair<const std::int64_t, std::int64_t>>> pooled_map_t;
+
+void safe_map_find(state& state)
+{
+	map_t map;
+	for(std::int64_t i=0 ; i<state.size() ; ++i) map.insert(map_t::value_type(i, i));
+
+	state.measure([&](unsigned int thread, std::uint64_t iterations) {
+		std::uint64_t start = std::uint64_t(thread) << 32;
+		for(std::uint64_t i=0 ; i<iterations ; ++i) do_not_optimize(map.find(key_at(start+i, state.size())));
+	});
+}
+DUMBNOSE_BENCHMARK("safe_map/find", safe_map_find).sizes(data_sizes).threads(thread_counts);
+
+template<class some_map_t>
+void safe_map_insert_erase(state& state)
+{
+	some_map_t map;
+	for(std::int64_t i=0 ; i<state.size() ; ++i) map.insert(typename some_map_t::value_type(2*i, i));
+
+	// odd keys are never in the map, so every insert adds and every erase removes
+	state.measure([&](unsigned int thread, std::uint64_t iterations) {
+		std::uint64_t start = std::uint64_t(thread) << 32;
+		for(std::uint64_t i=0 ; i<iterations ; ++i) {
+			std::int64_t key = 2*key_at(start+i, state.size())+1;
+			if(!map.insert(typename some_map_t::value_type(key, key)).second) map.erase(key);
+		}
+	});
+}
+DUMBNOSE_BENCHMARK("safe_map/insert_erase", safe_map_insert_erase<map_t>).sizes(data_sizes).threads(thread_counts);
+DUMBNOSE_BENCHMARK("safe_map/insert_erase/pool", safe_map_insert_erase<pooled_map_t>).sizes(data_sizes).threads(thread_counts);
+
+
+template<class alloc_t>
+void safe_list_push_pop(state& state)
+{
+	dumbnose::safe_list<std::int64_t, alloc_t> list;
+	for(std::int64_t i=0 ; i<state.size() ; ++i) list.push_back(i);
+
+	state.measure([&](unsigned int, std::uint64_t iterations) {
+		for(std::uint64_t i=0 ; i<iterations ; ++i) {
+			list.push_back(static_cast<std::int64_t>(i));
+			list.pop_front();
+		}
+	});
+}
+DUMBNOSE_BENCHMARK("safe_list/push_back_pop_front", safe_list_push_pop<std::allocator<std::int64_t>>).sizes({ 0, 1 << 10 }).threads(thread_counts);
+DUMBNOSE_BENCHMARK("safe_list/push_back_pop_front/pool", safe_list_push_pop<dumbnose::pool_allocator<std::int64_t>>).sizes({ 0, 1 << 10 }).threads(thread_counts);
+
+
+// Threads take turns adding and getting, so the queue stays near half full
+void job_queue_add_get(state& state)
+{
+	dumbnose::job_queue<std::int64_t> queue(static_cast<std::size_t>(state.size()));
+	for(std::int64_t i=0 ; i<state.size()/2 ; ++i) queue.add_job(i);
+
+	state.measure([&](unsigned int, std::uint64_t iterations) {
+		for(std::uint64_t i=0 ; i<iterations ; ++i) {
+			queue.add_job(static_cast<std::int64_t>(i));
+			do_not_optimize(queue.get_job());
+		}
+	});
+}
+DUMBNOSE_BENCHMARK("job_queue/add_get", job_queue_add_get).sizes({ 64, 1 << 12 }).threads(thread_counts);
+
+// Half the threads produce, half consume; one item moved per iteration
+void job_queue_producer_consumer(state& state)
+{
+	dumbnose::job_queue<std::int64_t> queue(static_cast<std::size_t>(state.size()));
+
+	state.measure([&](unsigned int thread, std::uint64_t iterations) {
+		if(thread%2==0) {
+			for(std::uint64_t i=0 ; i<iterations ; ++i) queue.add_job(static_cast<std::int64_t>(i));
+		} else {
+			for(std::uint64_t i=0 ; i<iterations ; ++i) do_not_optimize(queue.get_job());
+		}
+	});
+}
+DUMBNOSE_BENCHMARK("job_queue/producer_consumer", job_queue_producer_consumer).sizes({ 64, 1 << 12 }).threads({ 2, 4, 8 });
+
+void job_queue_bulk(state& state)
+{
+	dumbnose::job_queue<std::int64_t> queue(1 << 12);
+	std::size_t batch = static_cast<std::size_t>(state.size());
+
+	state.measure([&](unsigned int thread, std::uint64_t iterations) {
+		std::vector<std::int64_t> jobs;
+		for(std::uint64_t i=0 ; i<iterations ; i+=batch) {
+			if(thread%2==0) {
+				jobs.assign(batch, static_cast<std::int64_t>(i));
+				queue.add_jobs(jobs);
+			} else {
+				std::size_t taken = 0;
+				while(taken<batch) {
+					jobs.clear();
+					taken += queue.get_jobs(jobs, batch-taken);
+				}
+			}
+		}
+	});
+}
+DUMBNOSE_BENCHMARK("job_queue/bulk", job_queue_bulk).sizes({ 16, 256 }).threads({ 2, 4 });
+
+
+// tree234 keeps pointers; the keys live in a vector next to it
+int compare_keys(void* left, void* right)
+{
+	std::int64_t l = *static_cast<std::int64_t*>(left), r = *static_cast<std::int64_t*>(right);
+	return l<r ? -1 : (l>r ? 1 : 0);
+}
+
+struct tree234_fixture
+{
+	explicit tree234_fixture(std::int64_t size) : keys(static_cast<std::size_t>(size)), tree(newtree234(compare_keys))
+	{
+		for(std::int64_t i=0 ; i<size ; ++i) keys[static_cast<std::size_t>(i)] = key_at(static_cast<std::uint64_t>(i), size) * 2;
+		for(std::int64_t& key : keys) add234(tree, &key);
+	}
+
+	~tree234_fixture() { freetree234(tree); }
+
+	std::vector<std::int64_t> keys;
+	tree234* tree;
+};
+
+void tree234_find(state& state)
+{
+	tree234_fixture fixture(state.size());
+
+	state.measure([&](unsigned int, std::uint64_t iterations) {
+		for(std::uint64_t i=0 ; i<iterations ; ++i) {
+			std::int64_t key = 2*key_at(i, state.size());
+			do_not_optimize(find234(fixture.tree, &key, nullptr));
+		}
+	});
+}
+DUMBNOSE_BENCHMARK("tree234/find", tree234_find).sizes(data_sizes);
+
+void tree234_insert_delete(state& state)
+{
+	tree234_fixture fixture(state.size());
+
+	state.measure([&](unsigned int, std::uint64_t iterations) {
+		for(std::uint64_t i=0 ; i<iterations ; ++i) {
+			std::int64_t key = 2*key_at(i, state.size())+1;
+			add234(fixture.tree, &key);
+			del234(fixture.tree, &key);
+		}
+	});
+}
+DUMBNOSE_BENCHMARK("tree234/insert_delete", tree234_insert_delete).sizes(data_sizes);
+
+// One operation is one element visited in order
+void tree234_scan(state& state)
+{
+	tree234_fixture fixture(state.size());
+
+	state.measure([&](unsigned int, std::uint64_t iterations) {
+		int count = count234(fixture.tree);
+		int index = 0;
+		for(std::uint64_t i=0 ; i<iterations ; ++i) {
+			do_not_optimize(index234(fixture.tree, index));
+			if(++index==count) index = 0;
+		}
+	});
+}
+DUMBNOSE_BENCHMARK("tree234/scan", tree234_scan).sizes(data_sizes);
+
+
+#if defined(_WIN32)
+
+typedef dumbnose::btree::btree<std::int64_t, std::int64_t> btree_t;
+
+void btree_insert(state& state)
+{
+	state.measure([&](unsigned int, std::uint64_t iterations) {
+		btree_t tree;
+		for(std::uint64_t i=0 ; i<iterations ; ++i) {
+			std::int64_t record = static_cast<std::int64_t>(i);
+			tree.insert(static_cast<std::int64_t>(scrambled(i)), record);
+		}
+	});
+}
+DUMBNOSE_BENCHMARK("btree/insert", btree_insert);
+
+void btree_find(state& state)
+{
+	btree_t tree;
+	for(std::int64_t i=0 ; i<state.size() ; ++i) tree.insert(i, i);
+
+	state.measure([&](unsigned int, std::uint64_t iterations) {
+		for(std::uint64_t i=0 ; i<iterations ; ++i) do_not_optimize(tree.find(key_at(i, state.size())));
+	});
+}
+DUMBNOSE_BENCHMARK("btree/find", btree_find).sizes(data_sizes);
+
+#endif
+
+
+} // namespace
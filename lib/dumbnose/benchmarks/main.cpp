@@ -0,0 +1,12 @@
+//
+//	dumbnose_benchmarks [--filter=text] [--format=text|json|csv] [--out=path]
+//	                    [--min-time=ms] [--repetitions=n] [--list]
+//
+
+#include <dumbnose/benchmarks/benchmark.hpp>
+
+
+int main(int argc, char* argv[])
+{
+	return dumbnose::benchmark::run_benchmarks(argc, argv);
+}
@@ -0,0 +1,167 @@
+//
+//	Benchmarks for the threading primitives: the lock types, thread_pool
+//	and event_source::raise.
+//
+
+#include <dumbnose/benchmarks/benchmark.hpp>
+#include <dumbnose/critical_section.hpp>
+#include <dumbnose/mutex.hpp>
+#include <dumbnose/rw_lock.hpp>
+#include <dumbnose/lock.hpp>
+#include <dumbnose/thread_pool.hpp>
+#include <dumbnose/event_source.hpp>
+#include <dumbnose/inplace_event_source.hpp>
+#if !defined(_WIN32)
+#include <dumbnose/aux_/futex_sync.hpp>
+#endif
+#include <atomic>
+#include <cstdint>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+
+namespace {
+
+
+using dumbnose::benchmark::state;
+using dumbnose::benchmark::do_not_optimize;
+
+const std::vector<unsigned int> thread_counts = { 1, 2, 4, 8 };
+
+// size is the work done inside the lock, in increments of a shared counter
+template<class lock_t, class hold_t>
+void lock_benchmark(state& state, hold_t hold)
+{
+	lock_t lock;
+	std::uint64_t counter = 0;
+
+	state.measure([&](unsigned int, std::uint64_t iterations) {
+		for(std::uint64_t i=0 ; i<iterations ; ++i) {
+			hold(lock, [&]{
+				for(std::int64_t work=0 ; work<=state.size() ; ++work) ++counter;
+			});
+		}
+	});
+	do_not_optimize(counter);
+}
+
+template<class lock_t>
+void exclusive(state& state)
+{
+	lock_benchmark<lock_t>(state, [](lock_t& lock, auto const & body) {
+		dumbnose::lock_holder<lock_t> holder(lock);
+		body();
+	});
+}
+
+void std_mutex(state& state)
+{
+	lock_benchmark<std::mutex>(state, [](std::mutex& lock, auto const & body) {
+		std::lock_guard<std::mutex> holder(lock);
+		body();
+	});
+}
+
+void rw_lock_shared(state& state)
+{
+	dumbnose::rw_lock lock;
+	std::atomic<std::uint64_t> counter{0};
+
+	state.measure([&](unsigned int, std::uint64_t iterations) {
+		for(std::uint64_t i=0 ; i<iterations ; ++i) {
+			dumbnose::rw_lock::shared_token token = lock.acquire_shared();
+			do_not_optimize(counter.load(std::memory_order_relaxed));
+			lock.release_shared(token);
+		}
+	});
+}
+
+const std::vector<std::int64_t> critical_work = { 0, 64 };
+
+DUMBNOSE_BENCHMARK("lock/critical_section", exclusive<dumbnose::critical_section>).sizes(critical_work).threads(thread_counts);
+DUMBNOSE_BENCHMARK("lock/mutex", exclusive<dumbnose::mutex>).sizes(critical_work).threads(thread_counts);
+DUMBNOSE_BENCHMARK("lock/rw_lock_exclusive", exclusive<dumbnose::rw_lock>).sizes(critical_work).threads(thread_counts);
+DUMBNOSE_BENCHMARK("lock/rw_lock_shared", rw_lock_shared).threads(thread_counts);
+DUMBNOSE_BENCHMARK("lock/std_mutex", std_mutex).sizes(critical_work).threads(thread_counts);
+
+#if !defined(_WIN32)
+void futex_lock(state& state)
+{
+	lock_benchmark<dumbnose::aux::futex_lock>(state, [](dumbnose::aux::futex_lock& lock, auto const & body) {
+		std::lock_guard<dumbnose::aux::futex_lock> holder(lock);
+		body();
+	});
+}
+DUMBNOSE_BENCHMARK("lock/futex_lock", futex_lock).sizes(critical_work).threads(thread_counts);
+#endif
+
+
+// Each benchmark thread submits items and waits for the last; size is the number of workers
+void thread_pool_submit(state& state)
+{
+	dumbnose::thread_pool_options options;
+	options.thread_count = static_cast<unsigned int>(state.size());
+	dumbnose::thread_pool<> pool(options);
+
+	state.measure([&](unsigned int, std::uint64_t iterations) {
+		std::atomic<std::uint64_t> done{0};
+		for(std::uint64_t i=0 ; i<iterations ; ++i) {
+			pool.add_work_item(dumbnose::thread_pool<>::work_item_ptr(new std::function<void()>([&done]{ done.fetch_add(1, std::memory_order_release); })));
+		}
+		while(done.load(std::memory_order_acquire)<iterations) std::this_thread::yield();
+	});
+}
+DUMBNOSE_BENCHMARK("thread_pool/add_work_item", thread_pool_submit).sizes({ 1, 2, 4 }).threads({ 1, 2, 4 });
+
+void thread_pool_future(state& state)
+{
+	dumbnose::thread_pool_options options;
+	options.thread_count = static_cast<unsigned int>(state.size());
+	dumbnose::thread_pool<> pool(options);
+
+	state.measure([&](unsigned int, std::uint64_t iterations) {
+		for(std::uint64_t i=0 ; i<iterations ; ++i) pool.submit([i]{ return i; }).get();
+	});
+}
+DUMBNOSE_BENCHMARK("thread_pool/submit_round_trip", thread_pool_future).sizes({ 1, 4 }).threads({ 1, 2 });
+
+
+// size is the number of listeners
+void event_source_raise(state& state)
+{
+	typedef dumbnose::event_source<int, std::uint64_t> source_t;
+	source_t source;
+	std::atomic<std::uint64_t> total{0};
+
+	std::vector<std::unique_ptr<source_t::cookie_t>> cookies;
+	for(std::int64_t i=0 ; i<state.size() ; ++i) {
+		cookies.emplace_back(new source_t::cookie_t(source.register_listener([&total](int, std::uint64_t value){ total.fetch_add(value, std::memory_order_relaxed); })));
+	}
+
+	state.measure([&](unsigned int, std::uint64_t iterations) {
+		for(std::uint64_t i=0 ; i<iterations ; ++i) source.raise(0, i);
+	});
+}
+DUMBNOSE_BENCHMARK("event_source/raise", event_source_raise).sizes({ 0, 1, 8 }).threads(thread_counts);
+
+void inplace_event_source_raise(state& state)
+{
+	typedef dumbnose::inplace_event_source<int, std::uint64_t> source_t;
+	source_t source;
+	std::atomic<std::uint64_t> total{0};
+
+	std::vector<std::unique_ptr<source_t::cookie_t>> cookies;
+	for(std::int64_t i=0 ; i<state.size() ; ++i) {
+		cookies.emplace_back(new source_t::cookie_t(source.register_listener([&total](int, std::uint64_t value){ total.fetch_add(value, std::memory_order_relaxed); })));
+	}
+
+	state.measure([&](unsigned int, std::uint64_t iterations) {
+		for(std::uint64_t i=0 ; i<iterations ; ++i) source.raise(0, i);
+	});
+}
+DUMBNOSE_BENCHMARK("inplace_event_source/raise", inplace_event_source_raise).sizes({ 0, 1, 8 }).threads(thread_counts);
+
+
+} // namespace
@@ -1,7 +1,11 @@
 #pragma once
 
 //#include <dumbnose/mmap_file.hpp>
+#include <atomic>
+#include <chrono>
 #include <ostream>
+#include <string>
+#include <dumbnose/metrics.hpp>
 #include <boost/shared_ptr.hpp>
 #include "impl_/node.hpp"
 #include <boost/mpl/identity.hpp>
@@ -74,13 +78,44 @@ public:
 
 	const record_t* find(const key_t& key) const
 	{
-		return root_->find(key);
+		if(!find_time_) return root_->find(key);
+
+		std::chrono::steady_clock::time_point started = std::chrono::steady_clock::now();
+		const record_t* record = root_->find(key);
+		find_time_->record(std::chrono::steady_clock::now()-started);
+		return record;
 	}
 
 	void insert(const key_t& key, record_t& record)
 	{
+		std::chrono::steady_clock::time_point started;
+		if(insert_time_) started = std::chrono::steady_clock::now();
+
+		node_ptr old_root = root_;
 		root_->insert(key,record);
 		root_ = root_->find_root()/*->shared_from_this()*/;
+
+		if(insert_time_) {
+			// the tree only grows a level when the root splits
+			if(root_!=old_root) depth_.store(depth(), std::memory_order_relaxed);
+			blocks_.store(file_.block_count(), std::memory_order_relaxed);
+			insert_time_->record(std::chrono::steady_clock::now()-started);
+		}
+	}
+
+	//
+	// publish name_depth and name_blocks, and time find() and insert() from
+	// now on.  The exporter reads copies that insert() keeps up to date,
+	// never the tree itself, which is not safe to walk during an insert.
+	//
+	void publish_metrics(const std::string& name, metrics_registry& registry = metrics_registry::instance())
+	{
+		depth_.store(depth(), std::memory_order_relaxed);
+		blocks_.store(file_.block_count(), std::memory_order_relaxed);
+		depth_publication_ = registry.publish(metric_type::gauge, name + "_depth", "Levels in the tree", [this]{ return static_cast<double>(depth_.load(std::memory_order_relaxed)); });
+		blocks_publication_ = registry.publish(metric_type::gauge, name + "_blocks", "Blocks in the tree's file", [this]{ return static_cast<double>(blocks_.load(std::memory_order_relaxed)); });
+		find_time_ = &registry.add_histogram(name + "_find_seconds", "Time to find a key");
+		insert_time_ = &registry.add_histogram(name + "_insert_seconds", "Time to insert a key");
 	}
 
 	std::ostream& operator<<(std::ostream& os) const
@@ -103,6 +138,13 @@ private:
 	mmap_file<> file_;
 	node_ptr root_;
 
+	histogram* find_time_ = nullptr;
+	histogram* insert_time_ = nullptr;
+	std::atomic<int> depth_{0};
+	std::atomic<std::size_t> blocks_{0};
+	metrics_publication depth_publication_;
+	metrics_publication blocks_publication_;
+
 };
 
 
@@ -0,0 +1,153 @@
+#pragma once
+
+//
+//	chase_lev_deque
+//
+//	Growable single-owner work-stealing deque (Chase & Lev, with the C11
+//	memory orderings from Le, Pop, Cohen & Zappa Nardelli, PPoPP 2013).
+//	The owning thread pushes and pops at the bottom (LIFO), any other
+//	thread may steal from the top (FIFO).  Only pop/steal races on the
+//	last element need a CAS.
+//
+//	Elements are stored in atomics, so element_t should be a pointer or
+//	another small trivially copyable type.  Retired arrays are kept until
+//	the deque is destroyed because a thief may still be reading them.
+//
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <type_traits>
+#include <vector>
+#include <dumbnose/noncopyable.hpp>
+#include <dumbnose/aux_/spin_wait.hpp>
+
+
+namespace dumbnose {
+
+
+template<class element_t>
+class chase_lev_deque : dumbnose::noncopyable
+{
+	static_assert(std::is_trivially_copyable<element_t>::value, "chase_lev_deque elements must be trivially copyable");
+
+public:
+	explicit chase_lev_deque(std::size_t initial_capacity = 256)
+	{
+		std::size_t capacity = 2;
+		while(capacity<initial_capacity) capacity <<= 1;
+
+		arrays_.emplace_back(new array_t(capacity));
+		array_.store(arrays_.back().get(), std::memory_order_relaxed);
+	}
+
+	// owner only
+	void push(element_t element)
+	{
+		std::int64_t b = bottom_.load(std::memory_order_relaxed);
+		std::int64_t t = top_.load(std::memory_order_acquire);
+		array_t* a = array_.load(std::memory_order_relaxed);
+
+		if(b-t > static_cast<std::int64_t>(a->capacity())-1) a = grow(a,t,b);
+
+		a->put(b,element);
+		std::atomic_thread_fence(std::memory_order_release);
+		bottom_.store(b+1, std::memory_order_relaxed);
+	}
+
+	// owner only; takes the most recently pushed element
+	bool pop(element_t& element)
+	{
+		std::int64_t b = bottom_.load(std::memory_order_relaxed) - 1;
+		array_t* a = array_.load(std::memory_order_relaxed);
+		bottom_.store(b, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		std::int64_t t = top_.load(std::memory_order_relaxed);
+
+		if(t>b) {
+			// empty
+			bottom_.store(b+1, std::memory_order_relaxed);
+			return false;
+		}
+
+		element = a->get(b);
+		if(t!=b) return true;
+
+		// last element; race any thieves for it
+		bool won = top_.compare_exchange_strong(t, t+1, std::memory_order_seq_cst, std::memory_order_relaxed);
+		bottom_.store(b+1, std::memory_order_relaxed);
+
+		return won;
+	}
+
+	// any thread; takes the oldest element.  Fails if empty or if another
+	// thread won the race for the same element.
+	bool steal(element_t& element)
+	{
+		std::int64_t t = top_.load(std::memory_order_acquire);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		std::int64_t b = bottom_.load(std::memory_order_acquire);
+
+		if(t>=b) return false;
+
+		array_t* a = array_.load(std::memory_order_acquire);
+		element_t candidate = a->get(t);
+		if(!top_.compare_exchange_strong(t, t+1, std::memory_order_seq_cst, std::memory_order_relaxed)) return false;
+
+		element = candidate;
+		return true;
+	}
+
+	// Approximate; exact only when called by the owner with no thieves
+	std::size_t size() const
+	{
+		std::int64_t b = bottom_.load(std::memory_order_relaxed);
+		std::int64_t t = top_.load(std::memory_order_relaxed);
+		return b>t ? static_cast<std::size_t>(b-t) : 0;
+	}
+
+	bool empty() const { return size()==0; }
+
+private:
+	class array_t
+	{
+	public:
+		explicit array_t(std::size_t capacity) : mask_(capacity-1), slots_(new std::atomic<element_t>[capacity]) {}
+
+		std::size_t capacity() const { return mask_+1; }
+
+		element_t get(std::int64_t index) const {
+			return slots_[static_cast<std::size_t>(index) & mask_].load(std::memory_order_relaxed);
+		}
+
+		void put(std::int64_t index, element_t element) {
+			slots_[static_cast<std::size_t>(index) & mask_].store(element, std::memory_order_relaxed);
+		}
+
+	private:
+		std::size_t mask_;
+		std::unique_ptr<std::atomic<element_t>[]> slots_;
+	};
+
+	array_t* grow(array_t* old, std::int64_t top, std::int64_t bottom)
+	{
+		array_t* bigger = new array_t(old->capacity()*2);
+		for(std::int64_t i=top ; i<bottom ; ++i) bigger->put(i, old->get(i));
+
+		arrays_.emplace_back(bigger);
+		array_.store(bigger, std::memory_order_release);
+
+		return bigger;
+	}
+
+	alignas(aux::cache_line_size) std::atomic<std::int64_t> top_{0};
+	alignas(aux::cache_line_size) std::atomic<std::int64_t> bottom_{0};
+	std::atomic<array_t*> array_{nullptr};
+
+	// every array ever used, owned here (touched by the owner only)
+	std::vector<std::unique_ptr<array_t> > arrays_;
+};
+
+
+} // namespace dumbnose
@@ -1,11 +1,20 @@
 #pragma once
 
+#include <chrono>
+#include <dumbnose/lock.hpp>
+
+#if defined(_WIN32)
 #include <windows.h>
+#else
+#include <dumbnose/aux_/futex_sync.hpp>
+#endif
 
 namespace dumbnose
 {
 
 
+#if defined(_WIN32)
+
 class critical_section
 {
 public:
@@ -21,6 +30,27 @@ public:
 		EnterCriticalSection(&cs_);
 	}
 
+	bool try_acquire() const {
+		return TryEnterCriticalSection(&cs_)!=FALSE;
+	}
+
+	template<class rep_t, class period_t>
+	bool try_acquire_for(std::chrono::duration<rep_t,period_t> const & timeout) const {
+		return try_acquire_until(std::chrono::steady_clock::now()+timeout);
+	}
+
+	// CRITICAL_SECTION has no timed wait, so this polls until the deadline
+	template<class clock_t, class duration_t>
+	bool try_acquire_until(std::chrono::time_point<clock_t,duration_t> const & deadline) const {
+		std::chrono::steady_clock::time_point until = aux::steady_deadline(deadline);
+		for(unsigned int attempt=0 ; ; ++attempt) {
+			if(try_acquire()) return true;
+			if(std::chrono::steady_clock::now()>=until) return false;
+			if(attempt<16) SwitchToThread();
+			else Sleep(1);
+		}
+	}
+
 	void release() const {
 		LeaveCriticalSection(&cs_);
 	}
@@ -29,5 +59,42 @@ private:
 	mutable CRITICAL_SECTION cs_;
 };
 
+#else
+
+//
+// Recursive like its Win32 counterpart; uncontended acquire/release never
+// leave user mode, contended ones spin adaptively before sleeping on a futex.
+//
+class critical_section
+{
+public:
+	void acquire() const {
+		lock_.lock();
+	}
+
+	bool try_acquire() const {
+		return lock_.try_lock();
+	}
+
+	template<class rep_t, class period_t>
+	bool try_acquire_for(std::chrono::duration<rep_t,period_t> const & timeout) const {
+		return try_acquire_until(std::chrono::steady_clock::now()+timeout);
+	}
+
+	template<class clock_t, class duration_t>
+	bool try_acquire_until(std::chrono::time_point<clock_t,duration_t> const & deadline) const {
+		return lock_.lock(aux::futex_deadline(aux::steady_deadline(deadline)));
+	}
+
+	void release() const {
+		lock_.unlock();
+	}
+
+private:
+	mutable aux::recursive_futex_lock lock_;
+};
+
+#endif
+
 
-} // namespace dumbnose
\ No newline at end of file
+} // namespace dumbnose
@@ -0,0 +1,228 @@
+#pragma once
+
+//
+//	error_throttle
+//
+//	Keeps failure storms from turning error reporting into the bottleneck.
+//	Every message key (a call site, or the text of the message) gets a token
+//	bucket: it may emit burst messages at once and per_second after that.
+//	Messages over the limit are only counted; when the key next gets
+//	through, or when drain_suppressed() is called, the count is reported as
+//	one "N similar errors suppressed" summary.  Optionally every Nth
+//	suppressed message is let through anyway as a sample.
+//
+//	admit() takes a short per-key spin lock and never allocates, so callers
+//	can afford to consult it before they spend anything on formatting.
+//
+//	Keys live in a fixed table.  When a key's probe finds no free slot it
+//	takes over one whose key has gone quiet: its bucket has refilled and
+//	nothing is waiting to be reported.  Failing that, the key shares the
+//	last slot probed and is counted under that slot's key, which only makes
+//	limits coarser.
+//
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string_view>
+#include <dumbnose/noncopyable.hpp>
+#include <dumbnose/aux_/futex_sync.hpp>
+
+
+namespace dumbnose {
+
+
+struct error_throttle_options
+{
+	double per_second = 10.0;			// sustained messages per key
+	double burst = 20.0;				// messages a quiet key may emit at once
+	std::uint32_t sample_one_in = 0;	// let every Nth suppressed message through; 0 for never
+	bool enabled = true;
+};
+
+// Identifies a reporting call site; see STATUS_REPORT_ERROR
+class error_site : dumbnose::noncopyable
+{
+public:
+	constexpr error_site(const char* file, int line) : file_(file), line_(line) {}
+
+	const char* file() const { return file_; }
+	int line() const { return line_; }
+
+private:
+	const char* file_;
+	int line_;
+};
+
+
+class error_throttle : dumbnose::noncopyable
+{
+public:
+	struct decision
+	{
+		bool emit;					// report this message
+		std::uint64_t suppressed;	// messages held back since the key last got through
+		error_site const * site;	// where those were reported from, null for text keys
+	};
+
+	explicit error_throttle(error_throttle_options const & options = error_throttle_options())
+	{
+		configure(options);
+	}
+
+	void configure(error_throttle_options const & options)
+	{
+		per_second_.store(options.per_second, std::memory_order_relaxed);
+		burst_.store(options.burst, std::memory_order_relaxed);
+		sample_one_in_.store(options.sample_one_in, std::memory_order_relaxed);
+		enabled_.store(options.enabled, std::memory_order_relaxed);
+	}
+
+	static std::uint64_t key_of(error_site const & site) { return non_zero(reinterpret_cast<std::uintptr_t>(&site)); }
+	static std::uint64_t key_of(std::wstring_view text) { return non_zero(std::hash<std::wstring_view>()(text)); }
+	static std::uint64_t key_of(std::string_view text) { return non_zero(std::hash<std::string_view>()(text) ^ 0x9E3779B97F4A7C15ull); }
+
+	decision admit(std::uint64_t key, error_site const * site = nullptr)
+	{
+		if(!enabled_.load(std::memory_order_relaxed)) return decision{ true, 0, site };
+
+		std::int64_t now = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+		double per_second = per_second_.load(std::memory_order_relaxed);
+		double burst = burst_.load(std::memory_order_relaxed);
+		std::uint32_t sample_one_in = sample_one_in_.load(std::memory_order_relaxed);
+
+		// the slot may be handed to another key before we lock it; then look again
+		std::uint64_t owner;
+		slot_t* found = &find(key, now, per_second, burst, owner);
+		std::unique_lock<aux::futex_lock> lock(found->lock_);
+		while(found->claimed_key_.load(std::memory_order_acquire)!=owner) {
+			lock.unlock();
+			found = &find(key, now, per_second, burst, owner);
+			lock = std::unique_lock<aux::futex_lock>(found->lock_);
+		}
+		slot_t& slot = *found;
+
+		// a slot shared by several keys reports as the key that claimed it
+		if(slot.key_==0) {
+			slot.key_ = owner;
+			slot.tokens_ = burst;
+			slot.refilled_ = now;
+		}
+		if(owner==key && !slot.site_) slot.site_ = site;
+
+		slot.tokens_ += per_second*static_cast<double>(now-slot.refilled_)/1e9;
+		if(slot.tokens_>burst) slot.tokens_ = burst;
+		slot.refilled_ = now;
+
+		bool emit = slot.tokens_>=1.0;
+		if(emit) {
+			slot.tokens_ -= 1.0;
+		} else if(sample_one_in!=0 && ++slot.since_sample_>=sample_one_in) {
+			slot.since_sample_ = 0;
+			emit = true;
+		}
+
+		if(!emit) {
+			++slot.suppressed_;
+			return decision{ false, 0, slot.site_ };
+		}
+
+		decision result{ true, slot.suppressed_, slot.site_ };
+		slot.suppressed_ = 0;
+		return result;
+	}
+
+	//
+	// Report and reset every key's suppressed count:
+	// report(key, suppressed, site) where site is null for text keys
+	//
+	template<class report_t>
+	void drain_suppressed(report_t report)
+	{
+		for(slot_t& slot : slots_) {
+			std::uint64_t key, suppressed;
+			error_site const * site;
+			{
+				std::unique_lock<aux::futex_lock> lock(slot.lock_);
+				if(slot.suppressed_==0) continue;
+				key = slot.key_;
+				suppressed = slot.suppressed_;
+				site = slot.site_;
+				slot.suppressed_ = 0;
+			}
+			report(key, suppressed, site);
+		}
+	}
+
+private:
+	static const std::size_t slot_count = 256;
+	static const std::size_t max_probe = 8;
+
+	struct slot_t
+	{
+		std::atomic<std::uint64_t> claimed_key_{0};
+		aux::futex_lock lock_;
+		std::uint64_t key_ = 0;
+		error_site const * site_ = nullptr;
+		double tokens_ = 0;
+		std::int64_t refilled_ = 0;
+		std::uint64_t suppressed_ = 0;
+		std::uint32_t since_sample_ = 0;
+	};
+
+	static std::uint64_t non_zero(std::uint64_t key) { return key ? key : 1; }
+
+	// Also returns the key the slot was claimed by, which is key unless the slot is shared
+	slot_t& find(std::uint64_t key, std::int64_t now, double per_second, double burst, std::uint64_t& owner)
+	{
+		std::size_t index = static_cast<std::size_t>(key ^ (key >> 29)) & (slot_count-1);
+		for(std::size_t probe=0 ; probe<max_probe ; ++probe) {
+			slot_t& slot = slots_[(index+probe) & (slot_count-1)];
+			owner = slot.claimed_key_.load(std::memory_order_acquire);
+			if(owner==0 && slot.claimed_key_.compare_exchange_strong(owner, key, std::memory_order_acq_rel)) {
+				owner = key;
+				return slot;
+			}
+			if(owner==key) return slot;
+		}
+
+		owner = key;
+		for(std::size_t probe=0 ; probe<max_probe ; ++probe) {
+			slot_t& slot = slots_[(index+probe) & (slot_count-1)];
+			if(reclaim(slot, key, now, per_second, burst)) return slot;
+		}
+
+		slot_t& shared = slots_[(index+max_probe-1) & (slot_count-1)];
+		owner = shared.claimed_key_.load(std::memory_order_acquire);
+		return shared;
+	}
+
+	// Hand an idle slot to key: one whose bucket would be full by now and that has nothing to report
+	bool reclaim(slot_t& slot, std::uint64_t key, std::int64_t now, double per_second, double burst)
+	{
+		std::unique_lock<aux::futex_lock> lock(slot.lock_);
+		std::uint64_t owner = slot.claimed_key_.load(std::memory_order_acquire);
+		if(owner==key) return true;
+		if(slot.key_==0 || slot.suppressed_!=0) return false;
+		if(slot.tokens_+per_second*static_cast<double>(now-slot.refilled_)/1e9<burst) return false;
+		if(!slot.claimed_key_.compare_exchange_strong(owner, key, std::memory_order_acq_rel)) return false;
+
+		slot.key_ = 0;
+		slot.site_ = nullptr;
+		slot.since_sample_ = 0;
+		return true;
+	}
+
+	slot_t slots_[slot_count];
+
+	std::atomic<double> per_second_;
+	std::atomic<double> burst_;
+	std::atomic<std::uint32_t> sample_one_in_;
+	std::atomic<bool> enabled_;
+};
+
+
+} // namespace dumbnose
@@ -1,15 +1,28 @@
 #pragma once
 
-#include <windows.h>
 #include <string>
 #include <cassert>
+#include <dumbnose/lock.hpp>
+
+#if defined(_WIN32)
+#include <windows.h>
 #include <dumbnose/waiter.hpp>
+#else
+#include <cstdint>
+#include <system_error>
+#include <dumbnose/aux_/futex_sync.hpp>
+#if defined(__linux__)
+#include <dumbnose/aux_/readiness_fd.hpp>
+#endif
+#endif
 
 
 namespace dumbnose
 {
 
 
+#if defined(_WIN32)
+
 class event
 {
 	friend class waiter;
@@ -36,7 +49,7 @@ public:
 		assert(NULL!=event_);
 
 		DWORD result = WaitForSingleObject(event_,wait_time);
-		if(WAIT_OBJECT_0!=result) 
+		if(WAIT_OBJECT_0!=result)
 			throw windows_exception("Could not wait for event");
 	}
 
@@ -66,5 +79,80 @@ private:
 	mutable HANDLE event_;
 };
 
+#else
+
+//
+// Process-local manual or auto-reset event.  set() only makes a syscall
+// when a thread is asleep in wait().  On Linux it can also be waited on
+// together with other objects through waiter.
+//
+class event
+{
+	friend class waiter;
+
+public:
+	event(bool manual_reset, bool initial_state) : event_(manual_reset, initial_state) {}
+
+	void wait(unsigned int wait_time=infinite_wait) const {
+		if(!event_.wait(aux::deadline_after_ms(wait_time)))
+			throw std::system_error(std::make_error_code(std::errc::timed_out), "Could not wait for event");
+		sync();
+	}
+
+	void set() {
+		event_.set();
+		sync();
+	}
+
+	void pulse() {
+		event_.pulse();
+		sync();
+	}
+
+	void reset() {
+		event_.reset();
+		sync();
+	}
+
+private:
+	// waiter protocol
+	bool try_take() const {
+		bool taken = event_.try_wait();
+		sync();
+		return taken;
+	}
+
+	void signal() {
+		set();
+	}
+
+	std::uint32_t wait_ticket() const {
+		return event_.ticket();
+	}
+
+	void wait_from(std::uint32_t ticket) const {
+		event_.wait_from(ticket);
+		sync();
+	}
+
+#if defined(__linux__)
+	int wait_fd() const {
+		return fd_.get([this]{ return event_.is_set(); });
+	}
+
+	void sync() const {
+		fd_.sync([this]{ return event_.is_set(); });
+	}
+
+	mutable aux::readiness_fd fd_;
+#else
+	void sync() const {}
+#endif
+
+	mutable aux::futex_event event_;
+};
+
+#endif
+
 
 } // namespace dumbnose
\ No newline at end of file
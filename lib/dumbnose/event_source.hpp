@@ -1,10 +1,35 @@
 #pragma once
 
-#include <map>
-#include <functional>
+//
+//	event_source
+//
+//	Listeners live in an immutable, copy-on-write list.  register_listener
+//	and unregister_listener build a new list under a mutex and publish it
+//	with an atomic pointer store.  raise() reads the current list inside an
+//	aux::grace_period read section, which is an add and a subtract on a
+//	per-CPU counter, so raising neither allocates, locks nor shares a
+//	cache line with raisers on other CPUs.  A replaced list is freed once
+//	a grace period has passed.
+//
+//	A listener may register or unregister listeners (itself included) while
+//	it is being called; that raise finishes with the list it started with.
+//	Such a writer cannot wait out the raise it is part of, so the lists it
+//	replaces are freed by the next writer outside any raise, or by the
+//	destructor.
+//
+
+#include <algorithm>
+#include <atomic>
 #include <cassert>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
 #include <mutex>
+#include <utility>
+#include <vector>
 #include <dumbnose/noncopyable.hpp>
+#include <dumbnose/aux_/grace_period.hpp>
 
 namespace dumbnose {
 
@@ -20,12 +45,28 @@ public:
 	using event_handler_t = std::function<void(sender_t source, event_args_t args)>;
 	using cookie_t = event_source_cookie<this_t>;
 
+	event_source() = default;
+
+	~event_source()
+	{
+		delete listeners_.load(std::memory_order_relaxed);
+		for (const listeners_t* listeners : retired_) delete listeners;
+	}
+
 	// Register a listener and receive a cookie to revoke later.
 	cookie_t register_listener(event_handler_t listener)
 	{
-		std::unique_lock<std::mutex> lock(lock_);
-		uint64_t cookieNum = ++largest_event_cookie_;
-		listeners_[cookieNum] = listener;
+		uint64_t cookieNum;
+		{
+			std::unique_lock<std::mutex> lock(lock_);
+			cookieNum = ++largest_event_cookie_;
+
+			// cookies only grow, so appending keeps the list in registration order
+			std::unique_ptr<listeners_t> listeners = std::make_unique<listeners_t>(*listeners_.load(std::memory_order_relaxed));
+			listeners->emplace_back(cookieNum, std::move(listener));
+			publish(std::move(listeners));
+		}
+		reclaim();
 
 		event_source_cookie<this_t> cookie;
 		cookie.initialize(this, cookieNum);
@@ -37,45 +78,107 @@ public:
 	{
 		if (cookie == 0) return;
 
-		std::unique_lock<std::mutex> lock(lock_);
+		{
+			std::unique_lock<std::mutex> lock(lock_);
 
-		assert((cookie != 0) && (cookie <= largest_event_cookie_));
-		assert(listeners_.find(cookie) != listeners_.end());
+			assert((cookie != 0) && (cookie <= largest_event_cookie_));
 
-		listeners_.erase(cookie);
+			const listeners_t* current = listeners_.load(std::memory_order_relaxed);
+			typename listeners_t::const_iterator found = std::lower_bound(current->begin(), current->end(), cookie,
+				[](const listener_t& listener, uint64_t cookie) { return listener.first < cookie; });
+			assert((found != current->end()) && (found->first == cookie));
+			if ((found == current->end()) || (found->first != cookie)) return;
+
+			std::unique_ptr<listeners_t> listeners = std::make_unique<listeners_t>();
+			listeners->reserve(current->size() - 1);
+			listeners->insert(listeners->end(), current->begin(), found);
+			listeners->insert(listeners->end(), found + 1, current->end());
+			publish(std::move(listeners));
+		}
+		reclaim();
 	}
 
 	void raise(sender_t sender, event_args_t args)
 	{
-		std::unique_lock<std::mutex> lock(lock_);
-		std::map<uint64_t, event_handler_t> listeners = listeners_;
-		lock.unlock();
-
-		for (auto& listener : listeners)
 		{
-			listener.second(sender, args);
+			aux::grace_period::read_section reading(readers_);
+			const listeners_t& listeners = *listeners_.load(std::memory_order_acquire);
+
+			for (const listener_t& listener : listeners)
+			{
+				listener.second(sender, args);
+			}
 		}
 
-		event_.notify_all();
+		// the mutex is only needed when somebody is blocked in wait()
+		if (waiters_.load(std::memory_order_seq_cst) != 0)
+		{
+			{
+				std::unique_lock<std::mutex> lock(lock_);
+				++raises_;
+			}
+			event_.notify_all();
+		}
 	}
 
+	// Block until the next raise()
 	void wait()
 	{
 		std::unique_lock<std::mutex> lock(lock_);
-		event_.wait(lock);
+		uint64_t raises = raises_;
+
+		waiters_.fetch_add(1, std::memory_order_seq_cst);
+		event_.wait(lock, [&] { return raises_ != raises; });
+		waiters_.fetch_sub(1, std::memory_order_relaxed);
 	}
 
 private:
+	using listener_t = std::pair<uint64_t, event_handler_t>;
+	using listeners_t = std::vector<listener_t>;
+
+	// Called under lock_: swap in a new list, keeping the old one until no raise can be reading it
+	void publish(std::unique_ptr<listeners_t> listeners)
+	{
+		retired_.push_back(listeners_.load(std::memory_order_relaxed));
+		listeners_.store(listeners.release(), std::memory_order_release);
+	}
+
+	// Free retired lists after a grace period; from inside a raise that would wait for itself
+	void reclaim()
+	{
+		if (aux::grace_period::reading_any()) return;
+
+		std::unique_lock<std::mutex> reclaiming(reclaim_lock_);
+		std::vector<const listeners_t*> retired;
+		{
+			std::unique_lock<std::mutex> lock(lock_);
+			retired.swap(retired_);
+		}
+		if (retired.empty()) return;
+
+		readers_.synchronize();
+		for (const listeners_t* listeners : retired) delete listeners;
+	}
+
+	// serializes writers of listeners_ and guards raises_ and retired_
 	std::mutex lock_;
 	uint64_t largest_event_cookie_ = 0;
-	std::map<uint64_t, event_handler_t> listeners_;
+	std::atomic<const listeners_t*> listeners_{new listeners_t()};
+	std::vector<const listeners_t*> retired_;
+	// serializes synchronize(), which must not run under lock_: a listener may be waiting for lock_
+	std::mutex reclaim_lock_;
+	aux::grace_period readers_;
+	std::atomic<unsigned int> waiters_{0};
+	uint64_t raises_ = 0;
 	std::condition_variable event_;
 };
 
 
+#if defined(_MSC_VER)
 #pragma warning( push )
 #pragma warning( disable : 4521 )
 #pragma warning( disable : 4522 )
+#endif
 template<class event_source_t>
 class event_source_cookie
 {
@@ -127,7 +230,9 @@ private:
 	event_source_t* event_source_ = nullptr;
 	uint64_t cookie_ = 0;
 };
+#if defined(_MSC_VER)
 #pragma warning( pop )
+#endif
 
 
 }
@@ -7,24 +7,27 @@
 //	buffer.  Useful for leveraging the std::basic_string<> interface without
 //	having to use dynamic memory.  
 //
-//	@todo:	It would be dangerous to try to append to the string to make it 
-//	longer than the supplied buffer.  The macros define the strings to be const.
-//	If someone manually defines one, they will need to be careful.  Could add
-//	checking later.
+//	The buffer is handed out through a monotonic_buffer with no upstream, so
+//	growing a string past it throws std::bad_alloc instead of overrunning
+//	it.  The macros size the buffer to the literal and define the string
+//	const.
 //
 
+#include <memory_resource>
 #include <string>
 #include <dumbnose/preprocessor.hpp>
 #include <dumbnose/memory.hpp>
 
 
 #define FIXED_STRING(var_name, string_val) \
-	char CONCATENATE(var_name,_array)[] = string_val;		\
-	const dumbnose::fixed_string var_name(string_val, dumbnose::fixed_allocator<char>(CONCATENATE(##var_name,_array), ARRAY_SIZE(string_val)));
+	char CONCATENATE(var_name,_array)[sizeof(string_val)];		\
+	dumbnose::monotonic_buffer CONCATENATE(var_name,_buffer)(CONCATENATE(var_name,_array), sizeof(CONCATENATE(var_name,_array)), std::pmr::null_memory_resource()); \
+	const dumbnose::fixed_string var_name(string_val, dumbnose::fixed_allocator<char>(CONCATENATE(var_name,_buffer)));
 
 #define FIXED_WSTRING(var_name, string_val) \
-	wchar_t CONCATENATE(var_name,_array)[] = string_val;		\
-	const dumbnose::fixed_wstring var_name(string_val, dumbnose::fixed_allocator<wchar_t>(CONCATENATE(##var_name,_array), ARRAY_SIZE(string_val)));
+	wchar_t CONCATENATE(var_name,_array)[ARRAY_SIZE(string_val)];		\
+	dumbnose::monotonic_buffer CONCATENATE(var_name,_buffer)(CONCATENATE(var_name,_array), sizeof(CONCATENATE(var_name,_array)), std::pmr::null_memory_resource()); \
+	const dumbnose::fixed_wstring var_name(string_val, dumbnose::fixed_allocator<wchar_t>(CONCATENATE(var_name,_buffer)));
 
 namespace dumbnose {
 
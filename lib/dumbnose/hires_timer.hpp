@@ -1,10 +1,111 @@
 #pragma once
 
+//
+//	hires_timer
+//
+//	Elapsed time since construction or reset().  On Windows it reads
+//	QueryPerformanceCounter; elsewhere std::chrono::steady_clock.
+//
+//	cycle_clock is the cheaper clock for probes that time very short
+//	stretches of code (see timing_probe.hpp): on x86 with an invariant TSC
+//	it reads the time stamp counter, converting ticks to nanoseconds with a
+//	scale calibrated once against steady_clock; everywhere else its ticks
+//	are steady_clock nanoseconds.
+//
+
+#include <chrono>
+#include <cstdint>
+
+#if defined(_WIN32)
 #include <dumbnose/windows_exception.hpp>
+#endif
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#define DUMBNOSE_CYCLE_CLOCK_TSC 1
+#elif (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#include <cpuid.h>
+#include <x86intrin.h>
+#define DUMBNOSE_CYCLE_CLOCK_TSC 1
+#endif
 
 
 namespace dumbnose {
 
+
+class cycle_clock
+{
+public:
+	static std::uint64_t now()
+	{
+#if defined(DUMBNOSE_CYCLE_CLOCK_TSC)
+		if(uses_tsc()) return __rdtsc();
+#endif
+		return steady_ns();
+	}
+
+	static std::uint64_t to_ns(std::uint64_t ticks)
+	{
+		return static_cast<std::uint64_t>(static_cast<double>(ticks)*ns_per_tick());
+	}
+
+	static bool uses_tsc()
+	{
+		static const bool invariant = has_invariant_tsc();
+		return invariant;
+	}
+
+	// Calibrated on first use, which takes a few milliseconds; call early to keep that off a hot path
+	static double ns_per_tick()
+	{
+		static const double scale = calibrate();
+		return scale;
+	}
+
+private:
+	static std::uint64_t steady_ns()
+	{
+		return static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count());
+	}
+
+	static bool has_invariant_tsc()
+	{
+#if defined(DUMBNOSE_CYCLE_CLOCK_TSC) && defined(_MSC_VER)
+		int registers[4];
+		__cpuid(registers, 0x80000000);
+		if(static_cast<unsigned int>(registers[0])<0x80000007) return false;
+		__cpuid(registers, 0x80000007);
+		return (registers[3] & (1 << 8))!=0;
+#elif defined(DUMBNOSE_CYCLE_CLOCK_TSC)
+		unsigned int eax, ebx, ecx, edx;
+		if(!__get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx)) return false;
+		return (edx & (1u << 8))!=0;
+#else
+		return false;
+#endif
+	}
+
+	static double calibrate()
+	{
+		if(!uses_tsc()) return 1.0;
+
+		// spin rather than sleep so that a descheduled thread can't skew the two reads apart
+		std::uint64_t steady_start = steady_ns();
+		std::uint64_t ticks_start = now();
+		std::uint64_t steady_end, ticks_end;
+		do {
+			steady_end = steady_ns();
+			ticks_end = now();
+		} while(steady_end-steady_start<5000000);
+
+		if(ticks_end<=ticks_start) return 1.0;
+		return static_cast<double>(steady_end-steady_start)/static_cast<double>(ticks_end-ticks_start);
+	}
+};
+
+
+#if defined(_WIN32)
+
 class hires_timer
 {
 public:
@@ -21,6 +122,12 @@ public:
 		return ((double)current().QuadPart - start_.QuadPart) / frequency_.QuadPart;
 	}
 
+	std::uint64_t elapsed_ns() {
+		std::uint64_t ticks = current().QuadPart - start_.QuadPart;
+		std::uint64_t frequency = frequency_.QuadPart;
+		return ticks / frequency * 1000000000 + ticks % frequency * 1000000000 / frequency;
+	}
+
 protected:
 
 	LARGE_INTEGER frequency() {
@@ -43,4 +150,32 @@ private:
 
 };
 
-}
\ No newline at end of file
+#else
+
+class hires_timer
+{
+public:
+	hires_timer() {
+		reset();
+	}
+
+	void reset() {
+		start_ = std::chrono::steady_clock::now();
+	}
+
+	double elapsed() {
+		return std::chrono::duration<double>(std::chrono::steady_clock::now() - start_).count();
+	}
+
+	std::uint64_t elapsed_ns() {
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start_).count();
+	}
+
+private:
+	std::chrono::steady_clock::time_point start_;
+
+};
+
+#endif
+
+}
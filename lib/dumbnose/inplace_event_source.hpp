@@ -0,0 +1,152 @@
+#pragma once
+
+//
+//	inplace_event_source
+//
+//	An event_source for hot paths.  Listeners are inplace_functions kept in
+//	a fixed array of slots inside the source, so neither registering nor
+//	raising touches the heap, and raise() hands its arguments on without
+//	copying them; declare event_args_t as a const reference and a listener
+//	sees the raiser's own object.  Calling a listener costs a load of its
+//	slot's state plus one indirect call.
+//
+//	Cookies carry the slot index and the slot's generation, so revoking a
+//	cookie whose listener is already gone (and whose slot may have been
+//	reused) does nothing.  They are the same event_source_cookie RAII
+//	objects event_source hands out.
+//
+//	raise() never waits and may run on many threads at once.  Listeners may
+//	unregister themselves or others while being called.  An unregistered
+//	listener is destroyed when its slot is reused, once no raise that could
+//	still be calling it is running; registering only waits for that when
+//	every slot has been used at least once, and then refuses (rather than
+//	deadlocks) if called from inside one of this source's own listeners.
+//	Listeners of other sources, even of the same type, may register here.
+//
+
+#include <cstddef>
+#include <cstdint>
+#include <atomic>
+#include <mutex>
+#include <stdexcept>
+#include <utility>
+#include <dumbnose/noncopyable.hpp>
+#include <dumbnose/event_source.hpp>
+#include <dumbnose/inplace_function.hpp>
+#include <dumbnose/aux_/grace_period.hpp>
+
+
+namespace dumbnose {
+
+
+template<class sender_t, class event_args_t, std::size_t max_listeners = 16, std::size_t callback_size = 4*sizeof(void*)>
+class inplace_event_source : dumbnose::noncopyable
+{
+public:
+	using this_t = inplace_event_source<sender_t, event_args_t, max_listeners, callback_size>;
+	using event_handler_t = inplace_function<void(sender_t source, event_args_t args), callback_size>;
+	using cookie_t = event_source_cookie<this_t>;
+
+	static_assert(max_listeners>0, "inplace_event_source needs at least one slot");
+
+	// Throws std::length_error when all max_listeners slots are taken
+	cookie_t register_listener(event_handler_t listener)
+	{
+		std::unique_lock<std::mutex> lock(lock_);
+
+		std::size_t index = free_slot();
+		slot_t& slot = slots_[index];
+		slot.handler_ = std::move(listener);
+
+		std::uint32_t generation = slot.state_.load(std::memory_order_relaxed) >> 1;
+		slot.state_.store((generation << 1) | live, std::memory_order_release);
+		if(index>=used_.load(std::memory_order_relaxed)) used_.store(index+1, std::memory_order_release);
+
+		cookie_t cookie;
+		cookie.initialize(this, (static_cast<uint64_t>(generation) << 32) | (index+1));
+
+		return cookie;
+	}
+
+	void unregister_listener(uint64_t cookie)
+	{
+		if (cookie == 0) return;
+
+		std::size_t index = static_cast<std::size_t>(cookie & 0xFFFFFFFF) - 1;
+		std::uint32_t generation = static_cast<std::uint32_t>(cookie >> 32);
+		if (index >= max_listeners) return;
+
+		std::unique_lock<std::mutex> lock(lock_);
+
+		slot_t& slot = slots_[index];
+		if (slot.state_.load(std::memory_order_relaxed) != ((generation << 1) | live)) return;
+
+		// the handler may be running right now; it is destroyed when the slot is reused
+		slot.state_.store((generation+1) << 1, std::memory_order_release);
+		slot.retired_ = true;
+	}
+
+	template<class raise_sender_t, class raise_args_t>
+	void raise(raise_sender_t&& sender, raise_args_t&& args)
+	{
+		aux::grace_period::read_section reading(readers_);
+
+		std::size_t used = used_.load(std::memory_order_acquire);
+		for (std::size_t i=0 ; i<used ; ++i)
+		{
+			slot_t& slot = slots_[i];
+			if (slot.state_.load(std::memory_order_acquire) & live) slot.handler_(sender, args);
+		}
+	}
+
+private:
+	enum : std::uint32_t { live = 1 };
+
+	struct slot_t
+	{
+		// generation << 1 | live
+		std::atomic<std::uint32_t> state_{0};
+		bool retired_ = false;
+		event_handler_t handler_;
+	};
+
+	std::size_t free_slot()
+	{
+		std::size_t used = used_.load(std::memory_order_relaxed);
+		if (used < max_listeners) return used;
+
+		bool retired = false;
+		for (std::size_t i=0 ; i<max_listeners ; ++i)
+		{
+			if (slots_[i].retired_) retired = true;
+			else if (!(slots_[i].state_.load(std::memory_order_relaxed) & live)) return i;
+		}
+		if (!retired) throw std::length_error("inplace_event_source has no free listener slot");
+
+		// a listener of this source would be waiting for its own raise to finish
+		if (readers_.reading()) throw std::length_error("inplace_event_source cannot recycle listener slots from inside a listener");
+
+		// wait out raises that may still be calling retired handlers, then recycle them all
+		readers_.synchronize();
+
+		std::size_t first = max_listeners;
+		for (std::size_t i=0 ; i<max_listeners ; ++i)
+		{
+			slot_t& slot = slots_[i];
+			if (!slot.retired_) continue;
+
+			slot.handler_ = nullptr;
+			slot.retired_ = false;
+			if (first==max_listeners) first = i;
+		}
+		return first;
+	}
+
+	std::mutex lock_;
+	aux::grace_period readers_;
+	std::atomic<std::size_t> used_{0};
+	slot_t slots_[max_listeners];
+};
+
+
+} // namespace dumbnose
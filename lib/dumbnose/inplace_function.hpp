@@ -0,0 +1,131 @@
+#pragma once
+
+//
+//	inplace_function
+//
+//	A std::function that never allocates: the callable is stored in a fixed
+//	buffer inside the object, and one that does not fit is a compile-time
+//	error rather than a trip to the heap.  Calling it is a single indirect
+//	call.
+//
+//	It is move-only, which is all a listener list needs, so callables that
+//	capture move-only state work as well.
+//
+//		inplace_function<void(int), 16> print = [prefix](int value){ ... };
+//
+
+#include <cstddef>
+#include <functional>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+
+namespace dumbnose {
+
+
+template<class signature_t, std::size_t capacity = 4*sizeof(void*)>
+class inplace_function;
+
+template<class result_t, class... args_t, std::size_t capacity>
+class inplace_function<result_t(args_t...), capacity>
+{
+public:
+	inplace_function() noexcept = default;
+
+	inplace_function(std::nullptr_t) noexcept {}
+
+	template<class callable_t, class stored_t = std::decay_t<callable_t>,
+		class = std::enable_if_t<!std::is_same_v<stored_t, inplace_function> && std::is_invocable_r_v<result_t, stored_t&, args_t...> > >
+	inplace_function(callable_t&& callable)
+	{
+		static_assert(sizeof(stored_t)<=capacity, "callable does not fit in this inplace_function; raise its capacity");
+		static_assert(alignof(stored_t)<=alignof(std::max_align_t), "callable is over-aligned for inplace_function");
+		static_assert(std::is_nothrow_move_constructible_v<stored_t>, "inplace_function callables must be nothrow move constructible");
+
+		::new (static_cast<void*>(buffer_)) stored_t(std::forward<callable_t>(callable));
+		invoke_ = &invoke<stored_t>;
+		manage_ = &manage<stored_t>;
+	}
+
+	inplace_function(inplace_function&& other) noexcept
+	{
+		take(other);
+	}
+
+	inplace_function& operator=(inplace_function&& other) noexcept
+	{
+		if(this!=&other) {
+			reset();
+			take(other);
+		}
+		return *this;
+	}
+
+	inplace_function& operator=(std::nullptr_t) noexcept
+	{
+		reset();
+		return *this;
+	}
+
+	inplace_function(inplace_function const &) = delete;
+	inplace_function& operator=(inplace_function const &) = delete;
+
+	~inplace_function()
+	{
+		reset();
+	}
+
+	result_t operator()(args_t... args) const
+	{
+		if(!invoke_) throw std::bad_function_call();
+		return invoke_(buffer_, std::forward<args_t>(args)...);
+	}
+
+	explicit operator bool() const noexcept { return invoke_!=nullptr; }
+
+	void reset() noexcept
+	{
+		if(manage_) manage_(buffer_, nullptr);
+		invoke_ = nullptr;
+		manage_ = nullptr;
+	}
+
+private:
+	typedef result_t (*invoke_t)(void* callable, args_t&&... args);
+
+	// Moves the callable from source to target, or destroys source when target is null
+	typedef void (*manage_t)(void* source, void* target);
+
+	template<class stored_t>
+	static result_t invoke(void* callable, args_t&&... args)
+	{
+		return std::invoke(*static_cast<stored_t*>(callable), std::forward<args_t>(args)...);
+	}
+
+	template<class stored_t>
+	static void manage(void* source, void* target)
+	{
+		stored_t* callable = static_cast<stored_t*>(source);
+		if(target) ::new (target) stored_t(std::move(*callable));
+		callable->~stored_t();
+	}
+
+	void take(inplace_function& other) noexcept
+	{
+		if(!other.manage_) return;
+
+		other.manage_(other.buffer_, buffer_);
+		invoke_ = other.invoke_;
+		manage_ = other.manage_;
+		other.invoke_ = nullptr;
+		other.manage_ = nullptr;
+	}
+
+	invoke_t invoke_ = nullptr;
+	manage_t manage_ = nullptr;
+	alignas(std::max_align_t) mutable unsigned char buffer_[capacity];
+};
+
+
+} // namespace dumbnose
@@ -1,39 +1,113 @@
 #pragma once
 
 
-#include <dumbnose/critical_section.hpp>
-#include <dumbnose/semaphore.hpp>
-#include <list>
+#include <dumbnose/mpmc_queue.hpp>
+#include <dumbnose/metrics.hpp>
+#include <atomic>
+#include <iterator>
+#include <string>
+#include <utility>
+#include <vector>
 
 namespace dumbnose {
 
+//
+// Bounded producer/consumer queue of jobs.  Backed by mpmc_queue, so jobs
+// may be move-only and adding or getting a job never allocates.  add_job
+// blocks while the queue is full; get_job blocks while it is empty.
+//
 template<class job_t>
 class job_queue
 {
 public:
-	job_queue() : sem_(0,1000) {}
+	explicit job_queue(std::size_t capacity = 1024) : queue_(capacity) {}
 
-	void add_job(job_t& job)
+	void add_job(const job_t& job)
 	{
-		HOLD_LOCK(list_lock_);
-		job_list_.push_back(job);
-		sem_.release();
+		queue_.push(job);
+		count(added_, 1);
 	}
 
-	job_t get_job()
+	void add_job(job_t&& job)
+	{
+		queue_.push(std::move(job));
+		count(added_, 1);
+	}
+
+	// job is only moved from if it was queued
+	bool try_add_job(job_t&& job)
+	{
+		if(!queue_.try_push(std::move(job))) return false;
+		count(added_, 1);
+		return true;
+	}
+
+	// Queues every job in the range, moving them out of it
+	template<class range_t>
+	void add_jobs(range_t&& jobs)
 	{
-		sem_.acquire();
-		HOLD_LOCK(list_lock_);
-		job_t job = job_list_.front();
-		job_list_.pop_front();
+		std::size_t added = static_cast<std::size_t>(std::distance(std::begin(jobs), std::end(jobs)));
+		queue_.push_bulk(std::begin(jobs), std::end(jobs));
+		count(added_, added);
+	}
 
+	job_t get_job()
+	{
+		job_t job = queue_.pop();
+		count(taken_, 1);
 		return job;
 	}
 
+	bool try_get_job(job_t& job)
+	{
+		if(!queue_.try_pop(job)) return false;
+		count(taken_, 1);
+		return true;
+	}
+
+	// Blocks until a job is available, then appends up to max_jobs to jobs
+	std::size_t get_jobs(std::vector<job_t>& jobs, std::size_t max_jobs)
+	{
+		std::size_t taken = queue_.pop_bulk(std::back_inserter(jobs), max_jobs);
+		count(taken_, taken);
+		return taken;
+	}
+
+	std::vector<job_t> get_jobs(std::size_t max_jobs)
+	{
+		std::vector<job_t> jobs;
+		get_jobs(jobs, max_jobs);
+		return jobs;
+	}
+
+	std::size_t size() const { return queue_.size(); }
+
+	//
+	// Publish name_depth and name_capacity, and count jobs in
+	// name_added_total and name_taken_total from now on.  The callbacks are
+	// withdrawn with the queue.
+	//
+	void publish_metrics(std::string const & name, metrics_registry& registry = metrics_registry::instance())
+	{
+		depth_ = registry.publish(metric_type::gauge, name + "_depth", "Jobs queued", [this]{ return static_cast<double>(queue_.size()); });
+		capacity_ = registry.publish(metric_type::gauge, name + "_capacity", "Jobs the queue can hold", [this]{ return static_cast<double>(queue_.capacity()); });
+		added_.store(&registry.add_counter(name + "_added_total", "Jobs queued"), std::memory_order_release);
+		taken_.store(&registry.add_counter(name + "_taken_total", "Jobs taken"), std::memory_order_release);
+	}
+
 private:
-	dumbnose::semaphore sem_;
-	dumbnose::critical_section list_lock_;
-	std::list<job_t> job_list_;
+	static void count(std::atomic<counter*> const & jobs, std::size_t amount)
+	{
+		if(counter* published = jobs.load(std::memory_order_acquire)) published->add(amount);
+	}
+
+	dumbnose::mpmc_queue<job_t> queue_;
+
+	// see publish_metrics()
+	std::atomic<counter*> added_{nullptr};
+	std::atomic<counter*> taken_{nullptr};
+	metrics_publication depth_;
+	metrics_publication capacity_;
 };
 
 
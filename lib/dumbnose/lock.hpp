@@ -1,13 +1,36 @@
 #ifndef __LOCK_HPP
 #define __LOCK_HPP
 
+#include <chrono>
+#include <type_traits>
+#include <dumbnose/preprocessor.hpp>
 
 namespace dumbnose
 {
 
 
+// Timeout meaning "wait forever"; the same value as Win32's INFINITE
+const unsigned int infinite_wait = 0xFFFFFFFF;
+
 class lock_base{};
 
+
+namespace aux {
+
+// try_acquire_until() deadlines on any clock are waited out on steady_clock
+template<class clock_t, class duration_t>
+std::chrono::steady_clock::time_point steady_deadline(std::chrono::time_point<clock_t,duration_t> const & deadline)
+{
+	if constexpr (std::is_same_v<clock_t, std::chrono::steady_clock>) {
+		return std::chrono::time_point_cast<std::chrono::steady_clock::duration>(deadline);
+	} else {
+		return std::chrono::steady_clock::now()+std::chrono::duration_cast<std::chrono::steady_clock::duration>(deadline-clock_t::now());
+	}
+}
+
+} // namespace aux
+
+
 template<typename lock_t>
 class lock_holder : public lock_base
 {
@@ -32,13 +55,115 @@ hold_lock(lock_t& lock)
 	return lock_holder<lock_t>(lock);
 }
 
-typedef const lock_base& lock_type;
+//
+// Holder that may not get the lock: it tries once, or for a while, and
+// owns_lock() says whether it succeeded.  Handy for non-blocking fast
+// paths and for shedding work when a lock is too busy.
+//
+//	if(auto held=try_hold_lock_for(lock, std::chrono::milliseconds(5))) {
+//		...
+//	}
+//
+template<typename lock_t>
+class try_lock_holder : public lock_base
+{
+public:
+	explicit try_lock_holder(const lock_t& lock) : lock_(lock), owns_(lock_.try_acquire()) {}
+
+	template<class rep_t, class period_t>
+	try_lock_holder(const lock_t& lock, std::chrono::duration<rep_t,period_t> const & timeout)
+		: lock_(lock), owns_(lock_.try_acquire_for(timeout)) {}
+
+	template<class clock_t, class duration_t>
+	try_lock_holder(const lock_t& lock, std::chrono::time_point<clock_t,duration_t> const & deadline)
+		: lock_(lock), owns_(lock_.try_acquire_until(deadline)) {}
+
+	~try_lock_holder(){if(owns_) lock_.release();}
+
+	bool owns_lock() const {return owns_;}
+	explicit operator bool() const {return owns_;}
+private:
+	const lock_t& lock_;
+	const bool owns_;
+};
+
+template<typename lock_t>
+try_lock_holder<lock_t>
+try_hold_lock(lock_t& lock)
+{
+	return try_lock_holder<lock_t>(lock);
+}
+
+template<typename lock_t, class rep_t, class period_t>
+try_lock_holder<lock_t>
+try_hold_lock_for(lock_t& lock, std::chrono::duration<rep_t,period_t> const & timeout)
+{
+	return try_lock_holder<lock_t>(lock, timeout);
+}
+
+template<typename lock_t, class clock_t, class duration_t>
+try_lock_holder<lock_t>
+try_hold_lock_until(lock_t& lock, std::chrono::time_point<clock_t,duration_t> const & deadline)
+{
+	return try_lock_holder<lock_t>(lock, deadline);
+}
+
+//
+// Holders for reader-writer locks, e.g. as safe_map's read_lock_holder_t
+// and write_lock_holder_t.  lock_t::acquire_shared() returns a token that
+// must be handed back to release_shared().
+//
+template<typename lock_t>
+class shared_lock_holder : public lock_base
+{
+public:
+	shared_lock_holder(const lock_t& lock) : lock_(lock), token_(lock_.acquire_shared()) {}
+
+	~shared_lock_holder(){lock_.release_shared(token_);}
+private:
+	const lock_t& lock_;
+	typename lock_t::shared_token token_;
+};
+
+template<typename lock_t>
+class exclusive_lock_holder : public lock_holder<lock_t>
+{
+public:
+	exclusive_lock_holder(const lock_t& lock) : lock_holder<lock_t>(lock) {}
+};
 
-#define HOLD_LOCK(lock_var) const dumbnose::lock_base& lock##__LINE__ = dumbnose::hold_lock(lock_var);
+template<typename lock_t>
+shared_lock_holder<lock_t>
+hold_shared_lock(lock_t& lock)
+{
+	return shared_lock_holder<lock_t>(lock);
+}
+
+typedef const lock_base& lock_type;
 
 
 } // namespace dumbnose
 
 
+#if defined(DUMBNOSE_LOCK_INSTRUMENTATION)
+
+#include <dumbnose/lock_instrumentation.hpp>
+
+// Each use gets its own lock_site recording contention at this file and line
+#define DUMBNOSE_HOLD_INSTRUMENTED(hold_function, lock_var) \
+	static dumbnose::lock_site ANONYMOUS_VARIABLE(lock_site)(__FILE__, __LINE__, #lock_var); \
+	const dumbnose::lock_base& ANONYMOUS_VARIABLE(lock) = dumbnose::hold_function(lock_var, ANONYMOUS_VARIABLE(lock_site));
+
+#define HOLD_LOCK(lock_var) DUMBNOSE_HOLD_INSTRUMENTED(hold_lock, lock_var)
+#define HOLD_SHARED_LOCK(lock_var) DUMBNOSE_HOLD_INSTRUMENTED(hold_shared_lock, lock_var)
+
+#else
+
+#define HOLD_LOCK(lock_var) const dumbnose::lock_base& ANONYMOUS_VARIABLE(lock) = dumbnose::hold_lock(lock_var);
+#define HOLD_SHARED_LOCK(lock_var) const dumbnose::lock_base& ANONYMOUS_VARIABLE(lock) = dumbnose::hold_shared_lock(lock_var);
+
+#endif
+
+
 #endif // #ifndef __LOCK_HPP
 
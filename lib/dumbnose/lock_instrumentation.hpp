@@ -0,0 +1,278 @@
+#pragma once
+
+//
+//	lock_instrumentation
+//
+//	Per-site lock contention statistics.  Build with
+//	DUMBNOSE_LOCK_INSTRUMENTATION defined and every HOLD_LOCK and
+//	HOLD_SHARED_LOCK records, for its file and line:
+//
+//		- how often it acquired the lock and how often it had to wait
+//		- a log2 histogram of the time spent waiting
+//		- a log2 histogram of the time the lock was held
+//
+//	dump_lock_sites() prints every site that has been reached, hottest
+//	(most total waiting) first.  Without the macro HOLD_LOCK is unchanged
+//	and none of this is compiled in.
+//
+//	An acquisition counts as contended when the lock's try_acquire() fails,
+//	or, for lock types without one, when waiting took longer than a
+//	microsecond.
+//
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <iomanip>
+#include <ostream>
+#include <sstream>
+#include <vector>
+#include <dumbnose/noncopyable.hpp>
+#include <dumbnose/lock.hpp>
+
+
+namespace dumbnose {
+
+
+class lock_site : dumbnose::noncopyable
+{
+public:
+	// bucket i counts durations in [2^i, 2^(i+1)) nanoseconds; bucket 0 also counts 0
+	static constexpr std::size_t bucket_count = 40;
+
+	lock_site(const char* file, int line, const char* expression)
+		: file_(file), line_(line), expression_(expression), next_(head().load(std::memory_order_relaxed))
+	{
+		while(!head().compare_exchange_weak(next_, this, std::memory_order_release, std::memory_order_relaxed)) {}
+	}
+
+	void record_acquire(bool contended, std::uint64_t wait_ns)
+	{
+		acquires_.fetch_add(1, std::memory_order_relaxed);
+		if(contended) contended_.fetch_add(1, std::memory_order_relaxed);
+		wait_ns_.fetch_add(wait_ns, std::memory_order_relaxed);
+		wait_histogram_[bucket(wait_ns)].fetch_add(1, std::memory_order_relaxed);
+	}
+
+	void record_release(std::uint64_t hold_ns)
+	{
+		hold_ns_.fetch_add(hold_ns, std::memory_order_relaxed);
+		hold_histogram_[bucket(hold_ns)].fetch_add(1, std::memory_order_relaxed);
+	}
+
+	const char* file() const { return file_; }
+	int line() const { return line_; }
+	const char* expression() const { return expression_; }
+
+	std::uint64_t acquires() const { return acquires_.load(std::memory_order_relaxed); }
+	std::uint64_t contended() const { return contended_.load(std::memory_order_relaxed); }
+	std::uint64_t total_wait_ns() const { return wait_ns_.load(std::memory_order_relaxed); }
+	std::uint64_t total_hold_ns() const { return hold_ns_.load(std::memory_order_relaxed); }
+	std::uint64_t wait_bucket(std::size_t index) const { return wait_histogram_[index].load(std::memory_order_relaxed); }
+	std::uint64_t hold_bucket(std::size_t index) const { return hold_histogram_[index].load(std::memory_order_relaxed); }
+
+	void reset()
+	{
+		acquires_.store(0, std::memory_order_relaxed);
+		contended_.store(0, std::memory_order_relaxed);
+		wait_ns_.store(0, std::memory_order_relaxed);
+		hold_ns_.store(0, std::memory_order_relaxed);
+		for(std::size_t i=0 ; i<bucket_count ; ++i) {
+			wait_histogram_[i].store(0, std::memory_order_relaxed);
+			hold_histogram_[i].store(0, std::memory_order_relaxed);
+		}
+	}
+
+	// Sites register themselves the first time they are reached
+	static lock_site* first() { return head().load(std::memory_order_acquire); }
+	lock_site* next() const { return next_; }
+
+	static std::size_t bucket(std::uint64_t ns)
+	{
+		std::size_t index = 0;
+		while(ns>1 && index<bucket_count-1) {
+			ns >>= 1;
+			++index;
+		}
+		return index;
+	}
+
+private:
+	static std::atomic<lock_site*>& head()
+	{
+		static std::atomic<lock_site*> sites{nullptr};
+		return sites;
+	}
+
+	const char* file_;
+	int line_;
+	const char* expression_;
+	lock_site* next_;
+
+	std::atomic<std::uint64_t> acquires_{0};
+	std::atomic<std::uint64_t> contended_{0};
+	std::atomic<std::uint64_t> wait_ns_{0};
+	std::atomic<std::uint64_t> hold_ns_{0};
+	std::atomic<std::uint64_t> wait_histogram_[bucket_count] = {};
+	std::atomic<std::uint64_t> hold_histogram_[bucket_count] = {};
+};
+
+
+namespace aux {
+
+
+typedef std::chrono::steady_clock lock_clock;
+
+const std::uint64_t contended_wait_ns = 1000;
+
+inline std::uint64_t elapsed_ns(lock_clock::time_point from, lock_clock::time_point to)
+{
+	return static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(to-from).count());
+}
+
+// Times one acquisition for a site; acquire() does the locking and tells whether it had to wait
+class site_timer
+{
+public:
+	explicit site_timer(lock_site& site) : site_(site) {}
+
+	template<class acquire_t>
+	void acquire(acquire_t acquire)
+	{
+		lock_clock::time_point start = lock_clock::now();
+		bool waited = acquire();
+		acquired_ = lock_clock::now();
+
+		std::uint64_t wait_ns = elapsed_ns(start, acquired_);
+		site_.record_acquire(waited || wait_ns>contended_wait_ns, wait_ns);
+	}
+
+	void released()
+	{
+		site_.record_release(elapsed_ns(acquired_, lock_clock::now()));
+	}
+
+private:
+	lock_site& site_;
+	lock_clock::time_point acquired_;
+};
+
+
+} // namespace aux
+
+
+//
+// lock_holder that reports to a lock_site
+//
+template<typename lock_t>
+class instrumented_lock_holder : public lock_base
+{
+public:
+	instrumented_lock_holder(const lock_t& lock, lock_site& site) : lock_(lock), timer_(site) {
+		timer_.acquire([this]{
+			if constexpr (requires { lock_.try_acquire(); }) {
+				if(lock_.try_acquire()) return false;
+				lock_.acquire();
+				return true;
+			} else {
+				lock_.acquire();
+				return false;	// judged by how long it took
+			}
+		});
+	}
+
+	~instrumented_lock_holder(){
+		timer_.released();
+		lock_.release();
+	}
+
+private:
+	const lock_t& lock_;
+	aux::site_timer timer_;
+};
+
+template<typename lock_t>
+class instrumented_shared_lock_holder : public lock_base
+{
+public:
+	instrumented_shared_lock_holder(const lock_t& lock, lock_site& site) : lock_(lock), timer_(site) {
+		timer_.acquire([this]{
+			token_ = lock_.acquire_shared();
+			return false;
+		});
+	}
+
+	~instrumented_shared_lock_holder(){
+		timer_.released();
+		lock_.release_shared(token_);
+	}
+
+private:
+	const lock_t& lock_;
+	aux::site_timer timer_;
+	typename lock_t::shared_token token_;
+};
+
+template<typename lock_t>
+instrumented_lock_holder<lock_t>
+hold_lock(lock_t& lock, lock_site& site)
+{
+	return instrumented_lock_holder<lock_t>(lock, site);
+}
+
+template<typename lock_t>
+instrumented_shared_lock_holder<lock_t>
+hold_shared_lock(lock_t& lock, lock_site& site)
+{
+	return instrumented_shared_lock_holder<lock_t>(lock, site);
+}
+
+
+//
+// Print every site reached so far, most total waiting first
+//
+inline void dump_lock_sites(std::ostream& out)
+{
+	std::vector<lock_site*> sites;
+	for(lock_site* site=lock_site::first() ; site ; site=site->next()) sites.push_back(site);
+
+	std::sort(sites.begin(), sites.end(), [](lock_site* left, lock_site* right){
+		return left->total_wait_ns()>right->total_wait_ns();
+	});
+
+	for(lock_site* site : sites) {
+		std::uint64_t acquires = site->acquires();
+		if(acquires==0) continue;
+
+		// formatted apart so the caller's stream keeps its own flags
+		std::ostringstream percent;
+		percent << std::fixed << std::setprecision(1) << 100.0*site->contended()/acquires;
+
+		out << site->file() << "(" << site->line() << "): " << site->expression() << "\n"
+			<< "  acquires " << acquires
+			<< ", contended " << site->contended()
+			<< " (" << percent.str() << "%)"
+			<< ", wait " << site->total_wait_ns()/1000 << "us"
+			<< ", held " << site->total_hold_ns()/1000 << "us\n";
+
+		const char* names[] = { "  wait ns", "  held ns" };
+		for(int which=0 ; which<2 ; ++which) {
+			out << names[which];
+			for(std::size_t i=0 ; i<lock_site::bucket_count ; ++i) {
+				std::uint64_t count = which==0 ? site->wait_bucket(i) : site->hold_bucket(i);
+				if(count) out << "  <" << (std::uint64_t(1) << (i+1)) << ":" << count;
+			}
+			out << "\n";
+		}
+	}
+}
+
+inline void reset_lock_sites()
+{
+	for(lock_site* site=lock_site::first() ; site ; site=site->next()) site->reset();
+}
+
+
+} // namespace dumbnose
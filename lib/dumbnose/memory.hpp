@@ -1,81 +1,261 @@
 #pragma once
 
+//
+//	memory
+//
+//	Bump allocation for memory whose lifetime is a scope or a request:
+//
+//	monotonic_buffer	hands out memory by advancing a pointer through an
+//						optional caller-supplied buffer, then through chunks
+//						taken from an upstream std::pmr::memory_resource
+//						(each twice the size of the last).  Individual
+//						deallocations are ignored, except that freeing the
+//						most recent allocation gives it back; everything is
+//						returned at once by release() or the destructor.
+//	arena				a heap-backed monotonic_buffer that can be reset() and
+//						reused: it keeps its memory, coalesced into a single
+//						chunk, so a loop of requests soon stops going
+//						upstream at all.
+//	arena_allocator		STL allocator over either of them; rebinding keeps
+//						the same buffer, so node-based containers work.
+//	fixed_allocator		arena_allocator over a monotonic_buffer built on a
+//						fixed buffer with std::pmr::null_memory_resource()
+//						upstream, which throws std::bad_alloc when full.
+//
+//		dumbnose::arena scratch(64*1024);
+//		for(request& r : requests) {
+//			std::vector<int, dumbnose::arena_allocator<int, dumbnose::arena>> ids{dumbnose::arena_allocator<int, dumbnose::arena>(scratch)};
+//			...
+//			ids.clear(); scratch.reset();
+//		}
+//
+//	Both buffers are also std::pmr::memory_resources, so std::pmr
+//	containers can use them (through a virtual call) as well.  Neither is
+//	thread-safe.
+//
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory_resource>
+#include <new>
+#include <type_traits>
+#include <dumbnose/noncopyable.hpp>
+
+
 namespace dumbnose {
 
 
-template<class type_t>
-class fixed_allocator 
+class monotonic_buffer : public std::pmr::memory_resource, dumbnose::noncopyable
 {
 public:
-	typedef type_t value_type;
-	typedef type_t *pointer;
-	typedef type_t& reference;
-	typedef const type_t* const_pointer;
-	typedef const type_t& const_reference;
+	explicit monotonic_buffer(std::size_t initial_chunk = 4096, std::pmr::memory_resource* upstream = std::pmr::new_delete_resource())
+		: upstream_(upstream), next_chunk_(std::max(initial_chunk, min_chunk)) {}
 
-	typedef size_t size_type;
-	typedef ptrdiff_t difference_type;
+	monotonic_buffer(void* buffer, std::size_t size, std::pmr::memory_resource* upstream = std::pmr::new_delete_resource())
+		: upstream_(upstream), buffer_(static_cast<char*>(buffer)), buffer_size_(size),
+		  current_(buffer_), end_(buffer_+size), next_chunk_(std::max(2*size, min_chunk)) {}
 
-	// constructors
-	fixed_allocator<type_t>(pointer memory, size_t size) : storage_(memory), size_(size) {}
+	~monotonic_buffer() { release(); }
 
-	pointer allocate(size_type count)
+	void* allocate(std::size_t bytes, std::size_t alignment = alignof(std::max_align_t))
 	{
-		assert(count<=size_);
-		if(count>size_) throw std::length_error(__FUNCTION__ ": Length exceeds fixed buffer size");
+		char* aligned = align_up(current_, alignment);
+		if(aligned && aligned<=end_ && bytes<=static_cast<std::size_t>(end_-aligned)) {
+			last_ = aligned;
+			current_ = aligned+bytes;
+			return aligned;
+		}
+		return allocate_from_chunk(bytes, alignment);
+	}
 
-		return storage_;
+	// Only the most recent allocation is given back
+	void deallocate(void* memory, std::size_t bytes, std::size_t = alignof(std::max_align_t)) noexcept
+	{
+		if(memory==last_ && static_cast<char*>(memory)+bytes==current_) {
+			current_ = last_;
+			last_ = nullptr;
+		}
 	}
 
-	pointer allocate(size_type _Count, const void* hint)
-	{	// use hint
-		assert(count<=size_);
-		if(count>size_) throw std::length_error(__FUNCTION__ ": Length exceeds fixed buffer size");
+	// Return every chunk upstream and start over at the caller's buffer
+	void release() noexcept
+	{
+		while(chunks_) {
+			chunk_t* next = chunks_->next_;
+			upstream_->deallocate(chunks_, chunks_->size_, alignof(chunk_t));
+			chunks_ = next;
+		}
+		rewind();
+	}
 
-		storage_ = hint;
-		return hint;
+	// Bytes held upstream, not counting the caller's buffer
+	std::size_t upstream_bytes() const
+	{
+		std::size_t total = 0;
+		for(chunk_t* chunk=chunks_ ; chunk ; chunk=chunk->next_) total += chunk->size_;
+		return total;
 	}
 
-	pointer address(reference val) const
-	{	// return address of mutable val
-		return &val;
+	std::pmr::memory_resource* upstream() const { return upstream_; }
+
+protected:
+	struct alignas(std::max_align_t) chunk_t
+	{
+		chunk_t* next_;
+		std::size_t size_;			// including this header
+	};
+
+	static constexpr std::size_t min_chunk = 256;
+
+	static char* align_up(char* pointer, std::size_t alignment)
+	{
+		std::uintptr_t address = reinterpret_cast<std::uintptr_t>(pointer);
+		std::uintptr_t aligned = (address+alignment-1) & ~(static_cast<std::uintptr_t>(alignment)-1);
+		return aligned<address ? nullptr : reinterpret_cast<char*>(aligned);
 	}
 
-	const_pointer address(const_reference val) const
-	{	// return address of nonmutable val
-		return (&val);
+	void rewind()
+	{
+		current_ = buffer_;
+		end_ = buffer_ ? buffer_+buffer_size_ : nullptr;
+		last_ = nullptr;
 	}
 
-	void deallocate(pointer _Ptr, size_type)
-	{	
-		// noop
+	// Take a chunk of size bytes (header included) and allocate from it
+	void use_chunk(std::size_t size)
+	{
+		chunk_t* chunk = static_cast<chunk_t*>(upstream_->allocate(size, alignof(chunk_t)));
+		chunk->next_ = chunks_;
+		chunk->size_ = size;
+		chunks_ = chunk;
+		use_newest_chunk();
 	}
 
-	void destroy(pointer _Ptr)
+	void use_newest_chunk()
 	{
-		// noop
+		current_ = reinterpret_cast<char*>(chunks_+1);
+		end_ = reinterpret_cast<char*>(chunks_)+chunks_->size_;
+		last_ = nullptr;
 	}
 
-	size_type max_size() const 
-	{	
-		return size_;
+	chunk_t* chunks_ = nullptr;		// newest first
+
+private:
+	void* allocate_from_chunk(std::size_t bytes, std::size_t alignment)
+	{
+		std::size_t needed = sizeof(chunk_t)+bytes+alignment;
+		if(needed<bytes) throw std::bad_alloc();
+
+		std::size_t size = std::max(next_chunk_, needed);
+		use_chunk(size);
+		next_chunk_ = std::max(next_chunk_, size)*2;
+
+		char* aligned = align_up(current_, alignment);
+		last_ = aligned;
+		current_ = aligned+bytes;
+		return aligned;
 	}
 
+	void* do_allocate(std::size_t bytes, std::size_t alignment) override { return allocate(bytes, alignment); }
+	void do_deallocate(void* memory, std::size_t bytes, std::size_t alignment) override { deallocate(memory, bytes, alignment); }
+	bool do_is_equal(std::pmr::memory_resource const & other) const noexcept override { return this==&other; }
+
+	std::pmr::memory_resource* upstream_;
+	char* buffer_ = nullptr;
+	std::size_t buffer_size_ = 0;
+
+	char* current_ = nullptr;
+	char* end_ = nullptr;
+	char* last_ = nullptr;			// start of the most recent allocation
+	std::size_t next_chunk_;
+};
+
+
+class arena : public monotonic_buffer
+{
+public:
+	explicit arena(std::size_t initial_chunk = 4096, std::pmr::memory_resource* upstream = std::pmr::new_delete_resource())
+		: monotonic_buffer(initial_chunk, upstream) {}
+
+	//
+	// Forget every allocation but keep the memory.  Memory spread over
+	// several chunks is swapped for one chunk as large as all of them, so
+	// the next round fits without going upstream.
+	//
+	void reset()
+	{
+		if(!chunks_) return;
+
+		if(chunks_->next_) {
+			std::size_t total = upstream_bytes();
+			release();
+			use_chunk(total);
+		} else {
+			use_newest_chunk();
+		}
+	}
+};
+
+
+//
+// STL allocator over a monotonic_buffer or an arena.  Copies and rebinds
+// share the buffer; allocators compare equal when they share one.
+//
+template<class type_t, class buffer_t = monotonic_buffer>
+class arena_allocator
+{
+public:
+	typedef type_t value_type;
+	typedef std::size_t size_type;
+	typedef std::ptrdiff_t difference_type;
+
+	typedef std::true_type propagate_on_container_move_assignment;
+	typedef std::true_type propagate_on_container_swap;
+	typedef std::false_type is_always_equal;
+
 	template<class other_t>
 	struct rebind
-	{	// convert an allocator<_Ty> to an allocator <_Other>
-		typedef fixed_allocator<other_t> other;
+	{
+		typedef arena_allocator<other_t, buffer_t> other;
 	};
 
-private:
-	// disable default allocator
-	fixed_allocator<type_t>()/* : storage_(0){}*/;
+	explicit arena_allocator(buffer_t& buffer) noexcept : buffer_(&buffer) {}
 
-private:
-	pointer storage_;
-	size_t size_;
+	template<class other_t>
+	arena_allocator(arena_allocator<other_t, buffer_t> const & other) noexcept : buffer_(other.buffer()) {}
 
+	type_t* allocate(size_type count)
+	{
+		if(count>static_cast<size_type>(-1)/sizeof(type_t)) throw std::bad_array_new_length();
+		return static_cast<type_t*>(buffer_->allocate(count*sizeof(type_t), alignof(type_t)));
+	}
+
+	void deallocate(type_t* memory, size_type count) noexcept
+	{
+		buffer_->deallocate(memory, count*sizeof(type_t), alignof(type_t));
+	}
+
+	buffer_t* buffer() const noexcept { return buffer_; }
+
+	template<class other_t>
+	bool operator==(arena_allocator<other_t, buffer_t> const & other) const noexcept { return buffer_==other.buffer(); }
+
+	template<class other_t>
+	bool operator!=(arena_allocator<other_t, buffer_t> const & other) const noexcept { return buffer_!=other.buffer(); }
+
+private:
+	buffer_t* buffer_;
 };
 
 
+//
+// Allocator for containers that must live in a buffer the caller supplies
+// (see fixed_string): build the monotonic_buffer over it with
+// std::pmr::null_memory_resource() as upstream so overflowing throws.
+//
+template<class type_t>
+using fixed_allocator = arena_allocator<type_t, monotonic_buffer>;
+
+
 } // namespace dumbnose
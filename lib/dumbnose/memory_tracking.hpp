@@ -1,43 +1,429 @@
 #pragma once
 
-#include <dumbnose\safe_map.hpp>
-#include <cassert>
+//
+//	memory_tracking
+//
+//	Heap accounting for chosen types, cheap enough to leave on in
+//	production.  Derive from memory_tracking<T> to track T:
+//
+//		class session : public dumbnose::memory_tracking<session> { ... };
+//
+//	Every new and delete of a tracked type updates its counters: bytes and
+//	objects allocated and freed, sharded per CPU like metrics' counter, so
+//	threads never contend on them.
+//
+//	On top of that, allocations are sampled the way tcmalloc's heap
+//	profiler does it: each thread samples the allocation that crosses a
+//	randomly drawn byte count, exponentially distributed with a mean of
+//	set_memory_sampling_interval() bytes (512KB by default; 0 turns
+//	sampling off).  A sampled allocation captures its call stack and is
+//	weighted by the inverse of its chance of being sampled, so the live
+//	samples estimate live bytes by call site without bias.  Allocations
+//	that are not sampled cost a thread-local subtraction.
+//
+//	Each tracked allocation carries a 16 byte header holding its size and
+//	sample, so that delete finds both without a lookup.
+//
+//	take_memory_profile() returns live bytes by type and estimated live
+//	bytes by call site; dump_memory_profile() prints them.  Stacks are
+//	captured with backtrace() on glibc and CaptureStackBackTrace() on
+//	Windows, elsewhere call sites are not available.
+//
 
-#pragma warning(disable:4786)
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <memory_resource>
+#include <mutex>
+#include <new>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <typeinfo>
+#include <vector>
+#include <boost/core/demangle.hpp>
+#include <dumbnose/noncopyable.hpp>
+#include <dumbnose/metrics.hpp>
 
-namespace dumbnose 
+#if defined(_WIN32)
+#include <windows.h>
+#elif defined(__GLIBC__)
+#include <execinfo.h>
+#include <cstdlib>
+#endif
+
+
+namespace dumbnose {
+
+
+class tracked_type : dumbnose::noncopyable
+{
+public:
+	explicit tracked_type(std::string name) : name_(std::move(name)) {}
+
+	void allocated(std::size_t size)
+	{
+		bytes_allocated_.add(size);
+		objects_allocated_.add();
+	}
+
+	void freed(std::size_t size)
+	{
+		bytes_freed_.add(size);
+		objects_freed_.add();
+	}
+
+	std::string const & name() const { return name_; }
+
+	// The shards are read one at a time, so under way allocations may be half counted
+	std::uint64_t live_bytes() const { return difference(bytes_allocated_, bytes_freed_); }
+	std::uint64_t live_objects() const { return difference(objects_allocated_, objects_freed_); }
+	std::uint64_t total_allocations() const { return objects_allocated_.value(); }
+
+private:
+	static std::uint64_t difference(counter const & added, counter const & removed)
+	{
+		std::uint64_t out = removed.value();
+		std::uint64_t in = added.value();
+		return in>out ? in-out : 0;
+	}
+
+	const std::string name_;
+	counter bytes_allocated_;
+	counter bytes_freed_;
+	counter objects_allocated_;
+	counter objects_freed_;
+};
+
+
+struct memory_profile
+{
+	struct type_usage
+	{
+		std::string name;
+		std::uint64_t live_bytes;
+		std::uint64_t live_objects;
+		std::uint64_t total_allocations;
+	};
+
+	struct site_usage
+	{
+		std::vector<void*> stack;			// innermost first, starting in the tracker itself
+		std::uint64_t estimated_bytes;
+		std::uint64_t samples;
+	};
+
+	std::vector<type_usage> types;			// most live bytes first
+	std::vector<site_usage> sites;			// most estimated bytes first
+	std::size_t sampling_interval;
+};
+
+
+namespace aux {
+
+
+struct allocation_sample
+{
+	static constexpr int max_depth = 32;
+
+	allocation_sample* prev_;
+	allocation_sample* next_;
+	std::uint64_t estimated_bytes_;
+	int depth_;
+	void* stack_[max_depth];
+};
+
+// Precedes every tracked allocation; a multiple of the default new alignment
+struct alignas(std::max_align_t) allocation_header
+{
+	allocation_sample* sample_;
+	std::size_t size_;
+};
+
+// Trivial, so reaching it is a plain thread-local access; random_ is 0 until seeded
+struct allocation_sampler
+{
+	std::int64_t bytes_until_sample_;
+	std::uint64_t random_;
+};
+
+inline allocation_sampler& current_sampler()
+{
+	static thread_local allocation_sampler sampler{};
+	return sampler;
+}
+
+
+// Every tracked type and every live sample
+class memory_tracker : dumbnose::noncopyable
+{
+public:
+	static constexpr std::size_t default_interval = 512*1024;
+
+	static memory_tracker& instance()
+	{
+		// never destroyed: tracked objects may be deleted as late as process exit
+		static memory_tracker* tracker = new memory_tracker;
+		return *tracker;
+	}
+
+	tracked_type& add(std::string name)
+	{
+		std::lock_guard<std::mutex> lock(lock_);
+		types_.emplace_back(new tracked_type(std::move(name)));
+		return *types_.back();
+	}
+
+	std::size_t interval() const { return interval_.load(std::memory_order_relaxed); }
+	void set_interval(std::size_t bytes) { interval_.store(bytes, std::memory_order_relaxed); }
+
+	// Called once the thread's byte count runs out: nullptr or a sample of this allocation
+	allocation_sample* sample(allocation_sampler& sampler, std::size_t size)
+	{
+		std::size_t mean = interval();
+		if(!mean) {
+			// look again after another default interval
+			sampler.bytes_until_sample_ = default_interval;
+			return nullptr;
+		}
+
+		bool seeded = sampler.random_!=0;
+		if(!seeded) seed(sampler);
+		sampler.bytes_until_sample_ = next_distance(sampler, mean);
+		if(!seeded) return nullptr;
+
+		// an allocation of size bytes was sampled with probability 1-exp(-size/mean)
+		double probability = 1.0-std::exp(-static_cast<double>(size)/static_cast<double>(mean));
+		allocation_sample* sample = new allocation_sample;
+		sample->estimated_bytes_ = static_cast<std::uint64_t>(static_cast<double>(size)/probability);
+		sample->depth_ = capture_stack(sample->stack_, allocation_sample::max_depth);
+
+		std::lock_guard<std::mutex> lock(lock_);
+		sample->prev_ = nullptr;
+		sample->next_ = samples_;
+		if(samples_) samples_->prev_ = sample;
+		samples_ = sample;
+		return sample;
+	}
+
+	void release(allocation_sample* sample)
+	{
+		{
+			std::lock_guard<std::mutex> lock(lock_);
+			if(sample->prev_) sample->prev_->next_ = sample->next_;
+			else samples_ = sample->next_;
+			if(sample->next_) sample->next_->prev_ = sample->prev_;
+		}
+		delete sample;
+	}
+
+	memory_profile take_profile() const
+	{
+		memory_profile profile;
+		profile.sampling_interval = interval();
+
+		std::map<std::vector<void*>, memory_profile::site_usage> sites;
+		{
+			std::lock_guard<std::mutex> lock(lock_);
+			for(std::unique_ptr<tracked_type> const & type : types_) {
+				profile.types.push_back({ type->name(), type->live_bytes(), type->live_objects(), type->total_allocations() });
+			}
+			for(allocation_sample* sample=samples_ ; sample ; sample=sample->next_) {
+				std::vector<void*> stack(sample->stack_, sample->stack_+sample->depth_);
+				memory_profile::site_usage& site = sites[stack];
+				site.estimated_bytes += sample->estimated_bytes_;
+				++site.samples;
+			}
+		}
+
+		for(auto& site : sites) {
+			site.second.stack = site.first;
+			profile.sites.push_back(std::move(site.second));
+		}
+
+		std::sort(profile.types.begin(), profile.types.end(), [](memory_profile::type_usage const & left, memory_profile::type_usage const & right) {
+			return left.live_bytes>right.live_bytes;
+		});
+		std::sort(profile.sites.begin(), profile.sites.end(), [](memory_profile::site_usage const & left, memory_profile::site_usage const & right) {
+			return left.estimated_bytes>right.estimated_bytes;
+		});
+		return profile;
+	}
+
+private:
+	memory_tracker() {}
+
+	static void seed(allocation_sampler& sampler)
+	{
+		std::uint64_t seed = std::hash<std::thread::id>()(std::this_thread::get_id());
+		seed ^= static_cast<std::uint64_t>(std::chrono::steady_clock::now().time_since_epoch().count());
+		seed ^= reinterpret_cast<std::uintptr_t>(&sampler);
+		sampler.random_ = seed ? seed : 1;
+	}
+
+	// Exponentially distributed, so samples form a Poisson process over the bytes allocated
+	static std::int64_t next_distance(allocation_sampler& sampler, std::size_t mean)
+	{
+		// xorshift64*
+		sampler.random_ ^= sampler.random_ >> 12;
+		sampler.random_ ^= sampler.random_ << 25;
+		sampler.random_ ^= sampler.random_ >> 27;
+		std::uint64_t bits = (sampler.random_*0x2545F4914F6CDD1Dull) >> 11;
+
+		// uniform in (0,1]
+		double uniform = (static_cast<double>(bits)+1.0)/9007199254740992.0;
+		double distance = -std::log(uniform)*static_cast<double>(mean);
+		return static_cast<std::int64_t>(std::min(distance, 1e15))+1;
+	}
+
+	static int capture_stack(void** stack, int max_depth)
+	{
+#if defined(_WIN32)
+		return CaptureStackBackTrace(0, static_cast<DWORD>(max_depth), stack, NULL);
+#elif defined(__GLIBC__)
+		return backtrace(stack, max_depth);
+#else
+		(void)stack;
+		(void)max_depth;
+		return 0;
+#endif
+	}
+
+	mutable std::mutex lock_;
+	std::vector<std::unique_ptr<tracked_type>> types_;
+	allocation_sample* samples_ = nullptr;
+	std::atomic<std::size_t> interval_{default_interval};
+};
+
+
+// Keeps the object at the alignment it asked for
+inline std::size_t tracked_header_size(std::size_t alignment)
+{
+	return std::max(sizeof(allocation_header), alignment);
+}
+
+inline void* tracked_allocate(tracked_type& type, std::size_t size, std::size_t alignment)
 {
+	allocation_sample* sample = nullptr;
+	allocation_sampler& sampler = current_sampler();
+	sampler.bytes_until_sample_ -= static_cast<std::int64_t>(size);
+	if(sampler.bytes_until_sample_<0) sample = memory_tracker::instance().sample(sampler, size);
+
+	std::size_t header_size = tracked_header_size(alignment);
+	char* raw;
+	try {
+		raw = static_cast<char*>(std::pmr::new_delete_resource()->allocate(header_size+size, alignment));
+	} catch(...) {
+		if(sample) memory_tracker::instance().release(sample);
+		throw;
+	}
+
+	allocation_header* header = reinterpret_cast<allocation_header*>(raw+header_size-sizeof(allocation_header));
+	header->sample_ = sample;
+	header->size_ = size;
+	type.allocated(size);
+	return raw+header_size;
+}
+
+inline void tracked_free(tracked_type& type, void* memory, std::size_t alignment)
+{
+	if(!memory) return;
+
+	allocation_header* header = reinterpret_cast<allocation_header*>(static_cast<char*>(memory)-sizeof(allocation_header));
+	std::size_t size = header->size_;
+	type.freed(size);
+	if(header->sample_) memory_tracker::instance().release(header->sample_);
+
+	std::size_t header_size = tracked_header_size(alignment);
+	std::pmr::new_delete_resource()->deallocate(static_cast<char*>(memory)-header_size, header_size+size, alignment);
+}
+
+} // namespace aux
 
 
 template<class T>
 class memory_tracking
 {
 public:
-	static void * operator new(size_t size)
+	static void* operator new(std::size_t size)
 	{
-		void * raw = ::operator new(size);
-		mem_list_.insert(std::make_pair(raw,size));
+		return aux::tracked_allocate(type(), size, alignof(std::max_align_t));
+	}
 
-		return raw;
+	static void* operator new(std::size_t size, std::align_val_t alignment)
+	{
+		return aux::tracked_allocate(type(), size, static_cast<std::size_t>(alignment));
 	}
 
 	static void operator delete(void* raw)
 	{
-		if(NULL == raw) return;
-
-		mem_list_t::iterator it = mem_list_.find(raw);
-		assert(it!=mem_list_.end());
+		aux::tracked_free(type(), raw, alignof(std::max_align_t));
+	}
 
-		mem_list_.erase(it);
-		::operator delete(raw);
+	static void operator delete(void* raw, std::align_val_t alignment)
+	{
+		aux::tracked_free(type(), raw, static_cast<std::size_t>(alignment));
 	}
 
+	static std::uint64_t live_bytes() { return type().live_bytes(); }
+	static std::uint64_t live_objects() { return type().live_objects(); }
+
 protected:
-	typedef safe_map<void*,size_t> mem_list_t;
-	static mem_list_t mem_list_;
+	static tracked_type& type()
+	{
+		static tracked_type& tracked = aux::memory_tracker::instance().add(boost::core::demangle(typeid(T).name()));
+		return tracked;
+	}
 };
 
-template <class T> typename memory_tracking<T>::mem_list_t memory_tracking<T>::mem_list_;
+
+// Mean bytes between samples; 0 turns sampling off
+inline void set_memory_sampling_interval(std::size_t bytes)
+{
+	aux::memory_tracker::instance().set_interval(bytes);
+}
+
+inline memory_profile take_memory_profile()
+{
+	return aux::memory_tracker::instance().take_profile();
+}
+
+//
+// Print live bytes by type, then the call sites holding the most sampled
+// bytes with up to frames frames each
+//
+inline void dump_memory_profile(std::ostream& out, std::size_t max_sites = 20, int frames = 8)
+{
+	memory_profile profile = take_memory_profile();
+
+	out << "live by type:\n";
+	for(memory_profile::type_usage const & type : profile.types) {
+		out << "  " << type.live_bytes << " bytes in " << type.live_objects << " objects ("
+			<< type.total_allocations << " allocated)  " << type.name << "\n";
+	}
+
+	if(!profile.sampling_interval) return;
+	out << "live by call site (estimated, sampled every " << profile.sampling_interval << " bytes):\n";
+	for(std::size_t i=0 ; i<profile.sites.size() && i<max_sites ; ++i) {
+		memory_profile::site_usage const & site = profile.sites[i];
+		out << "  ~" << site.estimated_bytes << " bytes from " << site.samples << " samples\n";
+
+		int depth = std::min(frames, static_cast<int>(site.stack.size()));
+#if defined(__GLIBC__)
+		char** symbols = backtrace_symbols(site.stack.data(), depth);
+		for(int frame=0 ; frame<depth ; ++frame) out << "      " << (symbols ? symbols[frame] : "?") << "\n";
+		std::free(symbols);
+#else
+		for(int frame=0 ; frame<depth ; ++frame) out << "      " << site.stack[frame] << "\n";
+#endif
+	}
+}
 
 
-} // namespace dumbnose
\ No newline at end of file
+} // namespace dumbnose
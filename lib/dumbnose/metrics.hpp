@@ -0,0 +1,625 @@
+#pragma once
+
+//
+//	metrics
+//
+//	Numeric telemetry, the counterpart of status_notifier's strings.
+//
+//	counter		monotonically increasing count, sharded per CPU so that
+//				threads on different cores never write the same cache line
+//	gauge		a value that goes up and down
+//	histogram	HDR-style log-linear histogram of nanosecond latencies:
+//				every power of two is split into 16 linear sub-buckets,
+//				so any value is reported within about 6%
+//
+//	Recording is a relaxed atomic add (plus a rarely taken CAS for a
+//	histogram's maximum); nothing on the recording path locks or
+//	allocates.
+//
+//	metrics_registry names the metrics and writes snapshots of them as
+//	plain text or in the Prometheus exposition format.  Metrics added to a
+//	registry live as long as it does.  Values that already exist elsewhere,
+//	such as a queue's depth, can be published as callbacks instead; the
+//	returned metrics_publication withdraws the callback when destroyed.
+//	metrics_exporter writes a snapshot to a file (or stdout) periodically.
+//
+//		dumbnose::counter& requests = dumbnose::metrics_registry::instance().add_counter("requests_total", "Requests served");
+//		requests.add();
+//
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <ostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include <dumbnose/noncopyable.hpp>
+#include <dumbnose/singleton.hpp>
+#include <dumbnose/thread_affinity.hpp>
+#include <dumbnose/aux_/spin_wait.hpp>
+
+
+namespace dumbnose {
+
+
+class counter : dumbnose::noncopyable
+{
+public:
+	counter() : shard_mask_(cpu_shard_count()-1), shards_(new shard_t[shard_mask_+1]) {}
+
+	void add(std::uint64_t amount = 1)
+	{
+		shards_[current_cpu() & shard_mask_].value_.fetch_add(amount, std::memory_order_relaxed);
+	}
+
+	std::uint64_t value() const
+	{
+		std::uint64_t total = 0;
+		for(std::size_t i=0 ; i<=shard_mask_ ; ++i) total += shards_[i].value_.load(std::memory_order_relaxed);
+		return total;
+	}
+
+private:
+	struct alignas(aux::cache_line_size) shard_t
+	{
+		std::atomic<std::uint64_t> value_{0};
+	};
+
+	const std::size_t shard_mask_;
+	std::unique_ptr<shard_t[]> shards_;
+};
+
+
+class gauge : dumbnose::noncopyable
+{
+public:
+	void set(std::int64_t value) { value_.store(value, std::memory_order_relaxed); }
+	void add(std::int64_t amount = 1) { value_.fetch_add(amount, std::memory_order_relaxed); }
+	void sub(std::int64_t amount = 1) { value_.fetch_sub(amount, std::memory_order_relaxed); }
+
+	std::int64_t value() const { return value_.load(std::memory_order_relaxed); }
+
+private:
+	std::atomic<std::int64_t> value_{0};
+};
+
+
+class histogram : dumbnose::noncopyable
+{
+public:
+	static constexpr unsigned int sub_bucket_bits = 5;
+	static constexpr std::size_t sub_bucket_count = std::size_t(1) << sub_bucket_bits;
+	static constexpr std::size_t bucket_count = sub_bucket_count + (64-sub_bucket_bits)*(sub_bucket_count/2);
+
+	struct snapshot
+	{
+		std::vector<std::uint64_t> counts;
+		std::uint64_t count = 0;
+		std::uint64_t sum = 0;
+		std::uint64_t min = 0;
+		std::uint64_t max = 0;
+
+		double mean() const { return count ? static_cast<double>(sum)/count : 0.0; }
+
+		void merge(snapshot const & other)
+		{
+			if(other.count==0) return;
+
+			if(counts.size()<other.counts.size()) counts.resize(other.counts.size());
+			for(std::size_t i=0 ; i<other.counts.size() ; ++i) counts[i] += other.counts[i];
+			min = count ? std::min(min, other.min) : other.min;
+			max = std::max(max, other.max);
+			count += other.count;
+			sum += other.sum;
+		}
+
+		// Smallest value at or below which quantile (0..1) of the recorded values fall
+		std::uint64_t value_at(double quantile) const
+		{
+			if(count==0) return 0;
+
+			std::uint64_t rank = static_cast<std::uint64_t>(quantile*count+0.5);
+			rank = std::max<std::uint64_t>(1, std::min(rank, count));
+
+			std::uint64_t seen = 0;
+			for(std::size_t i=0 ; i<counts.size() ; ++i) {
+				seen += counts[i];
+				if(seen>=rank) return std::min(highest_in(i), max);
+			}
+			return max;
+		}
+
+		// Values recorded at or below bound
+		std::uint64_t count_at_or_below(std::uint64_t bound) const
+		{
+			std::uint64_t seen = 0;
+			for(std::size_t i=0 ; i<counts.size() && lowest_in(i)<=bound ; ++i) {
+				if(highest_in(i)<=bound) seen += counts[i];
+			}
+			return seen;
+		}
+	};
+
+	histogram() : counts_(new std::atomic<std::uint64_t>[bucket_count]) {
+		for(std::size_t i=0 ; i<bucket_count ; ++i) counts_[i].store(0, std::memory_order_relaxed);
+	}
+
+	void record(std::uint64_t value)
+	{
+		counts_[index_of(value)].fetch_add(1, std::memory_order_relaxed);
+		count_.fetch_add(1, std::memory_order_relaxed);
+		sum_.fetch_add(value, std::memory_order_relaxed);
+
+		std::uint64_t max = max_.load(std::memory_order_relaxed);
+		while(value>max && !max_.compare_exchange_weak(max, value, std::memory_order_relaxed)) {}
+		std::uint64_t min = min_.load(std::memory_order_relaxed);
+		while(value<min && !min_.compare_exchange_weak(min, value, std::memory_order_relaxed)) {}
+	}
+
+	// Fold in values recorded elsewhere, e.g. by a thread that is exiting
+	void add(snapshot const & other)
+	{
+		if(other.count==0) return;
+
+		for(std::size_t i=0 ; i<other.counts.size() && i<bucket_count ; ++i) {
+			if(other.counts[i]) counts_[i].fetch_add(other.counts[i], std::memory_order_relaxed);
+		}
+		count_.fetch_add(other.count, std::memory_order_relaxed);
+		sum_.fetch_add(other.sum, std::memory_order_relaxed);
+
+		std::uint64_t max = max_.load(std::memory_order_relaxed);
+		while(other.max>max && !max_.compare_exchange_weak(max, other.max, std::memory_order_relaxed)) {}
+		std::uint64_t min = min_.load(std::memory_order_relaxed);
+		while(other.min<min && !min_.compare_exchange_weak(min, other.min, std::memory_order_relaxed)) {}
+	}
+
+	template<class rep_t, class period_t>
+	void record(std::chrono::duration<rep_t, period_t> const & duration)
+	{
+		auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count();
+		record(static_cast<std::uint64_t>(ns<0 ? 0 : ns));
+	}
+
+	// Not atomic across buckets; concurrent records may be partly included
+	snapshot take_snapshot() const
+	{
+		snapshot result;
+		result.counts.resize(bucket_count);
+		for(std::size_t i=0 ; i<bucket_count ; ++i) {
+			result.counts[i] = counts_[i].load(std::memory_order_relaxed);
+			result.count += result.counts[i];
+		}
+		result.sum = sum_.load(std::memory_order_relaxed);
+		result.max = max_.load(std::memory_order_relaxed);
+		result.min = result.count ? std::min(min_.load(std::memory_order_relaxed), result.max) : 0;
+		return result;
+	}
+
+	std::uint64_t count() const { return count_.load(std::memory_order_relaxed); }
+
+	static std::size_t index_of(std::uint64_t value)
+	{
+		if(value<sub_bucket_count) return static_cast<std::size_t>(value);
+
+		unsigned int shift = highest_bit(value)-sub_bucket_bits+1;
+		std::size_t top = static_cast<std::size_t>(value >> shift);
+		return sub_bucket_count + (shift-1)*(sub_bucket_count/2) + (top-sub_bucket_count/2);
+	}
+
+	static std::uint64_t lowest_in(std::size_t index)
+	{
+		if(index<sub_bucket_count) return index;
+
+		std::size_t offset = index-sub_bucket_count;
+		unsigned int shift = static_cast<unsigned int>(offset/(sub_bucket_count/2))+1;
+		std::uint64_t top = sub_bucket_count/2 + offset%(sub_bucket_count/2);
+		return top << shift;
+	}
+
+	static std::uint64_t highest_in(std::size_t index)
+	{
+		if(index<sub_bucket_count) return index;
+
+		unsigned int shift = static_cast<unsigned int>((index-sub_bucket_count)/(sub_bucket_count/2))+1;
+		return lowest_in(index) + ((std::uint64_t(1) << shift)-1);
+	}
+
+private:
+	static unsigned int highest_bit(std::uint64_t value)
+	{
+		unsigned int bit = 0;
+		while(value>>=1) ++bit;
+		return bit;
+	}
+
+	std::unique_ptr<std::atomic<std::uint64_t>[]> counts_;
+	std::atomic<std::uint64_t> count_{0};
+	std::atomic<std::uint64_t> sum_{0};
+	std::atomic<std::uint64_t> min_{~std::uint64_t(0)};
+	std::atomic<std::uint64_t> max_{0};
+};
+
+
+enum class metric_type { counter, gauge, histogram };
+
+class metrics_registry;
+
+//
+// Keeps a callback published; withdraws it when destroyed.  Copies are
+// empty, so objects holding one stay copyable without publishing twice.
+//
+class metrics_publication
+{
+public:
+	metrics_publication() = default;
+	metrics_publication(metrics_registry* registry, std::uint64_t id) : registry_(registry), id_(id) {}
+
+	metrics_publication(metrics_publication const &) {}
+	metrics_publication& operator=(metrics_publication const & other)
+	{
+		if(this!=&other) withdraw();
+		return *this;
+	}
+
+	metrics_publication(metrics_publication&& other) noexcept : registry_(other.registry_), id_(other.id_)
+	{
+		other.registry_ = nullptr;
+	}
+
+	metrics_publication& operator=(metrics_publication&& other) noexcept
+	{
+		if(this!=&other) {
+			withdraw();
+			registry_ = other.registry_;
+			id_ = other.id_;
+			other.registry_ = nullptr;
+		}
+		return *this;
+	}
+
+	~metrics_publication() { withdraw(); }
+
+	inline void withdraw();
+
+private:
+	metrics_registry* registry_ = nullptr;
+	std::uint64_t id_ = 0;
+};
+
+
+class metrics_registry : public dumbnose::singleton<metrics_registry>
+{
+public:
+	// Adding a metric that exists returns it; the type must match
+	counter& add_counter(std::string const & name, std::string const & help, std::string const & labels = std::string())
+	{
+		return *add<counter>(metric_type::counter, name, help, labels, &entry_t::counter_);
+	}
+
+	gauge& add_gauge(std::string const & name, std::string const & help, std::string const & labels = std::string())
+	{
+		return *add<gauge>(metric_type::gauge, name, help, labels, &entry_t::gauge_);
+	}
+
+	// Records nanoseconds; exported in seconds
+	histogram& add_histogram(std::string const & name, std::string const & help, std::string const & labels = std::string())
+	{
+		return *add<histogram>(metric_type::histogram, name, help, labels, &entry_t::histogram_);
+	}
+
+	//
+	// read() is called every time a snapshot is written, outside the
+	// registry's lock so it may take the owner's own locks.  Withdrawing
+	// waits for a call in progress, so the owner can go away right after.
+	//
+	metrics_publication publish(metric_type type, std::string const & name, std::string const & help, std::function<double()> read, std::string const & labels = std::string())
+	{
+		if(type==metric_type::histogram) throw std::invalid_argument("metrics_registry: histograms cannot be published as callbacks");
+
+		std::lock_guard<std::mutex> lock(lock_);
+		entries_.emplace_back();
+		entry_t& entry = entries_.back();
+		entry.type_ = type;
+		entry.name_ = name;
+		entry.help_ = help;
+		entry.labels_ = labels;
+		entry.id_ = ++last_id_;
+		entry.read_ = std::make_shared<callback_t>();
+		entry.read_->read_ = std::move(read);
+		return metrics_publication(this, entry.id_);
+	}
+
+	void withdraw(std::uint64_t id)
+	{
+		std::shared_ptr<callback_t> read;
+		{
+			std::lock_guard<std::mutex> lock(lock_);
+			for(entry_t const & entry : entries_) {
+				if(entry.id_==id) read = entry.read_;
+			}
+			entries_.erase(std::remove_if(entries_.begin(), entries_.end(), [id](entry_t const & entry) { return entry.id_==id; }), entries_.end());
+		}
+
+		// a snapshot being written may still hold the entry
+		if(read) {
+			std::lock_guard<std::mutex> lock(read->lock_);
+			read->read_ = nullptr;
+		}
+	}
+
+	void write_prometheus(std::ostream& out) const
+	{
+		std::string last_name;
+		for(entry_t const & entry : sorted()) {
+			std::optional<double> value;
+			if(entry.type_!=metric_type::histogram && !(value = entry.value())) continue;
+
+			if(entry.name_!=last_name) {
+				out << "# HELP " << entry.name_ << " " << entry.help_ << "\n";
+				out << "# TYPE " << entry.name_ << " " << type_name(entry.type_) << "\n";
+				last_name = entry.name_;
+			}
+
+			if(value) {
+				out << entry.name_ << braced(entry.labels_) << " " << number(*value) << "\n";
+				continue;
+			}
+
+			histogram::snapshot snapshot = entry.histogram_->take_snapshot();
+			for(double bound : bucket_bounds()) {
+				std::uint64_t ns = static_cast<std::uint64_t>(bound*1e9);
+				out << entry.name_ << "_bucket" << braced(joined(entry.labels_, "le=\"" + number(bound) + "\"")) << " " << snapshot.count_at_or_below(ns) << "\n";
+			}
+			out << entry.name_ << "_bucket" << braced(joined(entry.labels_, "le=\"+Inf\"")) << " " << snapshot.count << "\n";
+			out << entry.name_ << "_sum" << braced(entry.labels_) << " " << number(snapshot.sum/1e9) << "\n";
+			out << entry.name_ << "_count" << braced(entry.labels_) << " " << snapshot.count << "\n";
+		}
+	}
+
+	// One line per metric; histograms show count, mean and percentiles
+	void write_text(std::ostream& out) const
+	{
+		for(entry_t const & entry : sorted()) {
+			if(entry.type_!=metric_type::histogram) {
+				std::optional<double> value = entry.value();
+				if(value) out << entry.name_ << braced(entry.labels_) << " " << number(*value) << "\n";
+				continue;
+			}
+
+			histogram::snapshot snapshot = entry.histogram_->take_snapshot();
+			out << entry.name_ << braced(entry.labels_)
+				<< " count=" << snapshot.count
+				<< " mean=" << duration(snapshot.mean())
+				<< " min=" << duration(static_cast<double>(snapshot.min))
+				<< " p50=" << duration(static_cast<double>(snapshot.value_at(0.50)))
+				<< " p90=" << duration(static_cast<double>(snapshot.value_at(0.90)))
+				<< " p99=" << duration(static_cast<double>(snapshot.value_at(0.99)))
+				<< " p99.9=" << duration(static_cast<double>(snapshot.value_at(0.999)))
+				<< " max=" << duration(static_cast<double>(snapshot.max)) << "\n";
+		}
+	}
+
+private:
+	// A published callback, emptied when withdrawn
+	struct callback_t
+	{
+		std::mutex lock_;
+		std::function<double()> read_;
+	};
+
+	// Copied out of the registry to write a snapshot; shared_ptrs keep the metrics alive meanwhile
+	struct entry_t
+	{
+		metric_type type_ = metric_type::counter;
+		std::string name_;
+		std::string help_;
+		std::string labels_;
+		std::uint64_t id_ = 0;
+
+		std::shared_ptr<dumbnose::counter> counter_;
+		std::shared_ptr<dumbnose::gauge> gauge_;
+		std::shared_ptr<dumbnose::histogram> histogram_;
+		std::shared_ptr<callback_t> read_;
+
+		// Empty once a callback has been withdrawn
+		std::optional<double> value() const
+		{
+			if(read_) {
+				std::lock_guard<std::mutex> lock(read_->lock_);
+				if(!read_->read_) return std::nullopt;
+				return read_->read_();
+			}
+			if(counter_) return static_cast<double>(counter_->value());
+			return static_cast<double>(gauge_->value());
+		}
+	};
+
+	template<class metric_t>
+	metric_t* add(metric_type type, std::string const & name, std::string const & help, std::string const & labels, std::shared_ptr<metric_t> entry_t::* member)
+	{
+		std::lock_guard<std::mutex> lock(lock_);
+
+		for(entry_t& entry : entries_) {
+			if(entry.name_!=name || entry.labels_!=labels || entry.read_) continue;
+			if(entry.type_!=type) throw std::logic_error("metrics_registry: " + name + " already exists with another type");
+			return (entry.*member).get();
+		}
+
+		entries_.emplace_back();
+		entry_t& entry = entries_.back();
+		entry.type_ = type;
+		entry.name_ = name;
+		entry.help_ = help;
+		entry.labels_ = labels;
+		entry.id_ = ++last_id_;
+		(entry.*member).reset(new metric_t);
+		return (entry.*member).get();
+	}
+
+	std::vector<entry_t> sorted() const
+	{
+		std::vector<entry_t> result;
+		{
+			std::lock_guard<std::mutex> lock(lock_);
+			result.assign(entries_.begin(), entries_.end());
+		}
+		std::stable_sort(result.begin(), result.end(), [](entry_t const & left, entry_t const & right) { return left.name_<right.name_; });
+		return result;
+	}
+
+	// 1-2-5 steps from a microsecond to 500 seconds
+	static std::vector<double> const & bucket_bounds()
+	{
+		static const std::vector<double> bounds = []{
+			std::vector<double> result;
+			for(double decade=1e-6 ; decade<200 ; decade*=10) {
+				result.push_back(decade);
+				result.push_back(decade*2);
+				result.push_back(decade*5);
+			}
+			return result;
+		}();
+		return bounds;
+	}
+
+	static const char* type_name(metric_type type)
+	{
+		switch(type) {
+		case metric_type::counter:	return "counter";
+		case metric_type::gauge:	return "gauge";
+		default:					return "histogram";
+		}
+	}
+
+	static std::string braced(std::string const & labels)
+	{
+		return labels.empty() ? labels : "{" + labels + "}";
+	}
+
+	static std::string joined(std::string const & labels, std::string const & label)
+	{
+		return labels.empty() ? label : labels + "," + label;
+	}
+
+	static std::string number(double value)
+	{
+		std::ostringstream text;
+		text.precision(15);
+		text << value;
+		return text.str();
+	}
+
+	static std::string duration(double ns)
+	{
+		std::ostringstream text;
+		text.precision(3);
+		if(ns<1e3) text << ns << "ns";
+		else if(ns<1e6) text << ns/1e3 << "us";
+		else if(ns<1e9) text << ns/1e6 << "ms";
+		else text << ns/1e9 << "s";
+		return text.str();
+	}
+
+	mutable std::mutex lock_;
+	std::deque<entry_t> entries_;
+	std::uint64_t last_id_ = 0;
+};
+
+
+inline void metrics_publication::withdraw()
+{
+	if(!registry_) return;
+	registry_->withdraw(id_);
+	registry_ = nullptr;
+}
+
+
+enum class metrics_format { text, prometheus };
+
+struct metrics_exporter_options
+{
+	std::chrono::milliseconds interval{10000};
+	std::string path;				// empty for stdout
+	metrics_format format = metrics_format::prometheus;
+};
+
+//
+// Writes a snapshot every interval, and once more when destroyed.  A file
+// is replaced atomically (written beside it, then renamed), so readers
+// such as a node_exporter textfile collector never see half a snapshot.
+//
+class metrics_exporter : dumbnose::noncopyable
+{
+public:
+	explicit metrics_exporter(metrics_exporter_options const & options, metrics_registry& registry = metrics_registry::instance())
+		: options_(options), registry_(registry), thread_([this]{ run(); }) {}
+
+	~metrics_exporter()
+	{
+		{
+			std::lock_guard<std::mutex> lock(lock_);
+			stop_ = true;
+		}
+		stop_event_.notify_all();
+		thread_.join();
+		export_now();
+	}
+
+	void export_now()
+	{
+		std::ostringstream snapshot;
+		if(options_.format==metrics_format::prometheus) registry_.write_prometheus(snapshot);
+		else registry_.write_text(snapshot);
+
+		if(options_.path.empty()) {
+			std::cout << snapshot.str() << std::flush;
+			return;
+		}
+
+		std::string temporary = options_.path + ".tmp";
+		{
+			std::ofstream file(temporary, std::ios::binary | std::ios::trunc);
+			file << snapshot.str();
+			if(!file) return;
+		}
+		std::error_code error;
+		std::filesystem::rename(temporary, options_.path, error);
+	}
+
+private:
+	void run()
+	{
+		std::unique_lock<std::mutex> lock(lock_);
+		while(!stop_event_.wait_for(lock, options_.interval, [this]{ return stop_; })) {
+			lock.unlock();
+			export_now();
+			lock.lock();
+		}
+	}
+
+	const metrics_exporter_options options_;
+	metrics_registry& registry_;
+
+	std::mutex lock_;
+	std::condition_variable stop_event_;
+	bool stop_ = false;
+	std::thread thread_;
+};
+
+
+} // namespace dumbnose
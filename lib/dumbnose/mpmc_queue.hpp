@@ -0,0 +1,394 @@
+#pragma once
+
+//
+//	mpmc_queue
+//
+//	Bounded multi-producer/multi-consumer ring buffer, after Dmitry Vyukov's
+//	design.  Every cell carries a sequence number that tells producers and
+//	consumers whether the cell is theirs to use, so an operation costs one
+//	CAS on the shared head or tail index and nothing is allocated after
+//	construction.
+//
+//	try_push/try_pop never block.  push/pop spin for a short while and then
+//	sleep on a futex until the other side makes progress.  Producers and
+//	consumers only touch the futex words when somebody is actually asleep.
+//
+//	The _bulk variants claim a run of consecutive cells with a single CAS
+//	and wake at most as many sleepers as elements they moved.
+//
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <memory>
+#include <new>
+#include <optional>
+#include <type_traits>
+#include <utility>
+#include <dumbnose/noncopyable.hpp>
+#include <dumbnose/aux_/futex.hpp>
+#include <dumbnose/aux_/spin_wait.hpp>
+
+
+namespace dumbnose {
+
+
+template<class element_t>
+class mpmc_queue : dumbnose::noncopyable
+{
+	// Elements are built before a cell is claimed and then moved in, so a
+	// throwing constructor can never leave a claimed cell half-filled.
+	static_assert(std::is_nothrow_move_constructible<element_t>::value, "mpmc_queue elements must be nothrow move constructible");
+
+public:
+	typedef element_t value_type;
+	typedef std::size_t size_type;
+
+	// capacity is rounded up to the next power of two
+	explicit mpmc_queue(size_type capacity, unsigned int spin_count = aux::spin_wait::default_spin_count)
+		: mask_(round_up(capacity)-1), cells_(new cell_t[mask_+1]), spin_count_(spin_count)
+	{
+		for(size_type i=0 ; i<=mask_ ; ++i) {
+			cells_[i].sequence_.store(i, std::memory_order_relaxed);
+		}
+	}
+
+	~mpmc_queue()
+	{
+		// destroy anything still queued
+		while(dequeue()) {}
+	}
+
+	size_type capacity() const { return mask_+1; }
+
+	// Approximate number of queued elements; exact only when quiescent
+	size_type size() const
+	{
+		size_type tail = dequeue_pos_.load(std::memory_order_relaxed);
+		size_type head = enqueue_pos_.load(std::memory_order_relaxed);
+		return head>tail ? head-tail : 0;
+	}
+
+	bool empty() const { return size()==0; }
+
+	/* ---------------------------------------------------------------------------------*\
+		non-blocking operations
+	\* ---------------------------------------------------------------------------------*/
+
+	bool try_push(const element_t& value)
+	{
+		element_t copy(value);
+		return try_push(std::move(copy));
+	}
+
+	// value is only moved from if the push succeeds
+	bool try_push(element_t&& value)
+	{
+		if(!enqueue(value)) return false;
+
+		notify(pop_waiters_, pushes_);
+		return true;
+	}
+
+	bool try_pop(element_t& value)
+	{
+		std::optional<element_t> result = dequeue();
+		if(!result) return false;
+
+		notify(push_waiters_, pops_);
+		value = std::move(*result);
+		return true;
+	}
+
+	std::optional<element_t> try_pop()
+	{
+		std::optional<element_t> result = dequeue();
+		if(result) notify(push_waiters_, pops_);
+
+		return result;
+	}
+
+	//
+	// Move elements from [first, last) into the queue until it is full.
+	// Returns the iterator one past the last element queued.
+	//
+	template<class iter_t>
+	iter_t try_push_bulk(iter_t first, iter_t last)
+	{
+		size_type count = enqueue_bulk(first, last);
+		if(count>0) notify(pop_waiters_, pushes_, count);
+
+		return first;
+	}
+
+	//
+	// Move up to max_count elements out of the queue into out.  Returns
+	// the number of elements taken.
+	//
+	template<class out_iter_t>
+	size_type try_pop_bulk(out_iter_t out, size_type max_count)
+	{
+		size_type count = dequeue_bulk(out, max_count);
+		if(count>0) notify(push_waiters_, pops_, count);
+
+		return count;
+	}
+
+	/* ---------------------------------------------------------------------------------*\
+		blocking operations
+	\* ---------------------------------------------------------------------------------*/
+
+	void push(const element_t& value)
+	{
+		element_t copy(value);
+		push(std::move(copy));
+	}
+
+	// blocks while the queue is full
+	void push(element_t&& value)
+	{
+		wait_until(push_waiters_, pops_, [&]{ return enqueue(value); });
+		notify(pop_waiters_, pushes_);
+	}
+
+	// blocks while the queue is empty
+	element_t pop()
+	{
+		std::optional<element_t> result;
+		wait_until(pop_waiters_, pushes_, [&]{ result = dequeue(); return result.has_value(); });
+		notify(push_waiters_, pops_);
+
+		return std::move(*result);
+	}
+
+	// moves every element of [first, last) in, blocking while the queue is full
+	template<class iter_t>
+	void push_bulk(iter_t first, iter_t last)
+	{
+		while(first!=last) {
+			size_type count = 0;
+			wait_until(push_waiters_, pops_, [&]{ count = enqueue_bulk(first, last); return count>0; });
+			notify(pop_waiters_, pushes_, count);
+		}
+	}
+
+	// blocks while the queue is empty, then takes up to max_count elements
+	template<class out_iter_t>
+	size_type pop_bulk(out_iter_t out, size_type max_count)
+	{
+		if(max_count==0) return 0;
+
+		size_type count = 0;
+		wait_until(pop_waiters_, pushes_, [&]{ count = dequeue_bulk(out, max_count); return count>0; });
+		notify(push_waiters_, pops_, count);
+
+		return count;
+	}
+
+private:
+	struct cell_t
+	{
+		std::atomic<size_type> sequence_;
+		alignas(element_t) unsigned char storage_[sizeof(element_t)];
+
+		element_t* element() { return std::launder(reinterpret_cast<element_t*>(storage_)); }
+	};
+
+	static size_type round_up(size_type capacity)
+	{
+		size_type size = 2;
+		while(size<capacity) size <<= 1;
+
+		return size;
+	}
+
+	bool enqueue(element_t& value)
+	{
+		cell_t* cell;
+		size_type pos = enqueue_pos_.load(std::memory_order_relaxed);
+		for(;;) {
+			cell = &cells_[pos & mask_];
+			size_type seq = cell->sequence_.load(std::memory_order_acquire);
+			std::intptr_t diff = static_cast<std::intptr_t>(seq) - static_cast<std::intptr_t>(pos);
+
+			if(diff==0) {
+				if(enqueue_pos_.compare_exchange_weak(pos, pos+1, std::memory_order_relaxed)) break;
+			} else if(diff<0) {
+				return false;	// full
+			} else {
+				pos = enqueue_pos_.load(std::memory_order_relaxed);
+			}
+		}
+
+		::new (static_cast<void*>(cell->storage_)) element_t(std::move(value));
+		cell->sequence_.store(pos+1, std::memory_order_release);
+
+		return true;
+	}
+
+	std::optional<element_t> dequeue()
+	{
+		cell_t* cell;
+		size_type pos = dequeue_pos_.load(std::memory_order_relaxed);
+		for(;;) {
+			cell = &cells_[pos & mask_];
+			size_type seq = cell->sequence_.load(std::memory_order_acquire);
+			std::intptr_t diff = static_cast<std::intptr_t>(seq) - static_cast<std::intptr_t>(pos+1);
+
+			if(diff==0) {
+				if(dequeue_pos_.compare_exchange_weak(pos, pos+1, std::memory_order_relaxed)) break;
+			} else if(diff<0) {
+				return std::nullopt;	// empty
+			} else {
+				pos = dequeue_pos_.load(std::memory_order_relaxed);
+			}
+		}
+
+		element_t* element = cell->element();
+		std::optional<element_t> result(std::move(*element));
+		element->~element_t();
+		cell->sequence_.store(pos+mask_+1, std::memory_order_release);
+
+		return result;
+	}
+
+	//
+	// Claim as many consecutive free cells as there are elements (bounded
+	// by what is free) with one CAS, then fill them.  Advances first past
+	// the elements queued and returns their number.
+	//
+	template<class iter_t>
+	size_type enqueue_bulk(iter_t& first, iter_t last)
+	{
+		static_assert(std::is_nothrow_constructible<element_t, decltype(std::move(*first))>::value,
+					  "bulk elements are constructed in claimed cells and must not throw");
+
+		size_type wanted = static_cast<size_type>(std::distance(first, last));
+		if(wanted==0) return 0;
+		if(wanted>mask_+1) wanted = mask_+1;
+
+		size_type pos = enqueue_pos_.load(std::memory_order_relaxed);
+		size_type ready;
+		for(;;) {
+			std::intptr_t diff = static_cast<std::intptr_t>(cells_[pos & mask_].sequence_.load(std::memory_order_acquire)) - static_cast<std::intptr_t>(pos);
+			if(diff<0) return 0;	// full
+			if(diff>0) {
+				pos = enqueue_pos_.load(std::memory_order_relaxed);
+				continue;
+			}
+
+			ready = 1;
+			while(ready<wanted && cells_[(pos+ready) & mask_].sequence_.load(std::memory_order_acquire)==pos+ready) ++ready;
+
+			if(enqueue_pos_.compare_exchange_weak(pos, pos+ready, std::memory_order_relaxed)) break;
+		}
+
+		for(size_type i=0 ; i<ready ; ++i, ++first) {
+			cell_t& cell = cells_[(pos+i) & mask_];
+			::new (static_cast<void*>(cell.storage_)) element_t(std::move(*first));
+			cell.sequence_.store(pos+i+1, std::memory_order_release);
+		}
+
+		return ready;
+	}
+
+	template<class out_iter_t>
+	size_type dequeue_bulk(out_iter_t& out, size_type max_count)
+	{
+		if(max_count==0) return 0;
+
+		size_type pos = dequeue_pos_.load(std::memory_order_relaxed);
+		size_type ready;
+		for(;;) {
+			std::intptr_t diff = static_cast<std::intptr_t>(cells_[pos & mask_].sequence_.load(std::memory_order_acquire)) - static_cast<std::intptr_t>(pos+1);
+			if(diff<0) return 0;	// empty
+			if(diff>0) {
+				pos = dequeue_pos_.load(std::memory_order_relaxed);
+				continue;
+			}
+
+			ready = 1;
+			while(ready<max_count && ready<=mask_ && cells_[(pos+ready) & mask_].sequence_.load(std::memory_order_acquire)==pos+ready+1) ++ready;
+
+			if(dequeue_pos_.compare_exchange_weak(pos, pos+ready, std::memory_order_relaxed)) break;
+		}
+
+		size_type i = 0;
+		try {
+			while(i<ready) {
+				cell_t& cell = cells_[(pos+i) & mask_];
+				element_t* element = cell.element();
+				*out = std::move(*element);
+				element->~element_t();
+				cell.sequence_.store(pos+i+mask_+1, std::memory_order_release);
+				++i;
+				++out;
+			}
+		} catch(...) {
+			// the output iterator threw; drop the rest so the claimed cells are not lost
+			for( ; i<ready ; ++i) {
+				cell_t& cell = cells_[(pos+i) & mask_];
+				cell.element()->~element_t();
+				cell.sequence_.store(pos+i+mask_+1, std::memory_order_release);
+			}
+			throw;
+		}
+
+		return ready;
+	}
+
+	//
+	// Spin on attempt(), then register as a waiter and sleep on counter.  The
+	// waiter count is published before the final attempt so that a notifier
+	// either sees us or we see its element (see notify()).
+	//
+	template<class attempt_t>
+	void wait_until(aux::futex_word& waiters, aux::futex_word& counter, attempt_t attempt)
+	{
+		aux::spin_wait spinner(spin_count_);
+		while(!attempt()) {
+			if(spinner.spin()) continue;
+
+			waiters.fetch_add(1, std::memory_order_seq_cst);
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			std::uint32_t seen = counter.load(std::memory_order_seq_cst);
+
+			bool done = attempt();
+			if(!done) aux::futex_wait(counter, seen);
+
+			waiters.fetch_sub(1, std::memory_order_relaxed);
+			if(done) return;
+		}
+	}
+
+	void notify(aux::futex_word& waiters, aux::futex_word& counter, size_type count = 1)
+	{
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		std::uint32_t sleeping = waiters.load(std::memory_order_relaxed);
+		if(sleeping==0) return;
+
+		counter.fetch_add(1, std::memory_order_seq_cst);
+		if(count==1) {
+			aux::futex_wake_one(counter);
+		} else {
+			aux::futex_wake(counter, static_cast<unsigned int>(count<sleeping ? count : sleeping));
+		}
+	}
+
+	const size_type mask_;
+	std::unique_ptr<cell_t[]> cells_;
+	const unsigned int spin_count_;
+
+	alignas(aux::cache_line_size) std::atomic<size_type> enqueue_pos_{0};
+	alignas(aux::cache_line_size) std::atomic<size_type> dequeue_pos_{0};
+
+	// futex words bumped only while somebody sleeps on them
+	alignas(aux::cache_line_size) aux::futex_word pushes_{0};
+	aux::futex_word pop_waiters_{0};
+	alignas(aux::cache_line_size) aux::futex_word pops_{0};
+	aux::futex_word push_waiters_{0};
+};
+
+
+} // namespace dumbnose
@@ -1,15 +1,31 @@
 #pragma once
 
-#include <windows.h>
 #include <string>
-#include <dumbnose/waiter.hpp>
 #include <cassert>
+#include <chrono>
+#include <dumbnose/lock.hpp>
+
+#if defined(_WIN32)
+#include <windows.h>
+#include <dumbnose/waiter.hpp>
+#include <dumbnose/aux_/handle_wait.hpp>
+#else
+#include <memory>
+#include <system_error>
+#include <dumbnose/aux_/futex_sync.hpp>
+#if defined(__linux__)
+#include <dumbnose/aux_/robust_mutex.hpp>
+#include <dumbnose/aux_/shared_object.hpp>
+#endif
+#endif
 
 
 namespace dumbnose
 {
 
 
+#if defined(_WIN32)
+
 class mutex
 {
 	friend class waiter;
@@ -27,6 +43,11 @@ public:
 			throw GetLastError();
 	}
 
+	// Win32 names go away with their last handle; see the POSIX version
+	static bool remove(std::wstring const &) {
+		return true;
+	}
+
 	~mutex(){
 		assert(NULL!=mutex_);
 		CloseHandle(mutex_);
@@ -36,10 +57,28 @@ public:
 		assert(NULL!=mutex_);
 
 		DWORD result = WaitForSingleObject(mutex_,wait_time);
-		if((WAIT_OBJECT_0!=result) && (WAIT_ABANDONED!=result)) 
+		if((WAIT_OBJECT_0!=result) && (WAIT_ABANDONED!=result))
 			throw GetLastError();
 	}
 
+	bool try_acquire() const {
+		assert(NULL!=mutex_);
+
+		return acquired(WaitForSingleObject(mutex_,0));
+	}
+
+	template<class rep_t, class period_t>
+	bool try_acquire_for(std::chrono::duration<rep_t,period_t> const & timeout) const {
+		return try_acquire_until(std::chrono::steady_clock::now()+timeout);
+	}
+
+	template<class clock_t, class duration_t>
+	bool try_acquire_until(std::chrono::time_point<clock_t,duration_t> const & deadline) const {
+		assert(NULL!=mutex_);
+
+		return acquired(aux::wait_for_handle_until(mutex_,aux::steady_deadline(deadline)));
+	}
+
 	void release() const {
 		assert(NULL!=mutex_);
 
@@ -51,8 +90,111 @@ private:
 		return mutex_;
 	}
 
+	static bool acquired(DWORD result) {
+		if((WAIT_OBJECT_0==result) || (WAIT_ABANDONED==result))
+			return true;
+		if(WAIT_TIMEOUT==result)
+			return false;
+		throw GetLastError();
+	}
+
 	mutable HANDLE mutex_;
 };
 
+#else
+
+//
+// Recursive, like a Win32 mutex.  The unnamed mutex is process-local and
+// its fast path is a single atomic exchange instead of a kernel call.  On
+// Linux a named mutex is a robust pthread mutex in POSIX shared memory,
+// shared by every process that opens the name; when its owner dies the
+// next acquire succeeds and abandoned() reports it, like WAIT_ABANDONED.
+// Unlike a Win32 name, it persists after its last user closes it, until
+// remove() deletes it.
+//
+class mutex
+{
+	friend class waiter;
+
+public:
+	mutex() {}
+
+#if defined(__linux__)
+	explicit mutex(std::wstring name) : shared_(new aux::shared_object<aux::robust_mutex>(name)) {}
+
+	// Delete a named mutex; processes that have it open keep using it
+	static bool remove(std::wstring const & name) {
+		return aux::shared_object<aux::robust_mutex>::remove(name);
+	}
+#endif
+
+	void acquire(unsigned int wait_time=infinite_wait) const {
+		if(!acquire_until(aux::deadline_after_ms(wait_time)))
+			throw std::system_error(std::make_error_code(std::errc::timed_out), "Timed out acquiring mutex");
+	}
+
+	bool try_acquire() const {
+#if defined(__linux__)
+		if(shared_) return acquired(shared_->get().try_lock());
+#endif
+		return lock_.try_lock();
+	}
+
+	template<class rep_t, class period_t>
+	bool try_acquire_for(std::chrono::duration<rep_t,period_t> const & timeout) const {
+		return try_acquire_until(std::chrono::steady_clock::now()+timeout);
+	}
+
+	template<class clock_t, class duration_t>
+	bool try_acquire_until(std::chrono::time_point<clock_t,duration_t> const & deadline) const {
+		return acquire_until(aux::futex_deadline(aux::steady_deadline(deadline)));
+	}
+
+	void release() const {
+#if defined(__linux__)
+		if(shared_) {
+			shared_->get().unlock();
+			return;
+		}
+#endif
+		lock_.unlock();
+	}
+
+	// True if the holder got the mutex from an owner that died holding it
+	bool abandoned() const {
+		return abandoned_;
+	}
+
+private:
+	bool acquire_until(aux::futex_deadline const & deadline) const {
+#if defined(__linux__)
+		if(shared_) return acquired(shared_->get().lock(deadline));
+#endif
+		return lock_.lock(deadline);
+	}
+
+#if defined(__linux__)
+	bool acquired(aux::lock_result result) const {
+		if(aux::lock_result::timed_out==result)
+			return false;
+		abandoned_ = aux::lock_result::abandoned==result;
+		return true;
+	}
+#endif
+
+	// waiter protocol; a mutex can be signaled but not waited on
+	void signal() {
+		release();
+	}
+
+	mutable aux::recursive_futex_lock lock_;
+	mutable bool abandoned_ = false;
+#if defined(__linux__)
+	std::unique_ptr<aux::shared_object<aux::robust_mutex> > shared_;
+#endif
+};
+
+#endif
+
 
 } // namespace dumbnose
\ No newline at end of file
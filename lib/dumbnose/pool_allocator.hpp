@@ -0,0 +1,308 @@
+#pragma once
+
+//
+//	pool_allocator
+//
+//	Stateless STL allocator for node-based containers (std::list, std::map
+//	and so safe_list and safe_map) that would otherwise go to the global
+//	heap on every insert:
+//
+//		dumbnose::safe_list<job, dumbnose::pool_allocator<job>> pending;
+//		dumbnose::safe_map<int, std::string, std::less<int>,
+//			dumbnose::pool_allocator<std::pair<const int, std::string>>> names;
+//
+//	Requests of up to pool_max_size bytes are rounded up to a size class,
+//	a multiple of 16 bytes.  Each thread keeps a free list per size class
+//	and allocates and frees from it without locking or atomics.  When a
+//	thread's list runs dry it takes a batch of blocks from the central
+//	pool, and when it grows past two batches it hands one back, so one lock
+//	round trip covers dozens of operations and memory freed by a consumer
+//	thread flows back to producers.  The central pool carves new blocks out
+//	of 64KB slabs of a single size class, so nodes never fragment the
+//	general heap.  Slabs are kept for the life of the process.
+//
+//	Larger or over-aligned requests, such as a vector's array, go to
+//	std::allocator.
+//
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include <dumbnose/noncopyable.hpp>
+#include <dumbnose/aux_/spin_wait.hpp>
+
+
+namespace dumbnose {
+
+namespace aux {
+
+
+const std::size_t pool_granule = 16;
+const std::size_t pool_max_size = 256;
+const std::size_t pool_class_count = pool_max_size/pool_granule;
+const std::size_t pool_slab_size = 64*1024;
+
+inline std::size_t pool_class_of(std::size_t bytes)
+{
+	return bytes<=pool_granule ? 0 : (bytes-1)/pool_granule;
+}
+
+inline std::size_t pool_block_size(std::size_t size_class)
+{
+	return (size_class+1)*pool_granule;
+}
+
+// Blocks moved between a thread and the central pool at a time: about 4KB, 16 to 64 blocks
+inline std::size_t pool_batch_size(std::size_t size_class)
+{
+	return std::clamp<std::size_t>(4096/pool_block_size(size_class), 16, 64);
+}
+
+
+struct pool_block
+{
+	pool_block* next_;
+};
+
+
+// Batches of free blocks shared by every thread, one lock per size class
+class pool_central : dumbnose::noncopyable
+{
+public:
+	static pool_central& instance()
+	{
+		// never destroyed: threads hand their blocks back as late as process exit
+		static pool_central* central = new pool_central;
+		return *central;
+	}
+
+	// A list of count blocks linked through next_
+	pool_block* take_batch(std::size_t size_class, std::size_t& count)
+	{
+		size_class_t& pool = classes_[size_class];
+		std::lock_guard<std::mutex> lock(pool.lock_);
+
+		if(!pool.batches_.empty()) {
+			std::pair<pool_block*, std::size_t> batch = pool.batches_.back();
+			pool.batches_.pop_back();
+			count = batch.second;
+			return batch.first;
+		}
+
+		std::size_t block_size = pool_block_size(size_class);
+		if(static_cast<std::size_t>(pool.slab_end_-pool.slab_)<block_size) {
+			pool.slab_ = static_cast<char*>(::operator new(pool_slab_size));
+			pool.slab_end_ = pool.slab_+pool_slab_size;
+			reserved_.fetch_add(pool_slab_size, std::memory_order_relaxed);
+		}
+
+		count = std::min(pool_batch_size(size_class), static_cast<std::size_t>(pool.slab_end_-pool.slab_)/block_size);
+		pool_block* head = nullptr;
+		for(std::size_t i=0 ; i<count ; ++i) {
+			pool.slab_end_ -= block_size;
+			pool_block* block = reinterpret_cast<pool_block*>(pool.slab_end_);
+			block->next_ = head;
+			head = block;
+		}
+		return head;
+	}
+
+	void give_batch(std::size_t size_class, pool_block* head, std::size_t count)
+	{
+		size_class_t& pool = classes_[size_class];
+		std::lock_guard<std::mutex> lock(pool.lock_);
+		pool.batches_.emplace_back(head, count);
+	}
+
+	// Bytes taken from the heap for slabs
+	std::size_t reserved_bytes() const { return reserved_.load(std::memory_order_relaxed); }
+
+private:
+	pool_central() {}
+
+	struct alignas(cache_line_size) size_class_t
+	{
+		std::mutex lock_;
+		std::vector<std::pair<pool_block*, std::size_t>> batches_;
+		char* slab_ = nullptr;			// blocks are carved off the end
+		char* slab_end_ = nullptr;
+	};
+
+	size_class_t classes_[pool_class_count];
+	std::atomic<std::size_t> reserved_{0};
+};
+
+
+//
+// Trivial, so thread_local access needs no initialization check; the
+// pool_thread_exit registered on the first refill or the first
+// deallocate, whichever comes first, flushes it.  Once the
+// thread has flushed, counts_ are pinned at their limit and heads_ are
+// empty so any later call takes the slow path, which then goes straight
+// to the central pool.
+//
+struct pool_thread_cache
+{
+	pool_block* heads_[pool_class_count];
+	std::size_t counts_[pool_class_count];
+	bool registered_;
+	bool exited_;
+};
+
+inline pool_thread_cache& pool_cache()
+{
+	static thread_local pool_thread_cache cache{};
+	return cache;
+}
+
+class pool_thread_exit
+{
+public:
+	void touch() {}
+
+	~pool_thread_exit()
+	{
+		pool_thread_cache& cache = pool_cache();
+		for(std::size_t size_class=0 ; size_class<pool_class_count ; ++size_class) {
+			if(cache.heads_[size_class]) pool_central::instance().give_batch(size_class, cache.heads_[size_class], cache.counts_[size_class]);
+			cache.heads_[size_class] = nullptr;
+			cache.counts_[size_class] = static_cast<std::size_t>(-1);
+		}
+		cache.exited_ = true;
+	}
+};
+
+inline void pool_register(pool_thread_cache& cache)
+{
+	static thread_local pool_thread_exit on_exit;
+	on_exit.touch();
+	cache.registered_ = true;
+}
+
+inline void* pool_refill(pool_thread_cache& cache, std::size_t size_class)
+{
+	if(!cache.registered_) pool_register(cache);
+
+	std::size_t count;
+	pool_block* block = pool_central::instance().take_batch(size_class, count);
+	if(cache.exited_) {
+		if(count>1) pool_central::instance().give_batch(size_class, block->next_, count-1);
+	} else {
+		cache.heads_[size_class] = block->next_;
+		cache.counts_[size_class] = count-1;
+	}
+	return block;
+}
+
+inline void pool_drain(pool_thread_cache& cache, std::size_t size_class, pool_block* block)
+{
+	if(cache.exited_) {
+		block->next_ = nullptr;
+		pool_central::instance().give_batch(size_class, block, 1);
+		return;
+	}
+
+	// keep one batch, hand the rest back
+	std::size_t batch = pool_batch_size(size_class);
+	block->next_ = cache.heads_[size_class];
+	pool_block* last = block;
+	for(std::size_t i=1 ; i<batch ; ++i) last = last->next_;
+	cache.heads_[size_class] = last->next_;
+	cache.counts_[size_class] -= batch-1;
+	last->next_ = nullptr;
+	pool_central::instance().give_batch(size_class, block, batch);
+}
+
+inline void* pool_allocate(std::size_t bytes)
+{
+	std::size_t size_class = pool_class_of(bytes);
+	pool_thread_cache& cache = pool_cache();
+	pool_block* block = cache.heads_[size_class];
+	if(!block) return pool_refill(cache, size_class);
+
+	cache.heads_[size_class] = block->next_;
+	--cache.counts_[size_class];
+	return block;
+}
+
+inline void pool_deallocate(void* memory, std::size_t bytes) noexcept
+{
+	std::size_t size_class = pool_class_of(bytes);
+	pool_thread_cache& cache = pool_cache();
+	pool_block* block = static_cast<pool_block*>(memory);
+	// a thread that only frees, such as a consumer, must still hand its blocks back when it exits
+	if(!cache.registered_) pool_register(cache);
+	if(cache.counts_[size_class]>=2*pool_batch_size(size_class)) return pool_drain(cache, size_class, block);
+
+	block->next_ = cache.heads_[size_class];
+	cache.heads_[size_class] = block;
+	++cache.counts_[size_class];
+}
+
+
+} // namespace aux
+
+
+template<class type_t>
+class pool_allocator
+{
+public:
+	typedef type_t value_type;
+	typedef std::size_t size_type;
+	typedef std::ptrdiff_t difference_type;
+
+	typedef std::true_type propagate_on_container_move_assignment;
+	typedef std::true_type is_always_equal;
+
+	template<class other_t>
+	struct rebind
+	{
+		typedef pool_allocator<other_t> other;
+	};
+
+	pool_allocator() noexcept {}
+
+	template<class other_t>
+	pool_allocator(pool_allocator<other_t> const &) noexcept {}
+
+	type_t* allocate(size_type count)
+	{
+		if(!pooled(count)) return std::allocator<type_t>().allocate(count);
+		return static_cast<type_t*>(aux::pool_allocate(count*sizeof(type_t)));
+	}
+
+	void deallocate(type_t* memory, size_type count) noexcept
+	{
+		if(!pooled(count)) return std::allocator<type_t>().deallocate(memory, count);
+		aux::pool_deallocate(memory, count*sizeof(type_t));
+	}
+
+	template<class other_t>
+	bool operator==(pool_allocator<other_t> const &) const noexcept { return true; }
+
+	template<class other_t>
+	bool operator!=(pool_allocator<other_t> const &) const noexcept { return false; }
+
+private:
+	static bool pooled(size_type count)
+	{
+		return alignof(type_t)<=aux::pool_granule && count<=aux::pool_max_size/sizeof(type_t);
+	}
+};
+
+
+// Bytes the pool has taken from the heap, in use or cached
+inline std::size_t pool_reserved_bytes()
+{
+	return aux::pool_central::instance().reserved_bytes();
+}
+
+
+} // namespace dumbnose
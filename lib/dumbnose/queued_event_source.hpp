@@ -0,0 +1,198 @@
+#pragma once
+
+//
+//	queued_event_source
+//
+//	An event_source whose raise() only queues the event; a dispatcher thread
+//	owned by the source calls the listeners.  Slow listeners (UI, log sinks)
+//	then delay delivery instead of the code raising the event.
+//
+//	Events go through a bounded mpmc_queue, so raising allocates nothing
+//	beyond copying the arguments.  When the queue is full raise() either
+//	blocks until the dispatcher catches up (queue_overflow::block) or throws
+//	away the oldest queued event (queue_overflow::drop_oldest).
+//
+//	With coalesce set, whenever the dispatcher finds several events with
+//	the same key waiting it only delivers the newest of them, which suits
+//	"latest value wins" updates such as progress or status text.  The key
+//	comes from a function passed to the constructor, e.g. the sender so
+//	each object's latest progress survives; without one, only events with
+//	equal sender and arguments are merged.  Kept events are delivered in
+//	the order they were queued.
+//
+//	A listener may raise() on its own source.  Under queue_overflow::block,
+//	if the queue is full, the event is delivered inline, ahead of whatever
+//	is queued, since the dispatcher cannot wait for itself.
+//
+//	Arguments are copied into the queue (references are decayed); a sender
+//	passed by reference is kept by reference and must outlive the source.
+//	Destroying the source delivers whatever is still queued first,
+//	including events its listeners raise while that happens.
+//
+
+#include <cstddef>
+#include <cstdint>
+#include <atomic>
+#include <concepts>
+#include <functional>
+#include <iterator>
+#include <optional>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include <dumbnose/noncopyable.hpp>
+#include <dumbnose/event_source.hpp>
+#include <dumbnose/mpmc_queue.hpp>
+
+
+namespace dumbnose {
+
+
+enum class queue_overflow
+{
+	block,			// raise() waits for room
+	drop_oldest		// raise() discards the oldest queued event
+};
+
+struct queued_dispatch_options
+{
+	std::size_t capacity = 1024;
+	queue_overflow overflow = queue_overflow::block;
+	bool coalesce = false;
+};
+
+
+template<class sender_t, class event_args_t>
+class queued_event_source : dumbnose::noncopyable
+{
+public:
+	using source_t = event_source<sender_t, event_args_t>;
+	using event_handler_t = typename source_t::event_handler_t;
+	using cookie_t = typename source_t::cookie_t;
+	using coalesce_key_t = std::function<std::size_t(sender_t, event_args_t)>;
+
+	explicit queued_event_source(queued_dispatch_options const & options = queued_dispatch_options(), coalesce_key_t coalesce_key = nullptr)
+		: options_(options), coalesce_key_(std::move(coalesce_key)), queue_(options.capacity)
+	{
+		batch_.reserve(max_batch);
+		dispatcher_ = std::thread([this]{ dispatch(); });
+	}
+
+	~queued_event_source()
+	{
+		// a full queue needs no wake-up: the dispatcher is not waiting on it
+		stopping_.store(true, std::memory_order_release);
+		queue_.try_push(queued_t());
+		dispatcher_.join();
+	}
+
+	cookie_t register_listener(event_handler_t listener)
+	{
+		return source_.register_listener(std::move(listener));
+	}
+
+	void raise(sender_t sender, event_args_t args)
+	{
+		queued_t event(std::in_place, sender_storage_t(sender), args_storage_t(args));
+
+		if(options_.overflow==queue_overflow::block) {
+			if(std::this_thread::get_id()!=dispatcher_.get_id()) queue_.push(std::move(event));
+			else if(!queue_.try_push(std::move(event))) deliver(*event);
+			return;
+		}
+
+		while(!queue_.try_push(std::move(event))) {
+			std::optional<queued_t> oldest = queue_.try_pop();
+			if(oldest && *oldest) dropped_.fetch_add(1, std::memory_order_relaxed);
+		}
+	}
+
+	// Block until the dispatcher next delivers an event
+	void wait()
+	{
+		source_.wait();
+	}
+
+	// Events thrown away by drop_oldest so far
+	std::uint64_t dropped() const { return dropped_.load(std::memory_order_relaxed); }
+
+	// Events skipped because a newer one with the same key was already queued
+	std::uint64_t coalesced() const { return coalesced_.load(std::memory_order_relaxed); }
+
+private:
+	static const std::size_t max_batch = 64;
+
+	using sender_storage_t = std::conditional_t<std::is_reference_v<sender_t>,
+		std::reference_wrapper<std::remove_reference_t<sender_t>>, std::decay_t<sender_t>>;
+	using args_storage_t = std::decay_t<event_args_t>;
+
+	// an empty element only wakes the dispatcher to look at stopping_; dropping it is harmless
+	using event_t = std::pair<sender_storage_t, args_storage_t>;
+	using queued_t = std::optional<event_t>;
+
+	void dispatch()
+	{
+		for(;;) {
+			batch_.clear();
+			if(!stopping_.load(std::memory_order_acquire)) {
+				queue_.pop_bulk(std::back_inserter(batch_), max_batch);
+			} else if(queue_.try_pop_bulk(std::back_inserter(batch_), max_batch)==0) {
+				return;
+			}
+
+			std::size_t count = batch_.size();
+			for(std::size_t i=0 ; i<count ; ++i) {
+				if(!batch_[i]) continue;
+				if(options_.coalesce && superseded(i, count)) coalesced_.fetch_add(1, std::memory_order_relaxed);
+				else deliver(*batch_[i]);
+			}
+		}
+	}
+
+	// Whether a later event in the batch has the same key; batches are small enough to scan
+	bool superseded(std::size_t index, std::size_t count)
+	{
+		for(std::size_t later=index+1 ; later<count ; ++later) {
+			if(batch_[later] && same_key(*batch_[index], *batch_[later])) return true;
+		}
+		return false;
+	}
+
+	bool same_key(event_t& left, event_t& right)
+	{
+		if(coalesce_key_) return coalesce_key_(left.first, left.second)==coalesce_key_(right.first, right.second);
+		return equal_sender(left.first, right.first) && equal_args(left.second, right.second);
+	}
+
+	static bool equal_sender(sender_storage_t const & left, sender_storage_t const & right)
+	{
+		if constexpr(std::is_reference_v<sender_t>) return &left.get()==&right.get();
+		else if constexpr(std::equality_comparable<sender_storage_t>) return left==right;
+		else return false;
+	}
+
+	static bool equal_args(args_storage_t const & left, args_storage_t const & right)
+	{
+		if constexpr(std::equality_comparable<args_storage_t>) return left==right;
+		else return false;
+	}
+
+	void deliver(event_t& event)
+	{
+		source_.raise(event.first, event.second);
+	}
+
+	const queued_dispatch_options options_;
+	const coalesce_key_t coalesce_key_;
+	source_t source_;
+	mpmc_queue<queued_t> queue_;
+	std::vector<queued_t> batch_;
+	std::atomic<std::uint64_t> dropped_{0};
+	std::atomic<std::uint64_t> coalesced_{0};
+	std::atomic<bool> stopping_{false};
+	std::thread dispatcher_;
+};
+
+
+} // namespace dumbnose
@@ -0,0 +1,135 @@
+#pragma once
+
+//
+//	rw_lock
+//
+//	Reader-writer lock for read-mostly data (a "big reader" lock).  Every
+//	CPU has its own reader count on its own cache line, so readers on
+//	different CPUs never write to the same memory and shared acquisitions
+//	scale with the number of cores.  Writers pay for that: they have to
+//	visit every CPU's count.
+//
+//	Writers take precedence.  Once a writer is waiting, new readers step
+//	aside until it is done, so a steady stream of readers cannot starve it.
+//	Neither mode is recursive.
+//
+//	acquire()/release() take the lock exclusively, so rw_lock works with
+//	lock_holder and HOLD_LOCK as well as with shared_lock_holder:
+//
+//		typedef safe_map<int, std::string, std::less<int>,
+//						 std::allocator<std::pair<const int, std::string> >,
+//						 std::map<int, std::string>, rw_lock,
+//						 shared_lock_holder<rw_lock>, exclusive_lock_holder<rw_lock> > table_t;
+//
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <dumbnose/noncopyable.hpp>
+#include <dumbnose/lock.hpp>
+#include <dumbnose/thread_affinity.hpp>
+#include <dumbnose/aux_/futex.hpp>
+#include <dumbnose/aux_/futex_sync.hpp>
+#include <dumbnose/aux_/spin_wait.hpp>
+
+
+namespace dumbnose {
+
+
+class rw_lock : dumbnose::noncopyable
+{
+public:
+	// Identifies the reader count a shared acquisition went to
+	typedef std::size_t shared_token;
+
+	rw_lock() : slot_mask_(cpu_shard_count()-1), slots_(new slot_t[slot_mask_+1]) {}
+
+	shared_token acquire_shared() const
+	{
+		// the thread may migrate while it holds the lock, so remember the slot
+		shared_token slot = current_cpu() & slot_mask_;
+		aux::futex_word& readers = slots_[slot].readers_;
+
+		for(;;) {
+			readers.fetch_add(1, std::memory_order_seq_cst);
+			if(writer_.load(std::memory_order_seq_cst)==0) return slot;
+
+			leave(readers);
+			wait_for_writer();
+		}
+	}
+
+	void release_shared(shared_token slot) const
+	{
+		leave(slots_[slot].readers_);
+	}
+
+	void acquire() const
+	{
+		writers_.lock();
+		writer_.store(writer_pending, std::memory_order_seq_cst);
+
+		for(std::size_t slot=0 ; slot<=slot_mask_ ; ++slot) {
+			aux::futex_word& readers = slots_[slot].readers_;
+
+			// seq_cst against the store of writer_pending, the other half of the
+			// readers' fetch_add then load of writer_
+			aux::spin_wait spinner;
+			for(std::uint32_t count ; (count=readers.load(std::memory_order_seq_cst))!=0 ; ) {
+				if(!spinner.spin()) aux::futex_wait(readers, count);
+			}
+		}
+	}
+
+	void release() const
+	{
+		if(writer_.exchange(0, std::memory_order_release) & readers_waiting) aux::futex_wake_all(writer_);
+		writers_.unlock();
+	}
+
+private:
+	enum : std::uint32_t { writer_pending = 1, readers_waiting = 2 };
+
+	struct alignas(aux::cache_line_size) slot_t
+	{
+		aux::futex_word readers_{0};
+	};
+
+	void leave(aux::futex_word& readers) const
+	{
+		// the last reader out of a slot lets a waiting writer move on
+		if(readers.fetch_sub(1, std::memory_order_seq_cst)==1 && writer_.load(std::memory_order_seq_cst)!=0) {
+			aux::futex_wake_one(readers);
+		}
+	}
+
+	void wait_for_writer() const
+	{
+		aux::spin_wait spinner;
+		std::uint32_t state = writer_.load(std::memory_order_acquire);
+		while(state!=0) {
+			if(spinner.spin()) {
+				state = writer_.load(std::memory_order_acquire);
+				continue;
+			}
+
+			// tell the writer somebody sleeps, so its release has to wake us
+			if(!(state & readers_waiting)) {
+				if(!writer_.compare_exchange_weak(state, state | readers_waiting, std::memory_order_acquire)) continue;
+				state |= readers_waiting;
+			}
+
+			aux::futex_wait(writer_, state);
+			state = writer_.load(std::memory_order_acquire);
+		}
+	}
+
+	const std::size_t slot_mask_;
+	std::unique_ptr<slot_t[]> slots_;
+
+	alignas(aux::cache_line_size) mutable aux::futex_word writer_{0};
+	mutable aux::futex_lock writers_;
+};
+
+
+} // namespace dumbnose
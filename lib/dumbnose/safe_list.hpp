@@ -20,7 +20,7 @@ public:
 	typedef list_t						list_type;
 	typedef element_t					element_type;
 
-	typedef typename list_t::_Alloc		_Alloc;				
+	typedef typename list_t::allocator_type	_Alloc;
 	typedef element_type				_Ty;
 	typedef list_type					_Myt;
 
@@ -273,7 +273,7 @@ public:
 	void assign(size_type _Count, const _Ty& _Val)
 		{	// assign _Count * _Val
 		write_lock_holder_t holder(*this);
-		impl_.assign(_First, _Last, _Val);
+		impl_.assign(_Count, _Val);
 		}
 
 	iterator insert(iterator _Where, const _Ty& _Val)
@@ -285,7 +285,7 @@ public:
 	void insert(iterator _Where, size_type _Count, const _Ty& _Val)
 		{	// insert _Count * _Val at _Where
 		write_lock_holder_t holder(*this);
-		impl.insert(_Where, _Count, _Val);
+		impl_.insert(_Where, _Count, _Val);
 		}
 
 	template<class _Iter>
@@ -348,7 +348,7 @@ public:
 		void remove_if(_Pr1 _Pred)
 		{	// erase each element satisfying _Pr1
 		write_lock_holder_t holder(*this);
-		impl_.remove(_Val);
+		impl_.remove_if(_Pred);
 		}
 
 	void unique()
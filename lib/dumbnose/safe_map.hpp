@@ -18,11 +18,13 @@
 #include <map>
 #include <dumbnose/critical_section.hpp>
 #include <dumbnose/lock.hpp>
+#include <dumbnose/metrics.hpp>
+#include <string>
 
 namespace dumbnose {
 
 
-template<typename key_t, typename value_t, typename cmp_t=std::less<key_t>,typename alloc_t=std::allocator<std::pair<key_t,value_t> >,
+template<typename key_t, typename value_t, typename cmp_t=std::less<key_t>,typename alloc_t=std::allocator<std::pair<const key_t,value_t> >,
 		 typename map_t=std::map<key_t,value_t,cmp_t,alloc_t>, typename lock_t=critical_section, 
 		 typename read_lock_holder_t=lock_holder<lock_t>, typename write_lock_holder_t=read_lock_holder_t >
 class safe_map : public lock_t
@@ -46,7 +48,6 @@ public:
 	typedef typename map_t::const_iterator		const_iterator;
 	typedef typename map_t::reverse_iterator	reverse_iterator;
 	typedef typename map_t::const_reverse_iterator	const_reverse_iterator;
-	typedef typename map_t::value_type			value_type;
 
 	key_compare key_comp()		{ return impl_.key_compare(); }
 	value_compare value_comp()	{ return impl_.value_compare(); }
@@ -315,8 +316,18 @@ public:
 		impl_.clear();
 	}
 
+	/* ---------------------------------------------------------------------------------*\
+		metrics
+	\* ---------------------------------------------------------------------------------*/
+
+	// Publish name_size, read under the lock at each snapshot; withdrawn with the map (copies don't publish)
+	void publish_metrics(const std::string& name, metrics_registry& registry = metrics_registry::instance()) {
+		size_publication_ = registry.publish(metric_type::gauge, name + "_size", "Entries in the map", [this]{ return static_cast<double>(size()); });
+	}
+
 private:
 	map_t impl_;
+	metrics_publication size_publication_;
 };
 
 template<typename key_t,typename value_t,typename cmp_t,typename alloc_t,typename map_t,
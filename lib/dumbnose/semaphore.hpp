@@ -1,13 +1,33 @@
-#include <windows.h>
+#pragma once
+
 #include <string>
-#include <dumbnose/waiter.hpp>
 #include <cassert>
+#include <chrono>
+#include <dumbnose/lock.hpp>
+
+#if defined(_WIN32)
+#include <windows.h>
+#include <dumbnose/waiter.hpp>
+#include <dumbnose/aux_/handle_wait.hpp>
+#else
+#include <cstdint>
+#include <system_error>
+#include <memory>
+#include <stdexcept>
+#include <dumbnose/aux_/futex_sync.hpp>
+#if defined(__linux__)
+#include <dumbnose/aux_/readiness_fd.hpp>
+#include <dumbnose/aux_/shared_object.hpp>
+#endif
+#endif
 
 
 namespace dumbnose
 {
 
 
+#if defined(_WIN32)
+
 class semaphore
 {
 	friend class waiter;
@@ -25,6 +45,11 @@ public:
 			throw GetLastError();
 	}
 
+	// Win32 names go away with their last handle; see the POSIX version
+	static bool remove(std::wstring const &) {
+		return true;
+	}
+
 	~semaphore(){
 		assert(NULL!=semaphore_);
 		CloseHandle(semaphore_);
@@ -34,10 +59,28 @@ public:
 		assert(NULL!=semaphore_);
 
 		DWORD result = WaitForSingleObject(semaphore_,wait_time);
-		if(WAIT_OBJECT_0!=result) 
+		if(WAIT_OBJECT_0!=result)
 			throw GetLastError();
 	}
 
+	bool try_acquire() const {
+		assert(NULL!=semaphore_);
+
+		return acquired(WaitForSingleObject(semaphore_,0));
+	}
+
+	template<class rep_t, class period_t>
+	bool try_acquire_for(std::chrono::duration<rep_t,period_t> const & timeout) const {
+		return try_acquire_until(std::chrono::steady_clock::now()+timeout);
+	}
+
+	template<class clock_t, class duration_t>
+	bool try_acquire_until(std::chrono::time_point<clock_t,duration_t> const & deadline) const {
+		assert(NULL!=semaphore_);
+
+		return acquired(aux::wait_for_handle_until(semaphore_,aux::steady_deadline(deadline)));
+	}
+
 	void release() const {
 		assert(NULL!=semaphore_);
 
@@ -49,8 +92,126 @@ private:
 		return semaphore_;
 	}
 
+	static bool acquired(DWORD result) {
+		if(WAIT_OBJECT_0==result)
+			return true;
+		if(WAIT_TIMEOUT==result)
+			return false;
+		throw GetLastError();
+	}
+
 	mutable HANDLE semaphore_;
 };
 
+#else
+
+//
+// Counting semaphore.  acquire() only sleeps when the count is zero, and
+// release() only wakes when somebody is asleep.  On Linux a named semaphore
+// lives in POSIX shared memory and works across processes; it cannot be
+// used with waiter, whose descriptors only see changes made locally.  The
+// name and its count persist after the last user closes it, and after a
+// crash, until remove() deletes it; the next opener then starts afresh
+// with initial_count.
+//
+class semaphore
+{
+	friend class waiter;
+
+public:
+#if defined(__linux__)
+	semaphore(unsigned long initial_count, unsigned long max_count, std::wstring name)
+		: local_(0, 1),
+		  shared_(new aux::shared_object<aux::futex_semaphore>(name, static_cast<std::uint32_t>(initial_count), static_cast<std::uint32_t>(max_count), true)),
+		  semaphore_(&shared_->get()) {
+		assert(initial_count<=max_count);
+	}
+
+	// Delete a named semaphore; processes that have it open keep using it
+	static bool remove(std::wstring const & name) {
+		return aux::shared_object<aux::futex_semaphore>::remove(name);
+	}
+#endif
+
+	explicit semaphore(unsigned long initial_count, unsigned long max_count)
+		: local_(static_cast<std::uint32_t>(initial_count), static_cast<std::uint32_t>(max_count)), semaphore_(&local_) {
+		assert(initial_count<=max_count);
+	}
+
+	void acquire(unsigned int wait_time=infinite_wait) const {
+		if(!acquire_until(aux::deadline_after_ms(wait_time)))
+			throw std::system_error(std::make_error_code(std::errc::timed_out), "Timed out acquiring semaphore");
+	}
+
+	bool try_acquire() const {
+		bool taken = semaphore_->try_acquire();
+		sync();
+		return taken;
+	}
+
+	template<class rep_t, class period_t>
+	bool try_acquire_for(std::chrono::duration<rep_t,period_t> const & timeout) const {
+		return try_acquire_until(std::chrono::steady_clock::now()+timeout);
+	}
+
+	template<class clock_t, class duration_t>
+	bool try_acquire_until(std::chrono::time_point<clock_t,duration_t> const & deadline) const {
+		return acquire_until(aux::futex_deadline(aux::steady_deadline(deadline)));
+	}
+
+	// Like ReleaseSemaphore, releasing past max_count is ignored
+	void release() const {
+		semaphore_->release();
+		sync();
+	}
+
+private:
+	bool acquire_until(aux::futex_deadline const & deadline) const {
+		bool taken = semaphore_->acquire(deadline);
+		sync();
+		return taken;
+	}
+
+	// waiter protocol
+	bool try_take() const {
+		return try_acquire();
+	}
+
+	void signal() {
+		release();
+	}
+
+	int wait_ticket() const {
+		return 0;
+	}
+
+	void wait_from(int) const {
+		acquire();
+	}
+
+#if defined(__linux__)
+	int wait_fd() const {
+		if(shared_) throw std::logic_error("Named semaphores cannot be waited on with waiter");
+		return fd_.get([this]{ return semaphore_->count()>0; });
+	}
+
+	void sync() const {
+		fd_.sync([this]{ return semaphore_->count()>0; });
+	}
+
+	mutable aux::readiness_fd fd_;
+#else
+	void sync() const {}
+#endif
+
+	mutable aux::futex_semaphore local_;
+#if defined(__linux__)
+	std::unique_ptr<aux::shared_object<aux::futex_semaphore> > shared_;
+#endif
+	aux::futex_semaphore* semaphore_;
+};
+
+#endif
+
 
 } // namespace dumbnose
\ No newline at end of file
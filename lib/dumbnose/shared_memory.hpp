@@ -1,12 +1,28 @@
 #pragma once
 
+#include <string>
+
+#if defined(_WIN32)
 #include <dumbnose/mutex.hpp>
 #include <dumbnose/event.hpp>
+#else
+#include <cerrno>
+#include <cassert>
+#include <cstdint>
+#include <system_error>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <dumbnose/noncopyable.hpp>
+#endif
 
 
 namespace dumbnose {
 
 
+#if defined(_WIN32)
+
 class shared_memory
 {
 public:
@@ -49,5 +65,83 @@ private:
 	void*			mem_start_;		// Pointer to the start of the shared memory
 };
 
+#else
+
+//
+// POSIX shared memory object (shm_open), opened if it exists and created
+// zero-filled otherwise.  Unlike a Win32 mapping it outlives its last user
+// until remove() is called, so the name can be reused by later processes.
+//
+class shared_memory : dumbnose::noncopyable
+{
+public:
+	 shared_memory(unsigned int size, std::wstring name) : shared_memory(size, shm_name(name)) {}
+
+	 shared_memory(unsigned int size, std::string name) : size_(size)
+	 {
+		fd_ = shm_open(name.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+		if(fd_<0) throw std::system_error(errno, std::system_category(), "shm_open failed");
+
+		// whoever gets here first sizes it; a larger existing object is left alone
+		struct stat info;
+		if(fstat(fd_, &info)!=0 || (info.st_size<static_cast<off_t>(size) && ftruncate(fd_, size)!=0)) {
+			int error = errno;
+			close(fd_);
+			throw std::system_error(error, std::system_category(), "Could not size shared memory");
+		}
+
+		mem_start_ = mmap(nullptr, size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+		if(MAP_FAILED==mem_start_) {
+			int error = errno;
+			close(fd_);
+			throw std::system_error(error, std::system_category(), "mmap failed");
+		}
+	 }
+
+	 ~shared_memory() {
+		munmap(mem_start_, size_);
+		close(fd_);
+	 }
+
+	 void* mem_start()
+	 {
+		 assert(MAP_FAILED!=mem_start_);
+
+		 return mem_start_;
+	 }
+
+	 // Delete the named object; processes that have it mapped keep their view
+	 static bool remove(std::wstring name)
+	 {
+		 return shm_unlink(shm_name(name).c_str())==0;
+	 }
+
+	 // "/" followed by the name, with '/', '%' and non-ASCII characters escaped as %XXXXXXXX
+	 static std::string shm_name(std::wstring const & name)
+	 {
+		 static const char hex[] = "0123456789abcdef";
+
+		 std::string result("/");
+		 for(wchar_t c : name) {
+			 if(c>0x20 && c<0x7f && c!=L'/' && c!=L'%') {
+				 result += static_cast<char>(c);
+			 } else {
+				 // eight digits, so code points past 0xFFFF keep their own name
+				 std::uint32_t value = static_cast<std::uint32_t>(c);
+				 result += '%';
+				 for(int shift=28 ; shift>=0 ; shift-=4) result += hex[(value>>shift) & 0xf];
+			 }
+		 }
+		 return result;
+	 }
+
+private:
+	int				fd_;			// shm_open descriptor
+	std::size_t		size_;			// Bytes mapped
+	void*			mem_start_;		// Pointer to the start of the shared memory
+};
+
+#endif
+
 
 };	// namespace dumbnose
\ No newline at end of file
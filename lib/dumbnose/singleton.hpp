@@ -1,6 +1,8 @@
 #pragma once
 
+#if defined(_WIN32)
 #include "windows_exception.hpp"
+#endif
 #include <dumbnose/noncopyable.hpp>
 
 
@@ -17,6 +19,7 @@ public:
 protected:
 	singleton(){}
 
+#if defined(_WIN32)
 	static BOOL WINAPI init(PINIT_ONCE intOncePtr, PVOID Parameter, PVOID* context)
 	{
 		T* inst = new T;
@@ -36,6 +39,14 @@ protected:
 
 		return context;
 	}
+#else
+	// never destroyed, like the Win32 version, so it can be used during exit
+	static T* get_instance()
+	{
+		static T* context = new T;
+		return context;
+	}
+#endif
 };
 
 
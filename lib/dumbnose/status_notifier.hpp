@@ -1,54 +1,104 @@
 #pragma once
-#include <dumbnose\singleton.hpp>
+#include <dumbnose/singleton.hpp>
+#include <dumbnose/event_source.hpp>
+#include <dumbnose/trace_log.hpp>
+#include <dumbnose/error_throttle.hpp>
+#include <cassert>
+#include <cstdint>
+#include <exception>
+#include <string>
+#include <string_view>
 #include <sstream>
 
+#if defined(_WIN32)
+#include <windows.h>
+#endif
+
 namespace dumbnose {
 
 
+//
+// Traces go through a trace_log: trace() only copies the message into the
+// calling thread's ring buffer, and the log's flusher thread later sends
+// it to the debugger, keeps it in the bounded trace_history() and raises
+// trace_received_event.  Use STATUS_TRACE on hot paths to skip formatting
+// on the calling thread altogether.
+//
+// Errors are rate limited per message (see error_throttle), and messages
+// that are held back are never formatted.  Their count is reported as
+// "N similar errors suppressed" when the message next gets through, or by
+// report_suppressed_errors().  STATUS_REPORT_ERROR keys on the call site
+// and only builds its message when it is going to be reported.
+//
 class status_notifier : public dumbnose::singleton<status_notifier>
 {
 public:
+	status_notifier()
+		: trace_flushed_cookie_(trace_log_.entry_flushed_event.register_listener(
+			[this](dumbnose::trace_log&, trace_entry const & entry) { trace_flushed(entry); }))
+	{}
 
 	// operations
 	void update_status(std::wstring const & status)
 	{
 		status_updated_event.raise(*this, status);
 	}
-	
+
 
 	void report_error(std::wstring const & message)
 	{
-		error_occurred_event.raise(*this, message);
+		emit_error(error_throttle_.admit(dumbnose::error_throttle::key_of(message)), [&] { return message; });
 	}
 
 	void report_error(std::wstring const & message, uint32_t num)
 	{
-		std::wstring error_msg = (boost::wformat(L"0x%x: %s") % num % message).str();
-		error_occurred_event.raise(*this, error_msg);
+		emit_error(error_throttle_.admit(dumbnose::error_throttle::key_of(message)), [&] {
+			std::wostringstream error_msg;
+			error_msg << L"0x" << std::hex << num << L": " << message;
+			return error_msg.str();
+		});
 	}
 
 	void report_error(std::string const & message)
 	{
-		auto wide_message = (boost::wformat(L"%S") % message.c_str()).str();
-		report_error(wide_message);
+		emit_error(error_throttle_.admit(dumbnose::error_throttle::key_of(message)), [&] { return widen(message); });
 	}
 
 	void report_error(std::string const & message, uint32_t num)
 	{
-		auto wide_message = (boost::wformat(L"%S") % message.c_str()).str();
-		report_error(wide_message, num);
+		emit_error(error_throttle_.admit(dumbnose::error_throttle::key_of(message)), [&] {
+			std::wostringstream error_msg;
+			error_msg << L"0x" << std::hex << num << L": " << widen(message);
+			return error_msg.str();
+		});
 	}
 
 	void report_exception(std::exception & error)
 	{
-		report_error(error.what());
+		report_error(std::string(error.what()));
+	}
+
+	// format() returns the message as a std::wstring and is only called if it is reported
+	template<class format_t>
+	void report_error_at(error_site const & site, format_t&& format)
+	{
+		emit_error(error_throttle_.admit(dumbnose::error_throttle::key_of(site), &site), std::forward<format_t>(format));
+	}
+
+	// Report the counts of errors held back so far, e.g. from a periodic timer
+	void report_suppressed_errors()
+	{
+		error_throttle_.drain_suppressed([this](std::uint64_t, std::uint64_t suppressed, error_site const * site) {
+			error_occurred_event.raise(*this, suppressed_summary(suppressed, site));
+		});
 	}
 
+	// Limits can be changed at any time
+	dumbnose::error_throttle& error_throttle() { return error_throttle_; }
+
 	void trace(std::wstring const & trace_message)
 	{
-		OutputDebugString(trace_message.c_str());
-		trace_history_ << L"\n" << trace_message;
-		trace_received_event.raise(*this, trace_message);
+		trace_log_.write_text(trace_level::info, trace_message);
 	}
 
 	void trace_assert(bool condition, std::wstring const & message)
@@ -57,7 +107,20 @@ public:
 		if (!condition) trace(message);
 	}
 
-	std::wstring trace_history() { return trace_history_.str();  }
+	// Flushes pending traces first; holds at most trace_log_options::history_size of them
+	std::wstring trace_history()
+	{
+		trace_log_.flush();
+
+		std::wstring history;
+		for (trace_entry const & entry : trace_log_.history()) {
+			history += L"\n";
+			history += entry.text;
+		}
+		return history;
+	}
+
+	dumbnose::trace_log& trace_log() { return trace_log_; }
 
 	// events
 	using status_updated_event_t = event_source<status_notifier&, std::wstring const &>;
@@ -69,12 +132,85 @@ public:
 	using exception_occurred_event_t = event_source<status_notifier&, std::wstring const &>;
 	exception_occurred_event_t exception_occurred_event;
 
+	// raised on the trace log's flushing thread
 	using trace_received_event_t = event_source<status_notifier&, std::wstring const &>;
 	trace_received_event_t trace_received_event;
 
 private:
-	std::wstringstream trace_history_;
+	template<class format_t>
+	void emit_error(dumbnose::error_throttle::decision decision, format_t&& format)
+	{
+		if (!decision.emit) return;
+
+		// the count belongs to the key owning the slot, which may not be this one
+		if (decision.suppressed) error_occurred_event.raise(*this, suppressed_summary(decision.suppressed, decision.site));
+		error_occurred_event.raise(*this, format());
+	}
+
+	static std::wstring suppressed_summary(std::uint64_t suppressed, error_site const * site)
+	{
+		std::wostringstream summary;
+		summary << suppressed << L" similar errors suppressed";
+		if (site) summary << L" at " << widen(site->file()) << L"(" << site->line() << L")";
+		return summary.str();
+	}
+
+	// Narrow messages and file names are taken as the ANSI code page on Win32, UTF-8 elsewhere
+	static std::wstring widen(std::string_view text)
+	{
+#if defined(_WIN32)
+		if (text.empty()) return std::wstring();
+		std::wstring wide(MultiByteToWideChar(CP_ACP, 0, text.data(), static_cast<int>(text.size()), nullptr, 0), L'\0');
+		MultiByteToWideChar(CP_ACP, 0, text.data(), static_cast<int>(text.size()), wide.data(), static_cast<int>(wide.size()));
+		return wide;
+#else
+		std::wstring wide;
+		wide.reserve(text.size());
+		for (std::size_t i = 0; i < text.size(); ) {
+			unsigned char lead = static_cast<unsigned char>(text[i]);
+			std::size_t length = lead < 0x80 ? 1 : lead < 0xC2 ? 0 : lead < 0xE0 ? 2 : lead < 0xF0 ? 3 : lead < 0xF5 ? 4 : 0;
+			char32_t code = length == 1 ? lead : length == 2 ? lead & 0x1F : length == 3 ? lead & 0x0F : lead & 0x07;
+
+			std::size_t taken = 1;
+			for (; taken < length && i + taken < text.size() && (text[i + taken] & 0xC0) == 0x80; ++taken) {
+				code = code << 6 | (text[i + taken] & 0x3F);
+			}
+
+			// stray, truncated, overlong or surrogate sequences become U+FFFD
+			bool valid = length != 0 && taken == length
+				&& !(length == 3 && code < 0x800) && !(length == 4 && (code < 0x10000 || code > 0x10FFFF))
+				&& !(code >= 0xD800 && code <= 0xDFFF);
+			wide.push_back(static_cast<wchar_t>(valid ? code : 0xFFFD));
+			i += taken;
+		}
+		return wide;
+#endif
+	}
+
+	void trace_flushed(trace_entry const & entry)
+	{
+#if defined(_WIN32)
+		OutputDebugStringW(entry.text.c_str());
+#endif
+		trace_received_event.raise(*this, entry.text);
+	}
+
+	dumbnose::error_throttle error_throttle_;
+	dumbnose::trace_log trace_log_;
+	dumbnose::trace_log::entry_flushed_event_t::cookie_t trace_flushed_cookie_;
 };
 
 
 }
+
+
+// Trace through status_notifier's log, formatting later on its flushing thread
+#define STATUS_TRACE(level, format, ...) \
+	DUMBNOSE_TRACE(dumbnose::status_notifier::instance().trace_log(), level, format, ##__VA_ARGS__)
+
+// Report an error rate limited per call site; message is only evaluated if it is reported
+#define STATUS_REPORT_ERROR(message) \
+	do { \
+		static const dumbnose::error_site dumbnose_error_site(__FILE__, __LINE__); \
+		dumbnose::status_notifier::instance().report_error_at(dumbnose_error_site, [&] { return std::wstring(message); }); \
+	} while(0)
@@ -0,0 +1,279 @@
+#pragma once
+
+//
+//	task
+//
+//	Lazily started coroutine returning T.  A task does nothing until it is
+//	co_awaited; when it finishes it resumes its awaiter directly through
+//	symmetric transfer, so chains of tasks completing synchronously don't
+//	bounce through a scheduler.  Optimized builds make that transfer a tail
+//	call and the stack stays flat; unoptimized and ASan builds do not, so
+//	very long synchronous chains can still overflow there.
+//
+//	sync_wait() runs a task to completion from ordinary code, and detach()
+//	starts one without waiting for it.  Use the awaitables in async.hpp to
+//	move a task onto a thread_pool or to suspend it on events and timers.
+//
+
+#include <condition_variable>
+#include <coroutine>
+#include <exception>
+#include <mutex>
+#include <optional>
+#include <type_traits>
+#include <utility>
+
+
+namespace dumbnose {
+
+
+template<class result_t = void>
+class task;
+
+
+namespace aux {
+
+
+class task_promise_base
+{
+public:
+	struct final_awaiter
+	{
+		bool await_ready() noexcept { return false; }
+
+		// hand control straight to whoever awaited us
+		template<class promise_t>
+		std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_t> handle) noexcept
+		{
+			std::coroutine_handle<> continuation = handle.promise().continuation_;
+			return continuation ? continuation : std::noop_coroutine();
+		}
+
+		void await_resume() noexcept {}
+	};
+
+	std::suspend_always initial_suspend() noexcept { return {}; }
+	final_awaiter final_suspend() noexcept { return {}; }
+
+	void unhandled_exception() { error_ = std::current_exception(); }
+
+	void continuation(std::coroutine_handle<> continuation) { continuation_ = continuation; }
+
+protected:
+	void rethrow_if_failed()
+	{
+		if(error_) std::rethrow_exception(error_);
+	}
+
+private:
+	std::coroutine_handle<> continuation_;
+	std::exception_ptr error_;
+};
+
+
+template<class result_t>
+class task_promise : public task_promise_base
+{
+public:
+	task<result_t> get_return_object() noexcept;
+
+	template<class value_t>
+	void return_value(value_t&& value) { result_.emplace(std::forward<value_t>(value)); }
+
+	result_t& result() &
+	{
+		rethrow_if_failed();
+		return *result_;
+	}
+
+	result_t&& result() &&
+	{
+		rethrow_if_failed();
+		return std::move(*result_);
+	}
+
+private:
+	std::optional<result_t> result_;
+};
+
+
+template<>
+class task_promise<void> : public task_promise_base
+{
+public:
+	task<void> get_return_object() noexcept;
+
+	void return_void() noexcept {}
+
+	void result() { rethrow_if_failed(); }
+};
+
+
+} // namespace aux
+
+
+template<class result_t>
+class task
+{
+public:
+	typedef aux::task_promise<result_t> promise_type;
+	typedef std::coroutine_handle<promise_type> handle_t;
+
+	task() noexcept {}
+	explicit task(handle_t handle) noexcept : handle_(handle) {}
+
+	task(task&& other) noexcept : handle_(std::exchange(other.handle_, nullptr)) {}
+
+	task& operator=(task&& other) noexcept
+	{
+		if(this!=&other) {
+			if(handle_) handle_.destroy();
+			handle_ = std::exchange(other.handle_, nullptr);
+		}
+		return *this;
+	}
+
+	task(task const &) = delete;
+	task& operator=(task const &) = delete;
+
+	~task()
+	{
+		if(handle_) handle_.destroy();
+	}
+
+	bool valid() const noexcept { return static_cast<bool>(handle_); }
+	bool done() const noexcept { return !handle_ || handle_.done(); }
+
+	auto operator co_await() & noexcept
+	{
+		struct awaiter : awaiter_base
+		{
+			decltype(auto) await_resume() { return this->handle_.promise().result(); }
+		};
+		return awaiter{{handle_}};
+	}
+
+	auto operator co_await() && noexcept
+	{
+		struct awaiter : awaiter_base
+		{
+			decltype(auto) await_resume() { return std::move(this->handle_.promise()).result(); }
+		};
+		return awaiter{{handle_}};
+	}
+
+private:
+	struct awaiter_base
+	{
+		handle_t handle_;
+
+		bool await_ready() const noexcept { return !handle_ || handle_.done(); }
+
+		// start the task; it resumes the awaiter when it finishes
+		std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept
+		{
+			handle_.promise().continuation(awaiting);
+			return handle_;
+		}
+	};
+
+	handle_t handle_ = nullptr;
+};
+
+
+namespace aux {
+
+
+template<class result_t>
+task<result_t> task_promise<result_t>::get_return_object() noexcept
+{
+	return task<result_t>(std::coroutine_handle<task_promise<result_t> >::from_promise(*this));
+}
+
+inline task<void> task_promise<void>::get_return_object() noexcept
+{
+	return task<void>(std::coroutine_handle<task_promise<void> >::from_promise(*this));
+}
+
+
+// Eagerly started, self-destroying coroutine used to drive tasks from ordinary code
+struct detached_coroutine
+{
+	struct promise_type
+	{
+		detached_coroutine get_return_object() noexcept { return {}; }
+		std::suspend_never initial_suspend() noexcept { return {}; }
+		std::suspend_never final_suspend() noexcept { return {}; }
+		void return_void() noexcept {}
+		void unhandled_exception() noexcept { std::terminate(); }
+	};
+};
+
+
+template<class result_t>
+struct sync_wait_state
+{
+	std::mutex lock_;
+	std::condition_variable done_cv_;
+	bool done_ = false;
+	std::exception_ptr error_;
+	std::optional<typename std::conditional<std::is_void<result_t>::value, char, result_t>::type> result_;
+};
+
+
+template<class result_t>
+detached_coroutine run_sync_wait(task<result_t> work, sync_wait_state<result_t>* state)
+{
+	try {
+		if constexpr (std::is_void<result_t>::value) {
+			co_await std::move(work);
+		} else {
+			state->result_.emplace(co_await std::move(work));
+		}
+	} catch(...) {
+		state->error_ = std::current_exception();
+	}
+
+	std::lock_guard<std::mutex> lock(state->lock_);
+	state->done_ = true;
+	state->done_cv_.notify_all();
+}
+
+
+inline detached_coroutine run_detached(task<void> work)
+{
+	co_await std::move(work);
+}
+
+
+} // namespace aux
+
+
+//
+// Run work to completion, blocking the calling thread, and return its
+// result or rethrow its exception.
+//
+template<class result_t>
+result_t sync_wait(task<result_t> work)
+{
+	aux::sync_wait_state<result_t> state;
+	aux::run_sync_wait(std::move(work), &state);
+
+	std::unique_lock<std::mutex> lock(state.lock_);
+	state.done_cv_.wait(lock, [&]{ return state.done_; });
+
+	if(state.error_) std::rethrow_exception(state.error_);
+	if constexpr (!std::is_void<result_t>::value) return std::move(*state.result_);
+}
+
+//
+// Start work without waiting for it.  It runs on the calling thread until
+// its first suspension.  An exception escaping it terminates the process.
+//
+inline void detach(task<void> work)
+{
+	aux::run_detached(std::move(work));
+}
+
+
+} // namespace dumbnose
@@ -0,0 +1,158 @@
+#pragma once
+
+//
+//	thread_affinity
+//
+//	Helpers for placing threads on specific CPUs.  CPU numbers are the
+//	operating system's logical processor numbers.  On Windows only the
+//	first 64 processors (the calling thread's processor group) are
+//	supported.  Other systems without Linux's affinity calls (macOS, the
+//	BSDs) report every CPU as available and cannot pin threads.
+//
+
+#include <cstddef>
+#include <fstream>
+#include <functional>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if defined(_WIN32)
+#include <windows.h>
+#elif defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+
+namespace dumbnose {
+
+
+// CPUs the calling process is allowed to run on
+inline std::vector<unsigned int> available_cpus()
+{
+	std::vector<unsigned int> cpus;
+
+#if defined(_WIN32)
+	DWORD_PTR process_mask = 0, system_mask = 0;
+	if(GetProcessAffinityMask(GetCurrentProcess(), &process_mask, &system_mask)) {
+		for(unsigned int cpu=0 ; cpu<sizeof(DWORD_PTR)*8 ; ++cpu) {
+			if(process_mask & (static_cast<DWORD_PTR>(1)<<cpu)) cpus.push_back(cpu);
+		}
+	}
+#elif defined(__linux__)
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	if(sched_getaffinity(0, sizeof(set), &set)==0) {
+		for(unsigned int cpu=0 ; cpu<CPU_SETSIZE ; ++cpu) {
+			if(CPU_ISSET(cpu, &set)) cpus.push_back(cpu);
+		}
+	}
+#endif
+
+	if(cpus.empty()) {
+		unsigned int count = std::thread::hardware_concurrency();
+		for(unsigned int cpu=0 ; cpu<count ; ++cpu) cpus.push_back(cpu);
+	}
+
+	return cpus;
+}
+
+//
+// Parse a kernel cpu list such as "0-3,8-11"
+//
+inline std::vector<unsigned int> parse_cpu_list(std::string const & list)
+{
+	std::vector<unsigned int> cpus;
+	std::stringstream stream(list);
+	std::string range;
+
+	while(std::getline(stream, range, ',')) {
+		if(range.empty() || range[0]=='\n') continue;
+
+		std::string::size_type dash = range.find('-');
+		unsigned long first = std::stoul(range.substr(0, dash));
+		unsigned long last = (dash==std::string::npos) ? first : std::stoul(range.substr(dash+1));
+
+		for(unsigned long cpu=first ; cpu<=last ; ++cpu) cpus.push_back(static_cast<unsigned int>(cpu));
+	}
+
+	return cpus;
+}
+
+// CPUs that belong to a NUMA node; empty if the node does not exist
+inline std::vector<unsigned int> numa_node_cpus(int node)
+{
+	std::vector<unsigned int> cpus;
+	if(node<0) return cpus;
+
+#if defined(_WIN32)
+	ULONGLONG mask = 0;
+	if(GetNumaNodeProcessorMask(static_cast<UCHAR>(node), &mask)) {
+		for(unsigned int cpu=0 ; cpu<64 ; ++cpu) {
+			if(mask & (1ull<<cpu)) cpus.push_back(cpu);
+		}
+	}
+#else
+	std::ifstream file("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+	std::string list;
+	if(file && std::getline(file, list)) cpus = parse_cpu_list(list);
+#endif
+
+	return cpus;
+}
+
+//
+// CPU the calling thread is running on right now.  The answer can be stale
+// by the time it is used, so it is only good as a hint, e.g. for picking a
+// per-CPU shard.  Without an OS call for it, threads are spread by id.
+//
+inline unsigned int current_cpu()
+{
+#if defined(_WIN32)
+	return GetCurrentProcessorNumber();
+#else
+#if defined(__linux__)
+	int cpu = sched_getcpu();
+	if(cpu>=0) return static_cast<unsigned int>(cpu);
+#endif
+	return static_cast<unsigned int>(std::hash<std::thread::id>()(std::this_thread::get_id()));
+#endif
+}
+
+// How many per-CPU shards to keep: the CPU count rounded up to a power of
+// two, so current_cpu() can be masked into range, and capped at 64
+inline std::size_t cpu_shard_count()
+{
+	std::size_t cpus = std::thread::hardware_concurrency();
+	std::size_t count = 1;
+	while(count<cpus && count<64) count <<= 1;
+	return count;
+}
+
+// Restrict the calling thread to the given CPUs.  Returns false on failure.
+inline bool set_current_thread_affinity(std::vector<unsigned int> const & cpus)
+{
+	if(cpus.empty()) return false;
+
+#if defined(_WIN32)
+	DWORD_PTR mask = 0;
+	for(unsigned int cpu : cpus) {
+		if(cpu<sizeof(DWORD_PTR)*8) mask |= static_cast<DWORD_PTR>(1)<<cpu;
+	}
+	return mask!=0 && SetThreadAffinityMask(GetCurrentThread(), mask)!=0;
+#elif defined(__linux__)
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	for(unsigned int cpu : cpus) {
+		if(cpu<CPU_SETSIZE) CPU_SET(cpu, &set);
+	}
+	return pthread_setaffinity_np(pthread_self(), sizeof(set), &set)==0;
+#else
+	return false;
+#endif
+}
+
+
+} // namespace dumbnose
@@ -1,14 +1,25 @@
 #pragma once
 
+#if defined(_WIN32)
 #include <dumbnose/mutex.hpp>
 #include <dumbnose/event.hpp>
 #include <dumbnose/waiter.hpp>
 #include <dumbnose/shared_memory.hpp>
+#else
+#include <memory>
+#include <string>
+#include <dumbnose/barrier.hpp>
+#if defined(__linux__)
+#include <dumbnose/aux_/shared_object.hpp>
+#endif
+#endif
 
 
 namespace dumbnose {
 
 
+#if defined(_WIN32)
+
 class thread_barrier
 {
 public:
@@ -28,6 +39,12 @@ public:
 	 {
 	 }
 
+	 // Win32 names go away with their last handle; see the POSIX version
+	 static bool remove(std::wstring const &)
+	 {
+		return true;
+	 }
+
 	 void wait()
 	 {
 		lock_.acquire();
@@ -59,5 +76,49 @@ private:
     shared_memory	thread_count_;	// Current number of threads waiting
 };
 
+#else
+
+//
+// See barrier.hpp for barriers with more control over waiting.  On Linux a
+// named barrier lives in POSIX shared memory, so separate processes can
+// rendezvous on it; every process must pass the same threshold.  The name
+// and the count of threads waiting persist after the last user closes it,
+// and after a crash, until remove() deletes it.
+//
+class thread_barrier
+{
+public:
+	thread_barrier(unsigned int threshold) : local_(threshold), barrier_(&local_) {}
+
+#if defined(__linux__)
+	thread_barrier(unsigned int threshold, std::wstring name) :
+	  local_(1),
+	  shared_(new aux::shared_object<sense_barrier>(name, threshold, aux::spin_wait::default_spin_count, true)),
+	  barrier_(&shared_->get())
+	 {
+	 }
+
+	// Delete a named barrier; processes that have it open keep using it
+	static bool remove(std::wstring const & name)
+	{
+		return aux::shared_object<sense_barrier>::remove(name);
+	}
+#endif
+
+	void wait()
+	{
+		barrier_->wait();
+	}
+
+private:
+	sense_barrier	local_;			// Used by unnamed barriers
+#if defined(__linux__)
+	std::unique_ptr<aux::shared_object<sense_barrier> > shared_;
+#endif
+	sense_barrier*	barrier_;
+};
+
+#endif
+
 
 };	// namespace dumbnose
\ No newline at end of file
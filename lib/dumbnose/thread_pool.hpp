@@ -1,70 +1,541 @@
 #pragma once
 
-#include <dumbnose/mutex.hpp>
-#include <dumbnose/semaphore.hpp>
-#include <dumbnose/event.hpp>
-#include <dumbnose/waiter.hpp>
-#include <dumbnose/safe_list.hpp>
-#include <dumbnose/cmdline_options.hpp>
+#include <dumbnose/thread_affinity.hpp>
+#include <dumbnose/metrics.hpp>
 #include <boost/shared_ptr.hpp>
-#include <dumbnose/lock.hpp>
-#include <limits>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <future>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
 
 
 namespace dumbnose {
 
 
-template<class work_item_t>
+//
+// Sizing and placement of the workers a thread_pool owns
+//
+struct thread_pool_options
+{
+	unsigned int thread_count = 0;		// 0 = one worker per CPU in the placement set
+	int numa_node = -1;					// restrict workers to this NUMA node's CPUs
+	std::vector<unsigned int> cpus;		// explicit CPU set; overrides numa_node
+	bool pin_each_worker = false;		// pin worker i to a single CPU instead of the whole set
+	unsigned int starvation_limit = 16;	// see thread_pool::set_starvation_limit()
+	std::chrono::steady_clock::duration deadline_slack = std::chrono::milliseconds(1);	// see thread_pool::set_deadline_slack()
+};
+
+enum class work_priority
+{
+	high,		// latency critical
+	normal,		// what add_work_item() uses by default
+	low			// bulk/background
+};
+
+//
+// Queue depth counters for one scheduling lane
+//
+struct lane_stats
+{
+	std::size_t depth = 0;				// items queued right now
+	std::size_t max_depth = 0;			// high-water mark
+	std::uint64_t enqueued = 0;
+	std::uint64_t dequeued = 0;
+	std::uint64_t starvation_picks = 0;	// dequeues forced by starvation protection
+};
+
+enum class shutdown_mode
+{
+	drain,		// finish everything already queued, then stop
+	fast		// finish the items in flight, discard the rest
+};
+
+
+//
+// Queue of work items plus, optionally, the threads that service it.
+//
+// Default constructed, the pool is only a queue: callers run their own
+// threads that loop on get_work_item() until it returns null.  Constructed
+// with thread_pool_options, the pool starts and owns its workers, which
+// hand each item to processor (by default the item is simply invoked).
+// An exception escaping the processor terminates the process, as it would
+// on a std::thread; use submit() to get exceptions back through a future.
+//
+// Items are queued in lanes: an earliest-deadline-first lane, then high,
+// normal and low priority FIFO lanes.  Workers take from the first
+// non-empty lane in that order, except that high priority work goes ahead
+// of a deadline item with more than deadline_slack left before its
+// deadline, and a lane passed over starvation_limit times in a row while
+// it had work is served next.
+//
+template<class work_item_t = std::function<void()> >
 class thread_pool
 {
+public:
 	typedef boost::shared_ptr<work_item_t> work_item_ptr;
+	typedef std::function<void(work_item_ptr)> processor_t;
+	typedef std::chrono::steady_clock::time_point deadline_t;
 
-public:
-	thread_pool():die_(true,false),work_item_sem_(0,std::numeric_limits<long>::max()) {}
-	~thread_pool(){release_threads();}
+	thread_pool() {}
 
-	void release_threads(){die_.set();}
+	explicit thread_pool(thread_pool_options const & options, processor_t processor = &invoke_work_item)
+		: starvation_limit_(options.starvation_limit), deadline_slack_(options.deadline_slack), processor_(std::move(processor))
+	{
+		start_workers(options);
+	}
 
-	work_item_ptr get_work_item()
+	~thread_pool(){shutdown(shutdown_mode::fast);}
+
+	thread_pool(thread_pool const &) = delete;
+	thread_pool& operator=(thread_pool const &) = delete;
+
+	// Wake every waiter in get_work_item() and have it return null
+	void release_threads()
 	{
-		while(true)
 		{
-			if(1==waiter::wait_any(die_,work_item_sem_)) {
-				// The die_ event was set, return with getting a work item 
-				return work_item_ptr();
+			std::lock_guard<std::mutex> lock(lock_);
+			die_ = true;
+		}
+		work_available_.notify_all();
+	}
+
+	//
+	// Stop accepting work and join the owned workers.  With drain, workers
+	// keep going until the queue is empty; with fast, queued items that
+	// have not started are discarded (their futures report broken_promise).
+	// Only the first call joins; a concurrent or later call returns without
+	// waiting.  Called from a worker, that worker cannot join itself and is
+	// left for the destructor, which must then run on another thread.
+	//
+	void shutdown(shutdown_mode mode = shutdown_mode::drain)
+	{
+		std::deque<work_item_ptr> discarded;
+		std::vector<std::thread> workers;
+		{
+			std::lock_guard<std::mutex> lock(lock_);
+			accepting_ = false;
+			workers.swap(workers_);
+			if(mode==shutdown_mode::fast) {
+				die_ = true;
+				for(std::deque<work_item_ptr>& lane : lanes_) {
+					discarded.insert(discarded.end(), lane.begin(), lane.end());
+					lane.clear();
+				}
+				while(!deadline_lane_.empty()) {
+					discarded.push_back(deadline_lane_.top().work_item_);
+					deadline_lane_.pop();
+				}
+				for(lane_stats& stats : stats_) stats.depth = 0;
+				for(unsigned int& skipped : skipped_) skipped = 0;
+				queued_ = 0;
 			}
+		}
+		work_available_.notify_all();
+
+		for(std::thread& worker : workers) {
+			if(worker.get_id()!=std::this_thread::get_id()) {
+				worker.join();
+			} else {
+				std::lock_guard<std::mutex> lock(lock_);
+				workers_.push_back(std::move(worker));
+			}
+		}
+	}
+
+	// Blocks until an item is available.  Returns null once the pool is
+	// released, or once it is shutting down and the queue has drained.
+	work_item_ptr get_work_item()
+	{
+		std::unique_lock<std::mutex> lock(lock_);
+		if(!wait_for_work(lock)) return work_item_ptr();
+
+		return pop_locked();
+	}
+
+	//
+	// Batch form of get_work_item(): blocks the same way, then appends up to
+	// max_items to work_items under a single lock.  Returns the number
+	// appended (0 once the pool is released or drained).
+	//
+	std::size_t get_work_items(std::vector<work_item_ptr>& work_items, std::size_t max_items)
+	{
+		if(max_items==0) return 0;
+
+		std::unique_lock<std::mutex> lock(lock_);
+		if(!wait_for_work(lock)) return 0;
+
+		std::size_t count = std::min(max_items, queued_);
+		for(std::size_t i=0 ; i<count ; ++i) work_items.push_back(pop_locked());
 
-			//
-			// The semaphore was upped because a job is waiting, try to get it.  
-			// NOTE:  Double check to ensure there is a work item queued.
-			//
-			HOLD_LOCK(work_item_queue_);
+		return count;
+	}
+
+	std::vector<work_item_ptr> get_work_items(std::size_t max_items)
+	{
+		std::vector<work_item_ptr> work_items;
+		get_work_items(work_items, max_items);
+		return work_items;
+	}
+
+	void add_work_item(work_item_ptr work_item, work_priority priority = work_priority::normal)
+	{
+		{
+			std::lock_guard<std::mutex> lock(lock_);
+			check_accepting();
+			lanes_[lane_of(priority)-1].push_back(std::move(work_item));
+			count_enqueue(lane_of(priority), 1);
+
+			// wake up a single waiting thread.  Notify before unlocking: once the
+			// lock is released a worker may run the item and its owner may
+			// destroy the pool, condition variable included.
+			work_available_.notify_one();
+		}
+	}
 
-			// handle empty queue case
-			if(work_item_queue_.empty()) continue;
+	// Queue an item in the earliest-deadline-first lane
+	void add_work_item(work_item_ptr work_item, deadline_t deadline)
+	{
+		{
+			std::lock_guard<std::mutex> lock(lock_);
+			check_accepting();
+			deadline_lane_.push(deadline_entry(deadline, deadline_sequence_++, std::move(work_item)));
+			count_enqueue(deadline_lane, 1);
+			work_available_.notify_one();
+		}
+	}
+
+	//
+	// Queue a batch of work items under one lock acquisition and wake only as
+	// many sleeping threads as there are items.
+	//
+	template<class range_t>
+	void add_work_items(range_t const & work_items, work_priority priority = work_priority::normal)
+	{
+		std::size_t count = 0;
+		{
+			std::lock_guard<std::mutex> lock(lock_);
+			check_accepting();
 
-			// retrieve the item at the front of the list
-			work_item_ptr work_item = work_item_queue_.front();
-			work_item_queue_.pop_front();
+			std::deque<work_item_ptr>& lane = lanes_[lane_of(priority)-1];
+			for(work_item_ptr const & work_item : work_items) {
+				lane.push_back(work_item);
+				++count;
+			}
+			count_enqueue(lane_of(priority), count);
 
-			return work_item;
+			if(count>=waiting_) {
+				work_available_.notify_all();
+			} else {
+				for(std::size_t i=0 ; i<count ; ++i) work_available_.notify_one();
+			}
 		}
 	}
 
-	void add_work_item(work_item_ptr work_item)
+	//
+	// Queue a callable and get its result (or exception) through a future.
+	// Requires a work_item_t that can be built from a void() callable, as
+	// the default std::function<void()> can.
+	//
+	template<class func_t>
+	std::future<typename std::invoke_result<typename std::decay<func_t>::type>::type> submit(func_t&& func)
 	{
-		work_item_queue_.push_back(work_item);
+		return submit(work_priority::normal, std::forward<func_t>(func));
+	}
 
-		// Up the semaphore by one, so a thread will get
-		// woken up.
-		work_item_sem_.release();
+	template<class func_t>
+	std::future<typename std::invoke_result<typename std::decay<func_t>::type>::type> submit(work_priority priority, func_t&& func)
+	{
+		auto packaged = package(std::forward<func_t>(func));
+		add_work_item(std::move(packaged.first), priority);
+		return std::move(packaged.second);
+	}
+
+	template<class func_t>
+	std::future<typename std::invoke_result<typename std::decay<func_t>::type>::type> submit(deadline_t deadline, func_t&& func)
+	{
+		auto packaged = package(std::forward<func_t>(func));
+		add_work_item(std::move(packaged.first), deadline);
+		return std::move(packaged.second);
+	}
+
+	std::size_t size() const
+	{
+		std::lock_guard<std::mutex> lock(lock_);
+		return queued_;
+	}
+
+	lane_stats statistics(work_priority priority) const
+	{
+		std::lock_guard<std::mutex> lock(lock_);
+		return stats_[lane_of(priority)];
+	}
+
+	lane_stats deadline_statistics() const
+	{
+		std::lock_guard<std::mutex> lock(lock_);
+		return stats_[deadline_lane];
+	}
+
+	//
+	// A lane that had work waiting while limit consecutive items were taken
+	// from lanes ahead of it gets the next item, so low lanes get at least
+	// 1/(limit+1) of the dispatches under saturation.  0 gives strict
+	// priority order.
+	//
+	void set_starvation_limit(unsigned int limit)
+	{
+		std::lock_guard<std::mutex> lock(lock_);
+		starvation_limit_ = limit;
+	}
+
+	//
+	// A deadline item goes ahead of high priority work only once its
+	// deadline is at most slack away; until then it only outranks normal
+	// and low priority work.
+	//
+	void set_deadline_slack(std::chrono::steady_clock::duration slack)
+	{
+		std::lock_guard<std::mutex> lock(lock_);
+		deadline_slack_ = slack;
+	}
+
+	// Owned workers not yet joined
+	unsigned int thread_count() const
+	{
+		std::lock_guard<std::mutex> lock(lock_);
+		return static_cast<unsigned int>(workers_.size());
+	}
+
+	//
+	// Publish name_queue_depth, name_enqueued_total and name_dequeued_total
+	// per lane, and time every item the owned workers run in
+	// name_run_seconds.  The callbacks are withdrawn with the pool.
+	//
+	void publish_metrics(std::string const & name, metrics_registry& registry = metrics_registry::instance())
+	{
+		static const char* const lane_names[lane_count] = { "deadline", "high", "normal", "low" };
+
+		std::vector<metrics_publication> publications;
+		for(std::size_t lane=0 ; lane<lane_count ; ++lane) {
+			std::string labels = std::string("lane=\"") + lane_names[lane] + "\"";
+			publications.push_back(registry.publish(metric_type::gauge, name + "_queue_depth", "Work items queued", [this, lane]{ return static_cast<double>(lane_statistics(lane).depth); }, labels));
+			publications.push_back(registry.publish(metric_type::counter, name + "_enqueued_total", "Work items queued since start", [this, lane]{ return static_cast<double>(lane_statistics(lane).enqueued); }, labels));
+			publications.push_back(registry.publish(metric_type::counter, name + "_dequeued_total", "Work items taken since start", [this, lane]{ return static_cast<double>(lane_statistics(lane).dequeued); }, labels));
+		}
+		run_time_.store(&registry.add_histogram(name + "_run_seconds", "Time workers spent running an item"), std::memory_order_release);
+
+		// any earlier publications are withdrawn after the lock is released
+		std::lock_guard<std::mutex> lock(lock_);
+		publications_.swap(publications);
 	}
 
 protected:
+	// lane 0 is the deadline lane, then one per work_priority
+	static const std::size_t deadline_lane = 0;
+	static const std::size_t lane_count = 4;
+
+	struct deadline_entry
+	{
+		deadline_entry(deadline_t deadline, std::uint64_t sequence, work_item_ptr work_item)
+			: deadline_(deadline), sequence_(sequence), work_item_(std::move(work_item)) {}
+
+		// inverted so that std::priority_queue yields the earliest deadline (FIFO among ties)
+		bool operator<(deadline_entry const & other) const
+		{
+			if(deadline_!=other.deadline_) return deadline_>other.deadline_;
+			return sequence_>other.sequence_;
+		}
+
+		deadline_t deadline_;
+		std::uint64_t sequence_;
+		work_item_ptr work_item_;
+	};
+
+	static std::size_t lane_of(work_priority priority)
+	{
+		return static_cast<std::size_t>(priority)+1;
+	}
+
+	template<class func_t>
+	std::pair<work_item_ptr, std::future<typename std::invoke_result<typename std::decay<func_t>::type>::type> > package(func_t&& func)
+	{
+		typedef typename std::invoke_result<typename std::decay<func_t>::type>::type result_t;
+
+		auto task = std::make_shared<std::packaged_task<result_t()> >(std::forward<func_t>(func));
+		std::future<result_t> result = task->get_future();
+
+		return std::make_pair(work_item_ptr(new work_item_t([task]{ (*task)(); })), std::move(result));
+	}
+
+	void check_accepting() const
+	{
+		if(!accepting_) throw std::logic_error("thread_pool: work added after shutdown");
+	}
+
+	bool lane_empty(std::size_t lane) const
+	{
+		return lane==deadline_lane ? deadline_lane_.empty() : lanes_[lane-1].empty();
+	}
+
+	lane_stats lane_statistics(std::size_t lane) const
+	{
+		std::lock_guard<std::mutex> lock(lock_);
+		return stats_[lane];
+	}
+
+	void count_enqueue(std::size_t lane, std::size_t count)
+	{
+		lane_stats& stats = stats_[lane];
+		stats.enqueued += count;
+		stats.depth += count;
+		stats.max_depth = std::max(stats.max_depth, stats.depth);
+		queued_ += count;
+	}
+
+	// Take the next item by lane order and starvation protection; lock held, queue not empty
+	work_item_ptr pop_locked()
+	{
+		std::size_t chosen = lane_count;
+		bool starving = false;
+
+		if(starvation_limit_>0) {
+			for(std::size_t lane=0 ; lane<lane_count ; ++lane) {
+				if(!lane_empty(lane) && skipped_[lane]>=starvation_limit_) {
+					chosen = lane;
+					starving = true;
+					break;
+				}
+			}
+		}
+
+		if(chosen==lane_count) {
+			for(chosen=0 ; lane_empty(chosen) ; ++chosen) {}
+
+			std::size_t high = lane_of(work_priority::high);
+			if(chosen==deadline_lane && !lane_empty(high) && deadline_lane_.top().deadline_-std::chrono::steady_clock::now()>deadline_slack_) {
+				chosen = high;
+			}
+		}
+
+		// every other lane that had work was passed over; an empty one starts afresh
+		for(std::size_t lane=0 ; lane<lane_count ; ++lane) {
+			if(lane!=chosen && !lane_empty(lane)) ++skipped_[lane];
+			else skipped_[lane] = 0;
+		}
+
+		work_item_ptr work_item;
+		if(chosen==deadline_lane) {
+			work_item = deadline_lane_.top().work_item_;
+			deadline_lane_.pop();
+		} else {
+			work_item = std::move(lanes_[chosen-1].front());
+			lanes_[chosen-1].pop_front();
+		}
+
+		lane_stats& stats = stats_[chosen];
+		--stats.depth;
+		++stats.dequeued;
+		if(starving) ++stats.starvation_picks;
+		--queued_;
+
+		return work_item;
+	}
+
+	// Wait until there is work or the pool is stopping.  Returns false if
+	// the caller should stop asking for work.
+	bool wait_for_work(std::unique_lock<std::mutex>& lock)
+	{
+		++waiting_;
+		work_available_.wait(lock, [this]{ return die_ || !accepting_ || queued_>0; });
+		--waiting_;
+
+		return !die_ && queued_>0;
+	}
+
+	static void invoke_work_item(work_item_ptr work_item)
+	{
+		(*work_item)();
+	}
+
+	void start_workers(thread_pool_options const & options)
+	{
+		std::vector<unsigned int> cpus = options.cpus;
+		if(cpus.empty() && options.numa_node>=0) cpus = numa_node_cpus(options.numa_node);
+		if(cpus.empty() && options.numa_node>=0) throw std::invalid_argument("thread_pool: unknown NUMA node");
+
+		bool pin = !cpus.empty();
+		if(!pin) cpus = available_cpus();
+
+		unsigned int count = options.thread_count;
+		if(count==0) count = static_cast<unsigned int>(cpus.size());
+		if(count==0) count = 1;
+
+		std::lock_guard<std::mutex> lock(lock_);
+		workers_.reserve(count);
+		for(unsigned int i=0 ; i<count ; ++i) {
+			std::vector<unsigned int> placement;
+			if(options.pin_each_worker) {
+				placement.push_back(cpus[i % cpus.size()]);
+			} else if(pin) {
+				placement = cpus;
+			}
+
+			workers_.emplace_back(&thread_pool::run_worker, this, std::move(placement));
+		}
+	}
+
+	void run_worker(std::vector<unsigned int> placement)
+	{
+		if(!placement.empty()) set_current_thread_affinity(placement);
+
+		while(work_item_ptr work_item = get_work_item()) {
+			histogram* run_time = run_time_.load(std::memory_order_acquire);
+			if(!run_time) {
+				processor_(std::move(work_item));
+				continue;
+			}
+
+			auto started = std::chrono::steady_clock::now();
+			processor_(std::move(work_item));
+			run_time->record(std::chrono::steady_clock::now()-started);
+		}
+	}
+
 	// Member variables
-	semaphore work_item_sem_;
-	event die_;
-	safe_list<work_item_ptr> work_item_queue_;
+	mutable std::mutex lock_;
+	std::condition_variable work_available_;
+	std::deque<work_item_ptr> lanes_[lane_count-1];
+	std::priority_queue<deadline_entry> deadline_lane_;
+	std::uint64_t deadline_sequence_ = 0;
+	std::size_t queued_ = 0;		// items across all lanes
+	unsigned int skipped_[lane_count] = {};
+	unsigned int starvation_limit_ = 16;
+	std::chrono::steady_clock::duration deadline_slack_ = std::chrono::milliseconds(1);
+	lane_stats stats_[lane_count];
+	std::size_t waiting_ = 0;		// threads blocked in wait_for_work()
+	bool die_ = false;
+	bool accepting_ = true;
+
+	processor_t processor_;
+	std::vector<std::thread> workers_;
+
+	// see publish_metrics(); declared last so the callbacks go first
+	std::atomic<histogram*> run_time_{nullptr};
+	std::vector<metrics_publication> publications_;
 };
 
 } // namespace dumbnose
@@ -0,0 +1,128 @@
+#pragma once
+
+//
+//	timer_queue
+//
+//	One thread that runs callbacks at (or shortly after) given points in
+//	time.  Callbacks run on the timer thread, so they should only hand work
+//	off, e.g. to a thread_pool.  Pending callbacks are dropped when the
+//	queue is destroyed.
+//
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <utility>
+#include <vector>
+#include <dumbnose/noncopyable.hpp>
+
+
+namespace dumbnose {
+
+
+class timer_queue : dumbnose::noncopyable
+{
+public:
+	typedef std::chrono::steady_clock clock_t;
+	typedef std::function<void()> callback_t;
+
+	timer_queue() : thread_(&timer_queue::run, this) {}
+
+	~timer_queue()
+	{
+		{
+			std::lock_guard<std::mutex> lock(lock_);
+			stopping_ = true;
+		}
+		changed_.notify_one();
+		thread_.join();
+	}
+
+	// Process-wide queue for callers that don't need their own thread
+	static timer_queue& shared()
+	{
+		static timer_queue queue;
+		return queue;
+	}
+
+	void schedule_at(clock_t::time_point when, callback_t callback)
+	{
+		bool earliest;
+		{
+			std::lock_guard<std::mutex> lock(lock_);
+			earliest = timers_.empty() || when<timers_.top().when_;
+			timers_.push(timer_t(when, sequence_++, std::move(callback)));
+		}
+
+		// only the thread's wake-up time can have changed
+		if(earliest) changed_.notify_one();
+	}
+
+	template<class rep_t, class period_t>
+	void schedule_after(std::chrono::duration<rep_t,period_t> delay, callback_t callback)
+	{
+		schedule_at(clock_t::now()+std::chrono::duration_cast<clock_t::duration>(delay), std::move(callback));
+	}
+
+	std::size_t size() const
+	{
+		std::lock_guard<std::mutex> lock(lock_);
+		return timers_.size();
+	}
+
+private:
+	struct timer_t
+	{
+		timer_t(clock_t::time_point when, std::uint64_t sequence, callback_t callback)
+			: when_(when), sequence_(sequence), callback_(std::move(callback)) {}
+
+		// inverted so that std::priority_queue yields the earliest timer (FIFO among ties)
+		bool operator<(timer_t const & other) const
+		{
+			if(when_!=other.when_) return when_>other.when_;
+			return sequence_>other.sequence_;
+		}
+
+		clock_t::time_point when_;
+		std::uint64_t sequence_;
+		callback_t callback_;
+	};
+
+	void run()
+	{
+		std::unique_lock<std::mutex> lock(lock_);
+		while(!stopping_) {
+			if(timers_.empty()) {
+				changed_.wait(lock);
+				continue;
+			}
+
+			clock_t::time_point when = timers_.top().when_;
+			if(clock_t::now()<when) {
+				changed_.wait_until(lock, when);
+				continue;
+			}
+
+			callback_t callback = std::move(const_cast<timer_t&>(timers_.top()).callback_);
+			timers_.pop();
+
+			lock.unlock();
+			callback();
+			lock.lock();
+		}
+	}
+
+	mutable std::mutex lock_;
+	std::condition_variable changed_;
+	std::priority_queue<timer_t> timers_;
+	std::uint64_t sequence_ = 0;
+	bool stopping_ = false;
+	std::thread thread_;
+};
+
+
+} // namespace dumbnose
@@ -0,0 +1,257 @@
+#pragma once
+
+//
+//	timing_probe
+//
+//	Hot-path timing.  SCOPED_TIMER("name") times the rest of the enclosing
+//	scope with cycle_clock and records the nanoseconds in the histogram of
+//	its timing_site, one per SCOPED_TIMER in the source:
+//
+//		void btree::insert(const key_t& key, record_t& record)
+//		{
+//			SCOPED_TIMER("btree.insert");
+//			...
+//		}
+//
+//	Each thread records into histograms of its own, so probes on different
+//	threads never touch the same cache line and recording is a handful of
+//	uncontended relaxed atomic adds.  A thread's histograms are folded into
+//	its sites when it exits.  dump_timing_sites() prints count, min, p50,
+//	p99 and max for every site reached; timing_site::take_snapshot()
+//	gives the numbers.
+//
+//	A probe costs two cycle_clock reads (rdtsc where the TSC is invariant).
+//	The clock is calibrated when the first site is constructed, before its
+//	first probe starts.  Define DUMBNOSE_NO_TIMING_PROBES to compile
+//	SCOPED_TIMER out.
+//
+//	A site's name and totals live in a registry that is never destroyed,
+//	so threads exiting after static destruction can still fold into them.
+//
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include <dumbnose/noncopyable.hpp>
+#include <dumbnose/preprocessor.hpp>
+#include <dumbnose/hires_timer.hpp>
+#include <dumbnose/metrics.hpp>
+
+
+namespace dumbnose {
+
+
+namespace aux {
+
+
+// A timing_site as the registry keeps it
+struct timing_site_state : dumbnose::noncopyable
+{
+	timing_site_state(const char* name, const char* file, int line) : name_(name), file_(file), line_(line) {}
+
+	const char* name_;
+	const char* file_;
+	int line_;
+	histogram retired_;		// from threads that have exited
+};
+
+
+// Every timing_site, and the histograms of every thread that has recorded into one
+class timing_sites : dumbnose::noncopyable
+{
+public:
+	static timing_sites& instance()
+	{
+		// never destroyed: threads fold their histograms in here as late as process exit
+		static timing_sites* sites = new timing_sites;
+		return *sites;
+	}
+
+	std::size_t add(const char* name, const char* file, int line)
+	{
+		std::lock_guard<std::mutex> lock(lock_);
+		sites_.emplace_back(name, file, line);
+		return sites_.size()-1;
+	}
+
+	std::size_t site_count() const
+	{
+		std::lock_guard<std::mutex> lock(lock_);
+		return sites_.size();
+	}
+
+	// Elements of a deque stay put as it grows
+	timing_site_state const & site(std::size_t id) const
+	{
+		std::lock_guard<std::mutex> lock(lock_);
+		return sites_[id];
+	}
+
+	inline histogram::snapshot take_snapshot(std::size_t id) const;
+
+	// The calling thread's histogram for site id
+	histogram& local(std::size_t id)
+	{
+		thread_histograms& histograms = thread_histograms::current();
+		if(id<histograms.size() && histograms[id]) return *histograms[id];
+		return grow(histograms, id);
+	}
+
+private:
+	class thread_histograms : public std::vector<std::unique_ptr<histogram>>
+	{
+	public:
+		static thread_histograms& current()
+		{
+			static thread_local thread_histograms histograms;
+			return histograms;
+		}
+
+		~thread_histograms() { timing_sites::instance().retire(*this); }
+	};
+
+	histogram& grow(thread_histograms& histograms, std::size_t id)
+	{
+		std::lock_guard<std::mutex> lock(lock_);
+		if(histograms.empty()) threads_.push_back(&histograms);
+		if(histograms.size()<=id) histograms.resize(id+1);
+		histograms[id].reset(new histogram);
+		return *histograms[id];
+	}
+
+	inline void retire(thread_histograms& histograms);
+
+	mutable std::mutex lock_;
+	std::deque<timing_site_state> sites_;
+	std::vector<thread_histograms*> threads_;
+};
+
+
+} // namespace aux
+
+
+class timing_site : dumbnose::noncopyable
+{
+public:
+	timing_site(const char* name, const char* file, int line)
+		: id_(aux::timing_sites::instance().add(name, file, line))
+	{
+		cycle_clock::ns_per_tick();
+	}
+
+	void record(std::uint64_t ns)
+	{
+		aux::timing_sites::instance().local(id_).record(ns);
+	}
+
+	// Everything recorded so far, by exited threads and running ones
+	histogram::snapshot take_snapshot() const
+	{
+		return aux::timing_sites::instance().take_snapshot(id_);
+	}
+
+	const char* name() const { return aux::timing_sites::instance().site(id_).name_; }
+	const char* file() const { return aux::timing_sites::instance().site(id_).file_; }
+	int line() const { return aux::timing_sites::instance().site(id_).line_; }
+
+private:
+	const std::size_t id_;
+};
+
+// nothing to destroy, so a probe on a thread outliving the static site still finds its id
+static_assert(std::is_trivially_destructible_v<timing_site>);
+
+
+class scoped_timer : dumbnose::noncopyable
+{
+public:
+	explicit scoped_timer(timing_site& site) : site_(site), started_(cycle_clock::now()) {}
+
+	~scoped_timer()
+	{
+		site_.record(cycle_clock::to_ns(cycle_clock::now()-started_));
+	}
+
+private:
+	timing_site& site_;
+	std::uint64_t started_;
+};
+
+
+namespace aux {
+
+
+inline histogram::snapshot timing_sites::take_snapshot(std::size_t id) const
+{
+	std::lock_guard<std::mutex> lock(lock_);
+	histogram::snapshot result = sites_[id].retired_.take_snapshot();
+	for(thread_histograms const * histograms : threads_) {
+		if(id<histograms->size() && (*histograms)[id]) result.merge((*histograms)[id]->take_snapshot());
+	}
+	return result;
+}
+
+inline void timing_sites::retire(thread_histograms& histograms)
+{
+	std::lock_guard<std::mutex> lock(lock_);
+	for(std::size_t id=0 ; id<histograms.size() ; ++id) {
+		if(histograms[id]) sites_[id].retired_.add(histograms[id]->take_snapshot());
+	}
+	threads_.erase(std::remove(threads_.begin(), threads_.end(), &histograms), threads_.end());
+}
+
+
+} // namespace aux
+
+
+//
+// Print every site reached so far, most total time first
+//
+inline void dump_timing_sites(std::ostream& out)
+{
+	aux::timing_sites& registry = aux::timing_sites::instance();
+	std::vector<std::pair<aux::timing_site_state const *, histogram::snapshot>> sites;
+	for(std::size_t id=0, count=registry.site_count() ; id<count ; ++id) {
+		histogram::snapshot snapshot = registry.take_snapshot(id);
+		if(snapshot.count) sites.emplace_back(&registry.site(id), std::move(snapshot));
+	}
+
+	std::sort(sites.begin(), sites.end(), [](auto const & left, auto const & right){
+		return left.second.sum>right.second.sum;
+	});
+
+	for(auto const & entry : sites) {
+		histogram::snapshot const & snapshot = entry.second;
+		out << entry.first->name_ << "  " << entry.first->file_ << "(" << entry.first->line_ << ")\n"
+			<< "  count " << snapshot.count
+			<< ", total " << snapshot.sum/1000 << "us"
+			<< ", min " << snapshot.min << "ns"
+			<< ", p50 " << snapshot.value_at(0.50) << "ns"
+			<< ", p99 " << snapshot.value_at(0.99) << "ns"
+			<< ", max " << snapshot.max << "ns\n";
+	}
+}
+
+
+} // namespace dumbnose
+
+
+#if defined(DUMBNOSE_NO_TIMING_PROBES)
+
+#define SCOPED_TIMER(name)
+
+#else
+
+#define SCOPED_TIMER(name) \
+	static dumbnose::timing_site ANONYMOUS_VARIABLE(timing_site)(name, __FILE__, __LINE__); \
+	dumbnose::scoped_timer ANONYMOUS_VARIABLE(scoped_timer)(ANONYMOUS_VARIABLE(timing_site))
+
+#endif
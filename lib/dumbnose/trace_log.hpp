@@ -0,0 +1,447 @@
+#pragma once
+
+//
+//	trace_log
+//
+//	Binary trace log cheap enough for hot paths.  Each thread writes fixed
+//	size records into its own single-producer ring buffer: a timestamp, a
+//	level, the address of a static format string and up to four numeric
+//	arguments.  Nothing is formatted, locked or allocated on the calling
+//	thread (apart from its buffer, on its first trace).  A background thread
+//	drains every buffer periodically, orders the records by time, formats
+//	them and keeps the most recent ones as a bounded history.
+//
+//		DUMBNOSE_TRACE(log, dumbnose::trace_level::info, L"read {} bytes in {} ms", count, elapsed);
+//
+//	Each "{}" in the format is replaced by the next argument.  Arguments
+//	may be integers, enums, floating point values, bools or pointers (which
+//	print as addresses); anything else must be formatted by the caller and
+//	logged with write_text(), which copies the text into the ring.
+//
+//	A full ring drops the new record and counts it rather than making the
+//	tracing thread wait.
+//
+//	Rings belong to the log.  A thread keeps only weak references to its
+//	rings, dropping those of logs that have gone, so destroying a log frees
+//	its rings at once.  When a thread exits it marks its rings, and the log
+//	frees each one after draining it.
+//
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include <dumbnose/noncopyable.hpp>
+#include <dumbnose/event_source.hpp>
+
+
+namespace dumbnose {
+
+
+enum class trace_level : std::uint8_t
+{
+	debug,
+	info,
+	warning,
+	error
+};
+
+// A format string; its address identifies it in trace records
+class trace_format : dumbnose::noncopyable
+{
+public:
+	explicit constexpr trace_format(const wchar_t* text) : text_(text) {}
+
+	const wchar_t* text() const { return text_; }
+
+private:
+	const wchar_t* text_;
+};
+
+// A formatted trace record
+struct trace_entry
+{
+	std::chrono::steady_clock::time_point time;
+	trace_level level;
+	std::thread::id thread;
+	std::wstring text;
+};
+
+struct trace_log_options
+{
+	std::size_t buffer_bytes = 64*1024;		// per tracing thread
+	std::size_t history_size = 1000;		// formatted entries kept in memory
+	std::chrono::milliseconds flush_interval{50};
+};
+
+
+class trace_log : dumbnose::noncopyable
+{
+public:
+	static constexpr std::size_t max_args = 4;
+
+	explicit trace_log(trace_log_options const & options = trace_log_options())
+		: options_(options), id_(next_id()), slot_count_(slot_count(options.buffer_bytes))
+	{
+		flusher_ = std::thread([this]{ run_flusher(); });
+	}
+
+	~trace_log()
+	{
+		{
+			std::unique_lock<std::mutex> lock(stop_lock_);
+			stop_ = true;
+		}
+		stop_event_.notify_all();
+		flusher_.join();
+		flush();
+	}
+
+	template<class... args_t>
+	void write(trace_level level, trace_format const & format, args_t const &... args)
+	{
+		static_assert(sizeof...(args_t)<=max_args, "trace_log records carry at most four arguments");
+		static_assert((is_loggable<args_t>::value && ...), "trace_log arguments must be numbers, enums, bools or pointers; use write_text for anything else");
+
+		buffer_t& buffer = this_thread_buffer();
+		std::size_t head = buffer.head_.load(std::memory_order_relaxed);
+		if(head-buffer.tail_.load(std::memory_order_acquire)>=slot_count_) {
+			buffer.dropped_.fetch_add(1, std::memory_order_relaxed);
+			return;
+		}
+
+		record_t& record = buffer.slots_[head & (slot_count_-1)];
+		record.time_ = std::chrono::steady_clock::now().time_since_epoch().count();
+		record.format_ = &format;
+		record.level_ = level;
+		record.arg_count_ = static_cast<std::uint8_t>(sizeof...(args_t));
+		record.extra_ = 0;
+
+		std::size_t index = 0;
+		(store_arg(record, index++, args), ...);
+		(void)index;
+
+		buffer.head_.store(head+1, std::memory_order_release);
+	}
+
+	// Copies text into the ring; long text is truncated to a quarter of the ring
+	void write_text(trace_level level, std::wstring_view text)
+	{
+		buffer_t& buffer = this_thread_buffer();
+
+		std::size_t length = std::min(text.size(), (slot_count_/4)*chars_per_slot);
+		std::size_t extra = (length+chars_per_slot-1)/chars_per_slot;
+
+		std::size_t head = buffer.head_.load(std::memory_order_relaxed);
+		if(head-buffer.tail_.load(std::memory_order_acquire)+1+extra>slot_count_) {
+			buffer.dropped_.fetch_add(1, std::memory_order_relaxed);
+			return;
+		}
+
+		record_t& record = buffer.slots_[head & (slot_count_-1)];
+		record.time_ = std::chrono::steady_clock::now().time_since_epoch().count();
+		record.format_ = nullptr;
+		record.level_ = level;
+		record.arg_count_ = 0;
+		record.extra_ = static_cast<std::uint32_t>(extra);
+		record.text_length_ = static_cast<std::uint32_t>(length);
+
+		for(std::size_t i=0 ; i<extra ; ++i) {
+			std::size_t offset = i*chars_per_slot;
+			std::size_t count = std::min(chars_per_slot, length-offset);
+			std::memcpy(&buffer.slots_[(head+1+i) & (slot_count_-1)], text.data()+offset, count*sizeof(wchar_t));
+		}
+
+		buffer.head_.store(head+1+extra, std::memory_order_release);
+	}
+
+	// Drain and format everything traced so far.  Listeners must not call it.
+	void flush()
+	{
+		std::unique_lock<std::mutex> flushing(flush_lock_);
+
+		std::vector<trace_entry> entries;
+		drain(entries);
+		std::stable_sort(entries.begin(), entries.end(), [](trace_entry const & left, trace_entry const & right) {
+			return left.time<right.time;
+		});
+
+		for(trace_entry const & entry : entries) {
+			{
+				std::unique_lock<std::mutex> lock(history_lock_);
+				history_.push_back(entry);
+				while(history_.size()>options_.history_size) history_.pop_front();
+			}
+			entry_flushed_event.raise(*this, entry);
+		}
+	}
+
+	// The most recent entries, oldest first
+	std::vector<trace_entry> history() const
+	{
+		std::unique_lock<std::mutex> lock(history_lock_);
+		return std::vector<trace_entry>(history_.begin(), history_.end());
+	}
+
+	// Records thrown away because a thread's ring was full
+	std::uint64_t dropped() const
+	{
+		std::unique_lock<std::mutex> lock(buffers_lock_);
+		std::uint64_t dropped = dropped_;
+		for(std::shared_ptr<buffer_t> const & buffer : buffers_) dropped += buffer->dropped_.load(std::memory_order_relaxed);
+		return dropped;
+	}
+
+	// Raised on the flushing thread for each entry, in time order
+	using entry_flushed_event_t = event_source<trace_log&, trace_entry const &>;
+	entry_flushed_event_t entry_flushed_event;
+
+private:
+	enum class arg_type : std::uint8_t { signed_int, unsigned_int, floating, pointer, boolean };
+
+	union arg_t
+	{
+		std::int64_t signed_int;
+		std::uint64_t unsigned_int;
+		double floating;
+		const void* pointer;
+	};
+
+	// One slot of a ring; text continues in the following slots
+	struct alignas(64) record_t
+	{
+		std::int64_t time_;
+		const trace_format* format_;
+		trace_level level_;
+		std::uint8_t arg_count_;
+		arg_type arg_types_[max_args];
+		std::uint32_t extra_;
+		std::uint32_t text_length_;
+		arg_t args_[max_args];
+	};
+	static_assert(sizeof(record_t)==64, "trace records should fill one cache line");
+
+	static constexpr std::size_t chars_per_slot = sizeof(record_t)/sizeof(wchar_t);
+
+	struct buffer_t : dumbnose::noncopyable
+	{
+		explicit buffer_t(std::size_t slot_count) : slots_(new record_t[slot_count]), thread_(std::this_thread::get_id()) {}
+
+		std::unique_ptr<record_t[]> slots_;
+		const std::thread::id thread_;
+		std::atomic<bool> exited_{false};		// set after the thread's last write
+		alignas(64) std::atomic<std::size_t> head_{0};
+		std::atomic<std::uint64_t> dropped_{0};
+		alignas(64) std::atomic<std::size_t> tail_{0};
+	};
+
+	template<class arg_t>
+	struct is_loggable : std::bool_constant<std::is_arithmetic_v<arg_t> || std::is_enum_v<arg_t> || std::is_pointer_v<arg_t> || std::is_null_pointer_v<arg_t>> {};
+
+	template<class value_t>
+	static void store_arg(record_t& record, std::size_t index, value_t const & value)
+	{
+		arg_t& arg = record.args_[index];
+		if constexpr (std::is_same_v<value_t, bool>) {
+			record.arg_types_[index] = arg_type::boolean;
+			arg.unsigned_int = value ? 1 : 0;
+		} else if constexpr (std::is_enum_v<value_t>) {
+			store_arg(record, index, static_cast<std::underlying_type_t<value_t>>(value));
+		} else if constexpr (std::is_floating_point_v<value_t>) {
+			record.arg_types_[index] = arg_type::floating;
+			arg.floating = static_cast<double>(value);
+		} else if constexpr (std::is_pointer_v<value_t> || std::is_null_pointer_v<value_t>) {
+			record.arg_types_[index] = arg_type::pointer;
+			arg.pointer = static_cast<const void*>(value);
+		} else if constexpr (std::is_signed_v<value_t>) {
+			record.arg_types_[index] = arg_type::signed_int;
+			arg.signed_int = static_cast<std::int64_t>(value);
+		} else {
+			record.arg_types_[index] = arg_type::unsigned_int;
+			arg.unsigned_int = static_cast<std::uint64_t>(value);
+		}
+	}
+
+	static std::size_t slot_count(std::size_t bytes)
+	{
+		std::size_t count = 16;
+		while(count*sizeof(record_t)<bytes) count <<= 1;
+		return count;
+	}
+
+	static std::uint64_t next_id()
+	{
+		static std::atomic<std::uint64_t> last{0};
+		return ++last;
+	}
+
+	// Each thread's buffers in the logs it has written to, keyed by log id
+	struct thread_buffers_t
+	{
+		std::uint64_t last_id = 0;
+		buffer_t* last = nullptr;
+		std::vector<std::pair<std::uint64_t, std::weak_ptr<buffer_t>>> buffers;
+
+		~thread_buffers_t()
+		{
+			for(auto const & entry : buffers) {
+				if(std::shared_ptr<buffer_t> buffer = entry.second.lock()) buffer->exited_.store(true, std::memory_order_release);
+			}
+		}
+	};
+
+	static thread_buffers_t& thread_buffers()
+	{
+		static thread_local thread_buffers_t buffers;
+		return buffers;
+	}
+
+	buffer_t& this_thread_buffer()
+	{
+		thread_buffers_t& buffers = thread_buffers();
+		if(buffers.last_id==id_) return *buffers.last;
+
+		// forget the buffers of logs that have been destroyed
+		std::erase_if(buffers.buffers, [](auto const & entry) { return entry.second.expired(); });
+
+		std::shared_ptr<buffer_t> buffer;
+		for(auto const & entry : buffers.buffers) {
+			if(entry.first==id_) buffer = entry.second.lock();
+		}
+
+		if(!buffer) {
+			buffer = std::make_shared<buffer_t>(slot_count_);
+			{
+				std::unique_lock<std::mutex> lock(buffers_lock_);
+				buffers_.push_back(buffer);
+			}
+			buffers.buffers.emplace_back(id_, buffer);
+		}
+
+		buffers.last_id = id_;
+		buffers.last = buffer.get();
+		return *buffer;
+	}
+
+	void drain(std::vector<trace_entry>& entries)
+	{
+		std::unique_lock<std::mutex> lock(buffers_lock_);
+
+		for(std::size_t i=0 ; i<buffers_.size() ; ) {
+			buffer_t& buffer = *buffers_[i];
+			// read before head_, so an exited thread's last record is drained below
+			bool exited = buffer.exited_.load(std::memory_order_acquire);
+			std::size_t tail = buffer.tail_.load(std::memory_order_relaxed);
+			std::size_t head = buffer.head_.load(std::memory_order_acquire);
+
+			while(tail!=head) {
+				record_t& record = buffer.slots_[tail & (slot_count_-1)];
+				entries.push_back(trace_entry{
+					std::chrono::steady_clock::time_point(std::chrono::steady_clock::duration(record.time_)),
+					record.level_, buffer.thread_, format(buffer, tail) });
+				tail += 1+record.extra_;
+			}
+			buffer.tail_.store(tail, std::memory_order_release);
+
+			// the tracing thread has exited and everything it wrote is out
+			if(exited) {
+				dropped_ += buffer.dropped_.load(std::memory_order_relaxed);
+				buffers_.erase(buffers_.begin()+i);
+			} else {
+				++i;
+			}
+		}
+	}
+
+	std::wstring format(buffer_t& buffer, std::size_t position) const
+	{
+		record_t& record = buffer.slots_[position & (slot_count_-1)];
+
+		if(!record.format_) {
+			std::wstring text(record.text_length_, L'\0');
+			for(std::size_t i=0 ; i<record.extra_ ; ++i) {
+				std::size_t offset = i*chars_per_slot;
+				std::size_t count = std::min<std::size_t>(chars_per_slot, record.text_length_-offset);
+				std::memcpy(&text[offset], &buffer.slots_[(position+1+i) & (slot_count_-1)], count*sizeof(wchar_t));
+			}
+			return text;
+		}
+
+		std::wostringstream text;
+		std::size_t next_arg = 0;
+		for(const wchar_t* c=record.format_->text() ; *c ; ++c) {
+			if(c[0]==L'{' && c[1]==L'}' && next_arg<record.arg_count_) {
+				write_arg(text, record.arg_types_[next_arg], record.args_[next_arg]);
+				++next_arg;
+				++c;
+			} else {
+				text << *c;
+			}
+		}
+		return text.str();
+	}
+
+	static void write_arg(std::wostringstream& text, arg_type type, arg_t const & arg)
+	{
+		switch(type) {
+		case arg_type::signed_int:		text << arg.signed_int; break;
+		case arg_type::unsigned_int:	text << arg.unsigned_int; break;
+		case arg_type::floating:		text << arg.floating; break;
+		case arg_type::pointer:			text << arg.pointer; break;
+		case arg_type::boolean:			text << (arg.unsigned_int ? L"true" : L"false"); break;
+		}
+	}
+
+	void run_flusher()
+	{
+		std::unique_lock<std::mutex> lock(stop_lock_);
+		while(!stop_) {
+			stop_event_.wait_for(lock, options_.flush_interval);
+
+			lock.unlock();
+			flush();
+			lock.lock();
+		}
+	}
+
+	const trace_log_options options_;
+	const std::uint64_t id_;
+	const std::size_t slot_count_;
+
+	mutable std::mutex buffers_lock_;
+	std::vector<std::shared_ptr<buffer_t>> buffers_;
+	std::uint64_t dropped_ = 0;
+
+	std::mutex flush_lock_;
+	mutable std::mutex history_lock_;
+	std::deque<trace_entry> history_;
+
+	std::mutex stop_lock_;
+	std::condition_variable stop_event_;
+	bool stop_ = false;
+	std::thread flusher_;
+};
+
+
+} // namespace dumbnose
+
+
+// Trace with a format string that is only formatted on the flushing thread
+#define DUMBNOSE_TRACE(log, level, format, ...) \
+	do { \
+		static const dumbnose::trace_format dumbnose_trace_format(format); \
+		(log).write(level, dumbnose_trace_format, ##__VA_ARGS__); \
+	} while(0)
@@ -0,0 +1,157 @@
+// async.cpp : task coroutines, the async.hpp awaitables and timer_queue
+//
+
+#include <dumbnose/task.hpp>
+#include <dumbnose/async.hpp>
+#include <dumbnose/timer_queue.hpp>
+#include <dumbnose/thread_pool.hpp>
+#include <dumbnose/work_stealing_pool.hpp>
+#include <dumbnose/event_source.hpp>
+#include <dumbnose/unit_tests/check.hpp>
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+
+dumbnose::task<int> identity(int value)
+{
+	co_return value;
+}
+
+dumbnose::task<long> sum_to(int count)
+{
+	long sum = 0;
+	for(int i=1 ; i<=count ; ++i) sum += co_await identity(i);
+	co_return sum;
+}
+
+dumbnose::task<std::string> failing()
+{
+	throw std::runtime_error("expected");
+	co_return std::string();
+}
+
+dumbnose::task<void> rethrowing()
+{
+	co_await failing();
+}
+
+void check_task()
+{
+	// nothing runs until the task is awaited
+	bool started = false;
+	auto lazy = [&]() -> dumbnose::task<void> { started = true; co_return; };
+	dumbnose::task<void> pending = lazy();
+	CHECK(pending.valid() && !started);
+	dumbnose::sync_wait(std::move(pending));
+	CHECK(started);
+
+	// a chain of tasks finishing synchronously; kept short enough for builds without tail calls
+	CHECK(dumbnose::sync_wait(sum_to(10000))==50005000L);
+
+	CHECK_THROWS(dumbnose::sync_wait(rethrowing()), std::runtime_error);
+
+	// detach() runs up to the first suspension on the calling thread
+	int reached = 0;
+	auto detached = [&]() -> dumbnose::task<void> { reached = co_await identity(7); };
+	dumbnose::detach(detached());
+	CHECK(reached==7);
+}
+
+void check_timer_queue()
+{
+	dumbnose::timer_queue timers;
+	std::mutex lock;
+	std::vector<int> order;
+	std::atomic<int> fired{0};
+	auto record = [&](int value) { return [&, value]{ { std::lock_guard<std::mutex> guard(lock); order.push_back(value); } ++fired; }; };
+
+	// earliest first, ties in the order they were scheduled
+	auto now = dumbnose::timer_queue::clock_t::now();
+	timers.schedule_at(now+std::chrono::milliseconds(30), record(3));
+	timers.schedule_at(now+std::chrono::milliseconds(10), record(1));
+	timers.schedule_at(now+std::chrono::milliseconds(20), record(2));
+	timers.schedule_at(now+std::chrono::milliseconds(20), record(22));
+	CHECK(timers.size()==4);
+	while(fired<4) std::this_thread::yield();
+	CHECK((order==std::vector<int>{ 1, 2, 22, 3 }));
+	CHECK(timers.size()==0);
+
+	// dropped when the queue goes away
+	{
+		dumbnose::timer_queue brief;
+		brief.schedule_after(std::chrono::hours(1), record(-1));
+	}
+	CHECK(fired==4);
+}
+
+template<class executor_t>
+dumbnose::task<std::thread::id> hop(executor_t& executor)
+{
+	co_await dumbnose::schedule_on(executor);
+	co_return std::this_thread::get_id();
+}
+
+template<class executor_t>
+dumbnose::task<std::chrono::steady_clock::duration> sleep(executor_t& executor, std::chrono::milliseconds duration)
+{
+	auto start = std::chrono::steady_clock::now();
+	co_await dumbnose::delay(executor, duration);
+	// a time already passed does not suspend
+	co_await dumbnose::resume_at(executor, start);
+	co_return std::chrono::steady_clock::now()-start;
+}
+
+dumbnose::task<std::pair<int, int>> next_values(dumbnose::event_source<int, int>& source, dumbnose::work_stealing_pool& pool)
+{
+	int first = co_await dumbnose::next_raise(source, pool);
+	int second = co_await dumbnose::next_raise(source, pool);
+	co_return std::make_pair(first, second);
+}
+
+void check_awaitables()
+{
+	dumbnose::thread_pool_options options;
+	options.thread_count = 2;
+	dumbnose::thread_pool<> pool(options);
+	dumbnose::work_stealing_pool stealing(2);
+
+	CHECK(dumbnose::sync_wait(hop(pool))!=std::this_thread::get_id());
+	CHECK(dumbnose::sync_wait(hop(stealing))!=std::this_thread::get_id());
+	CHECK(dumbnose::sync_wait(sleep(pool, std::chrono::milliseconds(20)))>=std::chrono::milliseconds(20));
+	CHECK(dumbnose::sync_wait(sleep(stealing, std::chrono::milliseconds(20)))>=std::chrono::milliseconds(20));
+
+	// each await sees one raise; raises while nobody is waiting are missed
+	dumbnose::event_source<int, int> source;
+	std::future<std::pair<int, int>> result = std::async(std::launch::async, [&]{ return dumbnose::sync_wait(next_values(source, stealing)); });
+	for(int value=1 ; result.wait_for(std::chrono::milliseconds(1))!=std::future_status::ready ; ++value) source.raise(0, value);
+	std::pair<int, int> seen = result.get();
+	CHECK(seen.first>=1 && seen.second>seen.first);
+
+	// thousands of coroutines in flight on two workers
+	std::atomic<int> finished{0};
+	auto waiting = [&]() -> dumbnose::task<void> {
+		co_await dumbnose::schedule_on(pool);
+		co_await dumbnose::delay(pool, std::chrono::milliseconds(5));
+		++finished;
+	};
+	for(int i=0 ; i<2000 ; ++i) dumbnose::detach(waiting());
+	while(finished<2000) std::this_thread::yield();
+	CHECK(finished==2000);
+}
+
+
+int main()
+{
+	check_task();
+	check_timer_queue();
+	check_awaitables();
+
+	return dumbnose::unit_tests::check_result();
+}
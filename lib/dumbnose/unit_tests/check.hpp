@@ -0,0 +1,49 @@
+#pragma once
+
+//
+//	check
+//
+//	Just enough of a test framework for the portable unit tests: CHECK()
+//	reports a failed condition and keeps going (unlike assert, it stays in
+//	release builds), and CHECK_THROWS() expects an exception type.  main()
+//	returns check_result() so ctest sees the failures.
+//
+
+#include <iostream>
+
+
+namespace dumbnose {
+namespace unit_tests {
+
+
+inline int& failures()
+{
+	static int count = 0;
+	return count;
+}
+
+inline void check_failed(const char* expression, const char* file, int line)
+{
+	std::cerr << file << "(" << line << "): CHECK failed: " << expression << "\n";
+	++failures();
+}
+
+inline int check_result()
+{
+	if(failures()) std::cerr << failures() << " check(s) failed\n";
+	return failures() ? 1 : 0;
+}
+
+
+}} // namespace dumbnose::unit_tests
+
+
+#define CHECK(condition) \
+	do { if(!(condition)) dumbnose::unit_tests::check_failed(#condition, __FILE__, __LINE__); } while(0)
+
+#define CHECK_THROWS(expression, exception_t) \
+	do { \
+		bool dumbnose_threw = false; \
+		try { expression; } catch(exception_t const &) { dumbnose_threw = true; } \
+		if(!dumbnose_threw) dumbnose::unit_tests::check_failed(#expression " throws " #exception_t, __FILE__, __LINE__); \
+	} while(0)
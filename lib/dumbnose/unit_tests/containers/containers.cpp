@@ -0,0 +1,184 @@
+// containers.cpp : safe_map, safe_list, mpmc_queue, job_queue, thread_pool and work_stealing_pool
+//
+
+#include <dumbnose/safe_map.hpp>
+#include <dumbnose/safe_list.hpp>
+#include <dumbnose/mpmc_queue.hpp>
+#include <dumbnose/job_queue.hpp>
+#include <dumbnose/thread_pool.hpp>
+#include <dumbnose/chase_lev_deque.hpp>
+#include <dumbnose/work_stealing_pool.hpp>
+#include <dumbnose/unit_tests/check.hpp>
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <memory>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+
+void check_safe_containers()
+{
+	typedef dumbnose::safe_map<int, int> map_t;
+	map_t map;
+	CHECK(map.insert(map_t::value_type(1, 10)).second);
+	CHECK(!map.insert(map_t::value_type(1, 11)).second);
+	CHECK(map.find(1)->second==10);
+	CHECK(map.erase(1)==1 && map.empty());
+
+	dumbnose::safe_list<int> list;
+	std::vector<std::thread> threads;
+	for(int i=0 ; i<4 ; ++i) threads.emplace_back([&]{ for(int j=0 ; j<1000 ; ++j) list.push_back(j); });
+	for(std::thread& thread : threads) thread.join();
+	CHECK(list.size()==4000);
+	list.remove_if([](int value){ return value>=500; });
+	CHECK(list.size()==2000);
+}
+
+void check_queues()
+{
+	dumbnose::mpmc_queue<std::unique_ptr<int>> queue(4);
+	CHECK(queue.capacity()==4);
+	for(int i=0 ; i<4 ; ++i) CHECK(queue.try_push(std::make_unique<int>(i)));
+	CHECK(!queue.try_push(std::make_unique<int>(4)));
+	std::unique_ptr<int> first;
+	CHECK(queue.try_pop(first) && *first==0);
+
+	dumbnose::job_queue<long> jobs(64);
+	std::atomic<long> sum{0};
+	std::vector<std::thread> threads;
+	for(int i=0 ; i<2 ; ++i) threads.emplace_back([&]{ for(long j=1 ; j<=10000 ; ++j) jobs.add_job(j); });
+	for(int i=0 ; i<2 ; ++i) threads.emplace_back([&]{ for(int j=0 ; j<10000 ; ++j) sum += jobs.get_job(); });
+	for(std::thread& thread : threads) thread.join();
+	CHECK(sum==2*50005000L);
+	CHECK(jobs.size()==0);
+}
+
+void check_thread_pool()
+{
+	dumbnose::thread_pool_options options;
+	options.thread_count = 3;
+	dumbnose::thread_pool<> pool(options);
+
+	std::vector<std::future<int>> results;
+	for(int i=0 ; i<100 ; ++i) results.push_back(pool.submit([i]{ return i*i; }));
+	long sum = 0;
+	for(std::future<int>& result : results) sum += result.get();
+	CHECK(sum==328350);
+
+	std::future<void> failed = pool.submit(dumbnose::work_priority::high, []{ throw std::runtime_error("expected"); });
+	CHECK_THROWS(failed.get(), std::runtime_error);
+
+	pool.shutdown(dumbnose::shutdown_mode::drain);
+	CHECK(pool.statistics(dumbnose::work_priority::normal).dequeued==100);
+	CHECK_THROWS(pool.submit([]{}), std::logic_error);
+	CHECK(pool.thread_count()==0);
+
+	// shut down from one of its own workers while another thread does the same
+	dumbnose::thread_pool<> stopping(options);
+	std::future<void> stopped = stopping.submit([&stopping]{ stopping.shutdown(dumbnose::shutdown_mode::drain); });
+	std::thread other([&stopping]{ stopping.shutdown(dumbnose::shutdown_mode::drain); });
+	stopped.get();
+	other.join();
+	// at most the worker that called shutdown is left, for the destructor to join
+	CHECK(stopping.thread_count()<=1);
+}
+
+void check_lanes()
+{
+	typedef dumbnose::thread_pool<int> pool_t;
+	pool_t queue;
+	auto now = std::chrono::steady_clock::now();
+
+	// a distant deadline waits behind high priority work, a due one does not
+	queue.add_work_item(pool_t::work_item_ptr(new int(1)), now+std::chrono::hours(1));
+	queue.add_work_item(pool_t::work_item_ptr(new int(2)), dumbnose::work_priority::high);
+	queue.add_work_item(pool_t::work_item_ptr(new int(3)), dumbnose::work_priority::normal);
+	queue.add_work_item(pool_t::work_item_ptr(new int(4)), now);
+	CHECK(*queue.get_work_item()==4);
+	CHECK(*queue.get_work_item()==2);
+	CHECK(*queue.get_work_item()==1);
+	CHECK(*queue.get_work_item()==3);
+}
+
+void check_chase_lev_deque()
+{
+	// the owner takes the newest, thieves the oldest; a small deque grows
+	dumbnose::chase_lev_deque<int> deque(2);
+	for(int i=0 ; i<10 ; ++i) deque.push(i);
+	CHECK(deque.size()==10);
+	int value = -1;
+	CHECK(deque.pop(value) && value==9);
+	CHECK(deque.steal(value) && value==0);
+	while(deque.pop(value)) {}
+	CHECK(deque.empty() && !deque.steal(value));
+
+	// every element is taken exactly once while thieves race the owner
+	const int count = 100000;
+	dumbnose::chase_lev_deque<int> shared(16);
+	std::vector<std::atomic<int>> taken(count);
+	std::atomic<bool> done{false};
+	std::vector<std::thread> thieves;
+	for(int i=0 ; i<3 ; ++i) thieves.emplace_back([&]{
+		int stolen;
+		while(!done) if(shared.steal(stolen)) ++taken[stolen];
+	});
+	for(int i=0 ; i<count ; ++i) {
+		shared.push(i);
+		if(i%3==0 && shared.pop(value)) ++taken[value];
+	}
+	while(shared.pop(value)) ++taken[value];
+	done = true;
+	for(std::thread& thief : thieves) thief.join();
+	int once = 0;
+	for(std::atomic<int>& times : taken) once += times==1;
+	CHECK(once==count);
+}
+
+void check_work_stealing_pool()
+{
+	std::atomic<long> sum{0};
+	{
+		dumbnose::work_stealing_pool pool(4);
+		CHECK(pool.thread_count()==4 && !pool.on_worker_thread());
+
+		// work submitted from outside, and from workers onto their own deques
+		for(long i=1 ; i<=1000 ; ++i) pool.submit([&pool, &sum, i]{
+			CHECK(pool.on_worker_thread());
+			pool.submit([&sum, i]{ sum += i; });
+		});
+		pool.wait_idle();
+		CHECK(sum==500500);
+
+		std::vector<std::atomic<int>> visits(10000);
+		pool.parallel_for(0, 10000, [&](int i){ ++visits[i]; }, 16);
+		int once = 0;
+		for(std::atomic<int>& times : visits) once += times==1;
+		CHECK(once==10000);
+
+		// nested in a task, and failing
+		std::atomic<long> nested{0};
+		pool.submit([&]{ pool.parallel_for(0, 100, [&](int i){ nested += i; }); });
+		pool.wait_idle();
+		CHECK(nested==4950);
+		CHECK_THROWS(pool.parallel_for(0, 100, [](int i){ if(i==42) throw std::runtime_error("expected"); }), std::runtime_error);
+
+		// the destructor runs what is still queued
+		for(int i=0 ; i<1000 ; ++i) pool.submit([&sum]{ ++sum; });
+	}
+	CHECK(sum==501500);
+}
+
+
+int main()
+{
+	check_safe_containers();
+	check_queues();
+	check_thread_pool();
+	check_lanes();
+	check_chase_lev_deque();
+	check_work_stealing_pool();
+
+	return dumbnose::unit_tests::check_result();
+}
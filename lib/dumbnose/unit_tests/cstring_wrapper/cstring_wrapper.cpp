@@ -22,7 +22,8 @@ int wmain(int argc, wchar_t* argv[])
 		std::cout << "String: " << str << std::endl;
 
 		wchar_t test_string[] = L"I am long enough to work";
-		dumbnose::fixed_wstring test(L"I am long enough to work", dumbnose::fixed_allocator<wchar_t>(test_string, ARRAY_SIZE(test_string)));
+		dumbnose::monotonic_buffer test_buffer(test_string, sizeof(test_string), std::pmr::null_memory_resource());
+		dumbnose::fixed_wstring test(L"I am long enough to work", dumbnose::fixed_allocator<wchar_t>(test_buffer));
 		test += L"bar";
 
 		std::wcout << L"Test: " << test << std::endl;
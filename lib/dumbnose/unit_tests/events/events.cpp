@@ -0,0 +1,238 @@
+// events.cpp : event_source, inplace_event_source and queued_event_source
+//
+
+#include <dumbnose/event_source.hpp>
+#include <dumbnose/inplace_event_source.hpp>
+#include <dumbnose/queued_event_source.hpp>
+#include <dumbnose/unit_tests/check.hpp>
+#include <atomic>
+#include <memory>
+#include <new>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+
+void check_event_source()
+{
+	typedef dumbnose::event_source<int, int> source_t;
+	source_t source;
+	std::atomic<long> sum{0};
+
+	source_t::cookie_t added = source.register_listener([&](int, int value){ sum += value; });
+	source_t::cookie_t* self = nullptr;
+	source_t::cookie_t once = source.register_listener([&](int, int){ sum += 1000; self->unregister_early(); });
+	self = &once;
+
+	source.raise(0, 1);
+	source.raise(0, 1);
+	CHECK(sum==1002);
+
+	// a listener registering another: the raise in progress keeps its list, the next one sees the new listener
+	std::optional<source_t::cookie_t> later;
+	source_t::cookie_t adder = source.register_listener([&](int, int value){
+		if(value!=2) return;
+		source_t::cookie_t added = source.register_listener([&](int, int){ sum += 10000; });
+		later.emplace(added);
+	});
+	source.raise(0, 2);
+	CHECK(sum==1004);
+	adder.unregister_early();
+	source.raise(0, 0);
+	CHECK(sum==11004);
+	later.reset();
+
+	// listeners coming and going while other threads raise
+	std::atomic<bool> stop{false};
+	std::thread churn([&]{ while(!stop) { source_t::cookie_t cookie = source.register_listener([](int, int){}); } });
+	std::vector<std::thread> raisers;
+	for(int i=0 ; i<4 ; ++i) raisers.emplace_back([&]{ for(int j=0 ; j<5000 ; ++j) source.raise(0, 1); });
+	for(std::thread& raiser : raisers) raiser.join();
+	stop = true;
+	churn.join();
+	CHECK(sum==11004+20000);
+}
+
+struct payload { std::string text; };
+
+void check_inplace_event_source()
+{
+	dumbnose::inplace_function<int(int), 16> triple = [factor=3](int value){ return value*factor; };
+	CHECK(triple(2)==6);
+	dumbnose::inplace_function<int(int), 16> moved = std::move(triple);
+	CHECK(!triple && moved(1)==3);
+
+	typedef dumbnose::inplace_event_source<int, payload const &, 4> source_t;
+	source_t source;
+	payload argument{"x"};
+	std::atomic<long> calls{0};
+
+	// arguments are passed on by reference, never copied
+	source_t::cookie_t same = source.register_listener([&](int, payload const & seen){ CHECK(&seen==&argument); ++calls; });
+	source_t::cookie_t* self = nullptr;
+	source_t::cookie_t once = source.register_listener([&](int, payload const &){ calls += 100; self->unregister_early(); });
+	self = &once;
+
+	source.raise(0, argument);
+	source.raise(0, argument);
+	CHECK(calls==102);
+
+	{
+		// the retired slot is recycled, so all four fit
+		source_t::cookie_t third = source.register_listener([](int, payload const &){});
+		source_t::cookie_t fourth = source.register_listener([](int, payload const &){});
+		source_t::cookie_t fifth = source.register_listener([](int, payload const &){});
+		CHECK_THROWS(source_t::cookie_t sixth = source.register_listener([](int, payload const &){}), std::length_error);
+	}
+
+	// a stale cookie is ignored
+	source.unregister_listener(0x0000000700000002ull);
+	source.raise(0, argument);
+	CHECK(calls==103);
+
+	// a listener of one source may recycle the slots of another of the same type
+	source_t other;
+	{
+		source_t::cookie_t first = other.register_listener([](int, payload const &){});
+		source_t::cookie_t second = other.register_listener([](int, payload const &){});
+		source_t::cookie_t third = other.register_listener([](int, payload const &){});
+		source_t::cookie_t fourth = other.register_listener([](int, payload const &){});
+	}
+	bool registered = false;
+	source_t::cookie_t nested = source.register_listener([&](int, payload const &){
+		if(registered) return;
+		source_t::cookie_t inner = other.register_listener([](int, payload const &){});
+		registered = true;
+	});
+	source.raise(0, argument);
+	CHECK(registered);
+}
+
+void check_queued_event_source()
+{
+	{
+		dumbnose::queued_event_source<int, std::wstring const &> source;
+		std::atomic<long> delivered{0};
+		std::wstring last;
+		auto cookie = source.register_listener([&](int, std::wstring const & text){ last = text; ++delivered; });
+		for(int i=0 ; i<1000 ; ++i) source.raise(0, std::to_wstring(i));
+		while(delivered<1000) std::this_thread::yield();
+		CHECK(last==L"999");
+	}
+
+	{
+		dumbnose::queued_dispatch_options options;
+		options.capacity = 16;
+		options.overflow = dumbnose::queue_overflow::drop_oldest;
+		dumbnose::queued_event_source<int, int> source(options);
+
+		std::atomic<long> delivered{0};
+		std::atomic<int> last{-1};
+		auto cookie = source.register_listener([&](int, int value){
+			CHECK(value>last);
+			last = value;
+			++delivered;
+			std::this_thread::sleep_for(std::chrono::microseconds(50));
+		});
+		for(int i=0 ; i<2000 ; ++i) source.raise(0, i);
+		while(delivered+static_cast<long>(source.dropped())<2000) std::this_thread::yield();
+		CHECK(last==1999);
+	}
+
+	{
+		// the first event holds the dispatcher until everything else is queued
+		dumbnose::queued_dispatch_options options;
+		options.coalesce = true;
+		dumbnose::queued_event_source<int, int> source(options, [](int sender, int){ return static_cast<std::size_t>(sender); });
+
+		std::atomic<bool> queued{false};
+		std::atomic<long> delivered{0};
+		int latest[4] = { -1, -1, -1, -1 };
+		auto cookie = source.register_listener([&](int sender, int value){
+			while(!queued) std::this_thread::yield();
+			CHECK(value>latest[sender]);
+			latest[sender] = value;
+			++delivered;
+		});
+		source.raise(0, -1);
+		for(int i=0 ; i<40 ; ++i) source.raise(i%4, i);
+		queued = true;
+		while(delivered+static_cast<long>(source.coalesced())<41) std::this_thread::yield();
+		// every sender's newest event got through
+		for(int sender=0 ; sender<4 ; ++sender) CHECK(latest[sender]==36+sender);
+		CHECK(source.coalesced()>0);
+	}
+
+	{
+		// a listener raising into its own full queue
+		dumbnose::queued_dispatch_options options;
+		options.capacity = 4;
+		dumbnose::queued_event_source<int, int> source(options);
+
+		std::atomic<long> delivered{0};
+		auto cookie = source.register_listener([&](int, int value){
+			if(value==0) for(int i=1 ; i<=20 ; ++i) source.raise(0, i);
+			++delivered;
+		});
+		source.raise(0, 0);
+		while(delivered<21) std::this_thread::yield();
+		CHECK(delivered==21);
+	}
+
+	typedef dumbnose::queued_event_source<int, int> queued_t;
+
+	{
+		// listeners raising while the source is destroyed, with room for all of it
+		std::atomic<long> delivered{0};
+		{
+			// the cookie is never destroyed, so the listener stays registered while the source is torn down
+			alignas(queued_t::cookie_t) unsigned char cookie[sizeof(queued_t::cookie_t)];
+			queued_t source;
+			new(cookie) queued_t::cookie_t(source.register_listener([&](int, int value){
+				if(value==0) {
+					std::this_thread::sleep_for(std::chrono::milliseconds(20));
+					for(int i=1 ; i<=5 ; ++i) source.raise(0, i);
+				}
+				++delivered;
+			}));
+			source.raise(0, 0);
+		}
+		CHECK(delivered==6);
+	}
+
+	{
+		// and overflowing a drop_oldest queue meanwhile
+		std::atomic<long> delivered{0};
+		std::uint64_t dropped = 0;
+		{
+			dumbnose::queued_dispatch_options options;
+			options.capacity = 4;
+			options.overflow = dumbnose::queue_overflow::drop_oldest;
+			alignas(queued_t::cookie_t) unsigned char cookie[sizeof(queued_t::cookie_t)];
+			queued_t source(options);
+			new(cookie) queued_t::cookie_t(source.register_listener([&](int, int value){
+				if(value==0) {
+					std::this_thread::sleep_for(std::chrono::milliseconds(20));
+					for(int i=1 ; i<=8 ; ++i) source.raise(0, i);
+					dropped = source.dropped();
+				}
+				++delivered;
+			}));
+			source.raise(0, 0);
+		}
+		CHECK(dropped>0);
+		CHECK(delivered+static_cast<long>(dropped)==9);
+	}
+}
+
+
+int main()
+{
+	check_event_source();
+	check_inplace_event_source();
+	check_queued_event_source();
+
+	return dumbnose::unit_tests::check_result();
+}
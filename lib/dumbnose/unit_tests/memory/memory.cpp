@@ -0,0 +1,230 @@
+// memory.cpp : monotonic_buffer, arena, pool_allocator and memory_tracking
+//
+
+#include <dumbnose/memory.hpp>
+#include <dumbnose/fixed_string.hpp>
+#include <dumbnose/pool_allocator.hpp>
+#include <dumbnose/memory_tracking.hpp>
+#include <dumbnose/safe_list.hpp>
+#include <dumbnose/safe_map.hpp>
+#include <dumbnose/unit_tests/check.hpp>
+#include <cstdint>
+#include <list>
+#include <map>
+#include <memory>
+#include <memory_resource>
+#include <mutex>
+#include <new>
+#include <string>
+#include <thread>
+#include <vector>
+
+
+// Counts what reaches the heap
+class counting_resource : public std::pmr::memory_resource
+{
+public:
+	std::size_t allocations = 0;
+	std::size_t outstanding = 0;
+
+private:
+	void* do_allocate(std::size_t bytes, std::size_t alignment) override
+	{
+		++allocations;
+		outstanding += bytes;
+		return std::pmr::new_delete_resource()->allocate(bytes, alignment);
+	}
+
+	void do_deallocate(void* memory, std::size_t bytes, std::size_t alignment) override
+	{
+		outstanding -= bytes;
+		std::pmr::new_delete_resource()->deallocate(memory, bytes, alignment);
+	}
+
+	bool do_is_equal(std::pmr::memory_resource const & other) const noexcept override { return this==&other; }
+};
+
+
+void check_monotonic_buffer()
+{
+	counting_resource heap;
+	alignas(std::max_align_t) char storage[256];
+	{
+		dumbnose::monotonic_buffer buffer(storage, sizeof(storage), &heap);
+
+		void* first = buffer.allocate(10, 1);
+		CHECK(first==storage);
+		void* aligned = buffer.allocate(8, 8);
+		CHECK(reinterpret_cast<std::uintptr_t>(aligned)%8==0);
+
+		// the most recent allocation is given back
+		buffer.deallocate(aligned, 8, 8);
+		CHECK(buffer.allocate(8, 8)==aligned);
+
+		// past the caller's buffer, chunks come from upstream
+		buffer.allocate(1000, 16);
+		CHECK(heap.allocations==1);
+		CHECK(buffer.upstream_bytes()>=1000);
+	}
+	CHECK(heap.outstanding==0);
+
+	dumbnose::monotonic_buffer fixed(storage, sizeof(storage), std::pmr::null_memory_resource());
+	CHECK_THROWS(fixed.allocate(512), std::bad_alloc);
+}
+
+void check_node_containers()
+{
+	counting_resource heap;
+	dumbnose::monotonic_buffer buffer(4096, &heap);
+
+	typedef dumbnose::arena_allocator<std::pair<const int, int>> map_allocator_t;
+	std::map<int, int, std::less<int>, map_allocator_t> map{map_allocator_t(buffer)};
+	std::list<int, dumbnose::arena_allocator<int>> list{dumbnose::arena_allocator<int>(buffer)};
+	for(int i=0 ; i<1000 ; ++i) {
+		map[i] = i;
+		list.push_back(i);
+	}
+
+	long sum = 0;
+	for(auto const & entry : map) sum += entry.second;
+	for(int value : list) sum += value;
+	CHECK(sum==2*499500);
+	CHECK(map.get_allocator()==dumbnose::arena_allocator<int>(buffer));
+	// chunks double, so a few dozen kilobytes take a handful of upstream calls
+	CHECK(heap.allocations<10);
+}
+
+void check_arena()
+{
+	counting_resource heap;
+	dumbnose::arena scratch(256, &heap);
+
+	for(int round=0 ; round<10 ; ++round) {
+		std::vector<int, dumbnose::arena_allocator<int, dumbnose::arena>> values{dumbnose::arena_allocator<int, dumbnose::arena>(scratch)};
+		for(int i=0 ; i<10000 ; ++i) values.push_back(i);
+		CHECK(values.back()==9999);
+		values = decltype(values)(dumbnose::arena_allocator<int, dumbnose::arena>(scratch));
+		scratch.reset();
+	}
+
+	// the first round spread over several chunks; after that one chunk held everything
+	std::size_t after_first = heap.allocations;
+	std::vector<int, dumbnose::arena_allocator<int, dumbnose::arena>> values{dumbnose::arena_allocator<int, dumbnose::arena>(scratch)};
+	for(int i=0 ; i<10000 ; ++i) values.push_back(i);
+	CHECK(heap.allocations==after_first);
+}
+
+void check_fixed_string()
+{
+	FIXED_STRING(greeting, "a string long enough to leave the small string buffer");
+	CHECK(greeting=="a string long enough to leave the small string buffer");
+	CHECK(reinterpret_cast<const char*>(greeting.data())==greeting_array);
+	FIXED_WSTRING(wide, L"a wide string long enough to leave the small string buffer");
+	CHECK(wide==L"a wide string long enough to leave the small string buffer");
+
+	// growing past the buffer throws rather than overrunning it
+	char storage[64];
+	dumbnose::monotonic_buffer buffer(storage, sizeof(storage), std::pmr::null_memory_resource());
+	dumbnose::fixed_string text("a string long enough to leave the small string buffer", dumbnose::fixed_allocator<char>(buffer));
+	CHECK_THROWS(text += " and then some more", std::bad_alloc);
+	CHECK(text=="a string long enough to leave the small string buffer");
+}
+
+void check_pool_allocator()
+{
+	// a freed node is the next one handed out on the same thread
+	dumbnose::pool_allocator<long> allocator;
+	long* node = allocator.allocate(1);
+	allocator.deallocate(node, 1);
+	CHECK(allocator.allocate(1)==node);
+	allocator.deallocate(node, 1);
+
+	// nodes allocated by producers are freed by consumers and flow back through the central pool
+	dumbnose::safe_list<long, dumbnose::pool_allocator<long>> list;
+	std::vector<std::thread> threads;
+	for(int i=0 ; i<2 ; ++i) threads.emplace_back([&]{ for(long j=1 ; j<=20000 ; ++j) list.push_back(j); });
+	for(int i=0 ; i<2 ; ++i) threads.emplace_back([&]{
+		for(int taken=0 ; taken<20000 ; ) {
+			if(!list.empty()) {
+				list.pop_front();
+				++taken;
+			}
+		}
+	});
+	for(std::thread& thread : threads) thread.join();
+	CHECK(list.empty());
+
+	typedef dumbnose::safe_map<int, std::string, std::less<int>, dumbnose::pool_allocator<std::pair<const int, std::string>>> map_t;
+	map_t map;
+	for(int round=0 ; round<10 ; ++round) {
+		for(int i=0 ; i<1000 ; ++i) map.insert(map_t::value_type(i, "value"));
+		map.clear();
+	}
+	std::size_t reserved = dumbnose::pool_reserved_bytes();
+	for(int i=0 ; i<1000 ; ++i) map.insert(map_t::value_type(i, "value"));
+	CHECK(dumbnose::pool_reserved_bytes()==reserved);
+
+	// short-lived threads that only free keep nothing once they exit
+	std::vector<long*> nodes(100);
+	for(int round=0 ; round<200 ; ++round) {
+		if(round==10) reserved = dumbnose::pool_reserved_bytes();
+		for(long*& node : nodes) node = allocator.allocate(1);
+		std::thread([&]{ for(long* node : nodes) allocator.deallocate(node, 1); }).join();
+	}
+	CHECK(dumbnose::pool_reserved_bytes()==reserved);
+
+	// too large to pool
+	std::vector<long, dumbnose::pool_allocator<long>> values(10000, 1);
+	CHECK(values.size()==10000);
+}
+
+struct tracked_node : dumbnose::memory_tracking<tracked_node>
+{
+	char payload[200];
+};
+
+void check_memory_tracking()
+{
+	dumbnose::set_memory_sampling_interval(4096);
+
+	std::vector<std::unique_ptr<tracked_node>> nodes;
+	std::vector<std::thread> threads;
+	std::mutex lock;
+	for(int i=0 ; i<2 ; ++i) threads.emplace_back([&]{
+		for(int j=0 ; j<10000 ; ++j) {
+			std::unique_ptr<tracked_node> node(new tracked_node);
+			if(j%2) {
+				std::lock_guard<std::mutex> guard(lock);
+				nodes.push_back(std::move(node));
+			}
+		}
+	});
+	for(std::thread& thread : threads) thread.join();
+
+	CHECK(tracked_node::live_objects()==10000);
+	CHECK(tracked_node::live_bytes()==10000*sizeof(tracked_node));
+
+	// two million bytes at one sample per 4KB: the estimate is well within a quarter
+	dumbnose::memory_profile profile = dumbnose::take_memory_profile();
+	std::uint64_t estimated = 0;
+	for(dumbnose::memory_profile::site_usage const & site : profile.sites) estimated += site.estimated_bytes;
+	CHECK(estimated>tracked_node::live_bytes()*3/4 && estimated<tracked_node::live_bytes()*5/4);
+
+	nodes.clear();
+	CHECK(tracked_node::live_bytes()==0);
+	CHECK(dumbnose::take_memory_profile().sites.empty());
+	dumbnose::set_memory_sampling_interval(dumbnose::aux::memory_tracker::default_interval);
+}
+
+
+int main()
+{
+	check_monotonic_buffer();
+	check_node_containers();
+	check_arena();
+	check_fixed_string();
+	check_pool_allocator();
+	check_memory_tracking();
+
+	return dumbnose::unit_tests::check_result();
+}
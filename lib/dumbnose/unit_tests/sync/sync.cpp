@@ -0,0 +1,301 @@
+// sync.cpp : the lock, semaphore, event and barrier types, and waiter
+//
+
+#include <dumbnose/critical_section.hpp>
+#include <dumbnose/mutex.hpp>
+#include <dumbnose/semaphore.hpp>
+#include <dumbnose/event.hpp>
+#include <dumbnose/rw_lock.hpp>
+#include <dumbnose/barrier.hpp>
+#include <dumbnose/thread_barrier.hpp>
+#include <dumbnose/lock.hpp>
+#include <dumbnose/unit_tests/check.hpp>
+#include <atomic>
+#include <chrono>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <vector>
+#if defined(_WIN32) || defined(__linux__)
+#include <dumbnose/waiter.hpp>
+#include <dumbnose/waitable_timer.hpp>
+#endif
+#if defined(__linux__)
+#include <dumbnose/aux_/shared_object.hpp>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+using namespace std::chrono;
+
+
+template<class lock_t>
+void check_exclusion(lock_t& lock)
+{
+	long counter = 0;
+	std::vector<std::thread> threads;
+	for(int i=0 ; i<4 ; ++i) {
+		threads.emplace_back([&]{
+			for(int j=0 ; j<20000 ; ++j) {
+				HOLD_LOCK(lock);
+				++counter;
+			}
+		});
+	}
+	for(std::thread& thread : threads) thread.join();
+	CHECK(counter==80000);
+}
+
+// lock is held by the caller for the duration
+template<class lock_t>
+void check_try_acquire(lock_t& lock)
+{
+	CHECK(lock.try_acquire());
+
+	std::thread other([&]{
+		CHECK(!lock.try_acquire());
+		steady_clock::time_point start = steady_clock::now();
+		CHECK(!lock.try_acquire_for(milliseconds(20)));
+		CHECK(steady_clock::now()-start>=milliseconds(20));
+		CHECK(!lock.try_acquire_until(system_clock::now()+milliseconds(5)));
+
+		auto held = dumbnose::try_hold_lock(lock);
+		CHECK(!held.owns_lock());
+
+		auto waited = dumbnose::try_hold_lock_for(lock, seconds(10));
+		CHECK(waited.owns_lock());
+	});
+
+	std::this_thread::sleep_for(milliseconds(50));
+	lock.release();
+	other.join();
+}
+
+// Nobody leaves a phase before everyone has arrived, and exactly one thread is told it was last
+void check_tree_barrier(unsigned int thread_count, unsigned int fan_in, unsigned int spin_count)
+{
+	dumbnose::tree_barrier barrier(thread_count, fan_in, spin_count);
+	CHECK(barrier.thread_count()==thread_count);
+
+	const int rounds = 50;
+	std::atomic<int> arrived{0}, serial{0};
+	std::vector<std::thread> threads;
+	for(unsigned int index=0 ; index<thread_count ; ++index) {
+		threads.emplace_back([&, index]{
+			for(int round=0 ; round<rounds ; ++round) {
+				++arrived;
+				if(barrier.wait(index)) ++serial;
+				CHECK(arrived>=static_cast<int>(thread_count)*(round+1));
+				barrier.wait(index);
+			}
+		});
+	}
+	for(std::thread& thread : threads) thread.join();
+	CHECK(serial==rounds);
+}
+
+#if defined(_WIN32) || defined(__linux__)
+void check_waiter()
+{
+	dumbnose::event first(false, false), second(false, false);
+	dumbnose::semaphore third(0, 4);
+
+	// the object signaled later is the one taken
+	std::thread setter([&]{ std::this_thread::sleep_for(milliseconds(20)); second.set(); });
+	CHECK(dumbnose::waiter::wait_any(first, second, third)==2);
+	setter.join();
+	CHECK_THROWS(second.wait(10), std::system_error);
+
+	// already signaled, and taking consumes it
+	third.release();
+	CHECK(dumbnose::waiter::wait_any(first, second, third)==3);
+	CHECK(!third.try_acquire());
+
+	dumbnose::waitable_timer timer;
+	steady_clock::time_point start = steady_clock::now();
+	timer.set(milliseconds(20));
+	CHECK(dumbnose::waiter::wait_any(first, timer)==2);
+	CHECK(steady_clock::now()-start>=milliseconds(20));
+
+	// a registered wait runs once per signal and takes the object
+	std::atomic<int> fired{0};
+	dumbnose::waiter::register_wait(first, [&]{ ++fired; });
+	std::this_thread::sleep_for(milliseconds(20));
+	CHECK(fired==0);
+	first.set();
+	while(fired<1) std::this_thread::yield();
+	CHECK_THROWS(first.wait(10), std::system_error);
+
+	for(int i=0 ; i<3 ; ++i) dumbnose::waiter::register_wait(third, [&]{ ++fired; });
+	for(int i=0 ; i<3 ; ++i) third.release();
+	while(fired<4) std::this_thread::yield();
+	std::this_thread::sleep_for(milliseconds(20));
+	CHECK(fired==4 && !third.try_acquire());
+}
+#endif
+
+#if defined(__linux__)
+// Fails on request: throws, or dies half way through construction
+struct fragile
+{
+	enum failure { none, throws, dies };
+
+	explicit fragile(failure how)
+	{
+		if(how==throws) throw std::runtime_error("expected");
+		if(how==dies) _exit(0);
+	}
+
+	int value = 42;
+};
+
+// Three processes meet at a named thread_barrier; nobody leaves a round before everyone has arrived
+void check_shared_barrier(std::wstring const & name)
+{
+	const int processes = 3, rounds = 50;
+	std::wstring counter_name = name + L"_arrived";
+	typedef dumbnose::aux::shared_object<std::atomic<int>> counter_t;
+
+	auto meet = [&]() -> bool {
+		dumbnose::thread_barrier barrier(processes, name);
+		counter_t counter(counter_name, 0);
+		std::atomic<int>& arrived = counter.get();
+		bool in_step = true;
+		for(int round=0 ; round<rounds ; ++round) {
+			++arrived;
+			barrier.wait();
+			in_step = in_step && arrived>=processes*(round+1);
+			barrier.wait();
+		}
+		return in_step;
+	};
+
+	std::vector<pid_t> children;
+	for(int i=1 ; i<processes ; ++i) {
+		pid_t child = fork();
+		if(child==0) _exit(meet() ? 0 : 1);
+		children.push_back(child);
+	}
+	CHECK(meet());
+	for(pid_t child : children) {
+		int status = -1;
+		waitpid(child, &status, 0);
+		CHECK(WIFEXITED(status) && WEXITSTATUS(status)==0);
+	}
+	CHECK(counter_t(counter_name, 0).get()==processes*rounds);
+
+	CHECK(dumbnose::thread_barrier::remove(name));
+	CHECK(counter_t::remove(counter_name));
+}
+
+void check_named_objects()
+{
+	std::wstring name = L"dumbnose_sync_test_" + std::to_wstring(getpid());
+
+	{
+		dumbnose::semaphore first(2, 2, name), second(0, 2, name);
+		CHECK(second.try_acquire());
+	}
+	// the count outlived both, until the name is removed
+	CHECK(dumbnose::semaphore(0, 2, name).try_acquire());
+	CHECK(dumbnose::semaphore::remove(name));
+	CHECK(!dumbnose::semaphore(0, 2, name).try_acquire());
+	CHECK(dumbnose::semaphore::remove(name));
+
+	typedef dumbnose::aux::shared_object<fragile> shared_t;
+	CHECK_THROWS(shared_t(name, fragile::throws), std::runtime_error);
+	CHECK(shared_t(name, fragile::none).get().value==42);
+	shared_t::remove(name);
+
+	pid_t child = fork();
+	if(child==0) shared_t(name, fragile::dies);
+	waitpid(child, nullptr, 0);
+	CHECK(shared_t(name, fragile::none).get().value==42);
+	shared_t::remove(name);
+
+	check_shared_barrier(name);
+}
+#endif
+
+
+int main()
+{
+	dumbnose::critical_section section;
+	check_exclusion(section);
+	check_try_acquire(section);
+
+	dumbnose::mutex mutex;
+	check_exclusion(mutex);
+	check_try_acquire(mutex);
+
+	mutex.acquire();
+	std::thread([&]{ CHECK_THROWS(mutex.acquire(10), std::system_error); }).join();
+	mutex.release();
+
+	dumbnose::rw_lock rw;
+	check_exclusion(rw);
+	{
+		HOLD_SHARED_LOCK(rw);
+		HOLD_SHARED_LOCK(rw);
+	}
+
+	dumbnose::semaphore semaphore(0, 4);
+	std::atomic<int> taken{0};
+	{
+		std::vector<std::thread> takers;
+		for(int i=0 ; i<4 ; ++i) takers.emplace_back([&]{ for(int j=0 ; j<1000 ; ++j) { semaphore.acquire(); ++taken; } });
+		// releases past the maximum are ignored, so keep releasing until everything is taken
+		while(taken<4000) {
+			semaphore.release();
+			std::this_thread::yield();
+		}
+		for(std::thread& taker : takers) taker.join();
+	}
+	CHECK(taken==4000);
+
+	dumbnose::event manual(true, false);
+	std::atomic<int> woken{0};
+	{
+		std::vector<std::thread> waiters;
+		for(int i=0 ; i<3 ; ++i) waiters.emplace_back([&]{ manual.wait(); ++woken; });
+		manual.set();
+		for(std::thread& waiter : waiters) waiter.join();
+	}
+	CHECK(woken==3);
+
+	dumbnose::event automatic(false, false);
+	CHECK_THROWS(automatic.wait(10), std::system_error);
+
+	dumbnose::sense_barrier barrier(3);
+	std::atomic<int> arrived{0}, serial{0};
+	{
+		std::vector<std::thread> threads;
+		for(int i=0 ; i<3 ; ++i) {
+			threads.emplace_back([&]{
+				for(int round=0 ; round<100 ; ++round) {
+					++arrived;
+					if(barrier.wait()) ++serial;
+					CHECK(arrived>=3*(round+1));
+					barrier.wait();
+				}
+			});
+		}
+		for(std::thread& thread : threads) thread.join();
+	}
+	CHECK(serial==100);
+
+	check_tree_barrier(1, 4, 0);
+	check_tree_barrier(5, 4, 0);
+	check_tree_barrier(17, 2, 0);
+	check_tree_barrier(16, 4, dumbnose::aux::spin_wait::default_spin_count);
+
+#if defined(_WIN32) || defined(__linux__)
+	check_waiter();
+#endif
+#if defined(__linux__)
+	check_named_objects();
+#endif
+
+	return dumbnose::unit_tests::check_result();
+}
@@ -0,0 +1,195 @@
+// telemetry.cpp : metrics, timing probes, trace_log and error throttling
+//
+
+#include <dumbnose/metrics.hpp>
+#include <dumbnose/timing_probe.hpp>
+#include <dumbnose/status_notifier.hpp>
+#include <dumbnose/trace_log.hpp>
+#include <dumbnose/job_queue.hpp>
+#include <dumbnose/unit_tests/check.hpp>
+#include <atomic>
+#include <sstream>
+#include <string>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+
+void check_histogram()
+{
+	typedef dumbnose::histogram histogram;
+
+	for(std::size_t i=0 ; i+1<histogram::bucket_count ; ++i) CHECK(histogram::highest_in(i)+1==histogram::lowest_in(i+1));
+	for(std::uint64_t value : { 0ull, 31ull, 32ull, 1000ull, 123456789ull, ~0ull }) {
+		std::size_t index = histogram::index_of(value);
+		CHECK(histogram::lowest_in(index)<=value && value<=histogram::highest_in(index));
+	}
+
+	histogram latencies;
+	for(std::uint64_t i=1 ; i<=1000 ; ++i) latencies.record(i*1000);
+	histogram::snapshot snapshot = latencies.take_snapshot();
+	CHECK(snapshot.count==1000 && snapshot.min==1000 && snapshot.max==1000000);
+	// within the 1/16 bucket resolution
+	CHECK(snapshot.value_at(0.5)>=500000 && snapshot.value_at(0.5)<=500000+500000/16);
+}
+
+void check_registry()
+{
+	dumbnose::metrics_registry registry;
+	dumbnose::counter& requests = registry.add_counter("requests_total", "Requests served");
+	CHECK(&registry.add_counter("requests_total", "Requests served")==&requests);
+	CHECK_THROWS(registry.add_gauge("requests_total", "Requests served"), std::logic_error);
+
+	std::vector<std::thread> threads;
+	for(int i=0 ; i<4 ; ++i) threads.emplace_back([&]{ for(int j=0 ; j<10000 ; ++j) requests.add(); });
+	for(std::thread& thread : threads) thread.join();
+	CHECK(requests.value()==40000);
+
+	{
+		dumbnose::job_queue<int> jobs(16);
+		jobs.publish_metrics("jobs", registry);
+		jobs.add_job(1);
+
+		std::ostringstream exposition;
+		registry.write_prometheus(exposition);
+		CHECK(exposition.str().find("# TYPE requests_total counter\nrequests_total 40000\n")!=std::string::npos);
+		CHECK(exposition.str().find("jobs_depth 1\n")!=std::string::npos);
+	}
+
+	// withdrawn with the queue
+	std::ostringstream text;
+	registry.write_text(text);
+	CHECK(text.str().find("jobs_depth")==std::string::npos);
+
+	// callbacks run outside the registry's lock, so they may use it themselves
+	{
+		dumbnose::metrics_publication reads = registry.publish(dumbnose::metric_type::counter, "reads_total", "Snapshots taken", [&]{
+			return static_cast<double>(registry.add_counter("requests_total", "Requests served").value());
+		});
+		std::ostringstream exposition;
+		registry.write_prometheus(exposition);
+		CHECK(exposition.str().find("reads_total 40000\n")!=std::string::npos);
+	}
+}
+
+#if !defined(DUMBNOSE_NO_TIMING_PROBES)
+void check_timing_probes()
+{
+	std::vector<std::thread> threads;
+	for(int i=0 ; i<3 ; ++i) threads.emplace_back([]{ for(int j=0 ; j<1000 ; ++j) { SCOPED_TIMER("telemetry.probe"); } });
+	for(std::thread& thread : threads) thread.join();
+
+	std::ostringstream report;
+	dumbnose::dump_timing_sites(report);
+	CHECK(report.str().find("telemetry.probe")!=std::string::npos);
+	CHECK(report.str().find("count 3000")!=std::string::npos);
+}
+#endif
+
+void check_error_throttle()
+{
+	dumbnose::error_throttle_options options;
+	options.per_second = 1000;
+	options.burst = 1;
+	dumbnose::error_throttle throttle(options);
+
+	// keys 1 to 250 land in consecutive slots, then wait long enough for every bucket to refill
+	for(std::uint64_t key=1 ; key<=250 ; ++key) CHECK(throttle.admit(key).emit);
+	std::this_thread::sleep_for(std::chrono::milliseconds(20));
+
+	// a new key whose probe finds no free slot takes over an idle one
+	CHECK(throttle.admit(5000).emit);
+	CHECK(!throttle.admit(5000).emit && !throttle.admit(5000).emit);
+	std::uint64_t reported_key = 0, reported = 0;
+	throttle.drain_suppressed([&](std::uint64_t key, std::uint64_t suppressed, dumbnose::error_site const *){
+		reported_key = key;
+		reported += suppressed;
+	});
+	CHECK(reported_key==5000 && reported==2);
+
+	// and the quiet keys are not charged for it
+	int emitted = 0;
+	for(std::uint64_t key=1 ; key<=250 ; ++key) emitted += throttle.admit(key).emit;
+	CHECK(emitted==250);
+
+	// a key sharing a busy slot is told which site the held back messages came from
+	static const dumbnose::error_site first(__FILE__, __LINE__), second(__FILE__, __LINE__);
+	options.per_second = 0.001;
+	dumbnose::error_throttle busy(options);
+	for(std::uint64_t key=1 ; key<=8 ; ++key) {
+		busy.admit(key, &first);
+		CHECK(!busy.admit(key, &first).emit);
+	}
+	options.per_second = 1000;
+	busy.configure(options);
+	std::this_thread::sleep_for(std::chrono::milliseconds(20));
+	dumbnose::error_throttle::decision shared = busy.admit(257, &second);
+	CHECK(shared.emit && shared.suppressed==1 && shared.site==&first);
+}
+
+void check_trace_log()
+{
+	static constexpr dumbnose::trace_format last_words(L"thread {} done");
+
+	// a thread's last records are flushed after it exits
+	dumbnose::trace_log log;
+	for(int i=0 ; i<8 ; ++i) std::thread([&log, i]{ log.write(dumbnose::trace_level::info, last_words, i); }).join();
+	log.flush();
+	std::vector<dumbnose::trace_entry> history = log.history();
+	CHECK(history.size()==8);
+	CHECK(history.back().text==L"thread 7 done");
+
+	// a thread outliving many logs it wrote to
+	for(int i=0 ; i<100 ; ++i) {
+		dumbnose::trace_log brief;
+		brief.write(dumbnose::trace_level::debug, last_words, i);
+		brief.flush();
+		CHECK(brief.history().size()==1);
+	}
+	log.write(dumbnose::trace_level::info, last_words, 8);
+	log.flush();
+	CHECK(log.history().back().text==L"thread 8 done");
+}
+
+void check_status_notifier()
+{
+	dumbnose::status_notifier& notifier = dumbnose::status_notifier::instance();
+
+	std::atomic<int> traced{0};
+	auto trace_cookie = notifier.trace_received_event.register_listener([&](dumbnose::status_notifier&, std::wstring const &){ ++traced; });
+	notifier.trace(L"a message long enough to need more than one slot of the ring buffer");
+	STATUS_TRACE(dumbnose::trace_level::info, L"n={} b={}", 42, true);
+	std::wstring history = notifier.trace_history();
+	CHECK(traced==2);
+	CHECK(history.find(L"n=42 b=true")!=std::wstring::npos);
+
+	std::vector<std::wstring> errors;
+	auto error_cookie = notifier.error_occurred_event.register_listener([&](dumbnose::status_notifier&, std::wstring const & message){ errors.push_back(message); });
+	int formatted = 0;
+	for(int i=0 ; i<1000 ; ++i) STATUS_REPORT_ERROR((++formatted, L"failure"));
+	// only the burst gets through, and only those are formatted
+	CHECK(formatted==static_cast<int>(errors.size()));
+	CHECK(errors.size()<100);
+
+	notifier.report_suppressed_errors();
+	CHECK(errors.back().find(L"similar errors suppressed")!=std::wstring::npos);
+
+	// narrow messages are UTF-8; bad bytes become U+FFFD
+	notifier.report_error(std::string("caf\xC3\xA9 \xF0\x9F\x94\xA5 \xFF"));
+	CHECK(errors.back()==L"caf\u00E9 \U0001F525 \uFFFD");
+}
+
+
+int main()
+{
+	check_histogram();
+	check_registry();
+#if !defined(DUMBNOSE_NO_TIMING_PROBES)
+	check_timing_probes();
+#endif
+	check_error_throttle();
+	check_trace_log();
+	check_status_notifier();
+
+	return dumbnose::unit_tests::check_result();
+}
@@ -1,11 +1,27 @@
 #pragma once
 
+#include <chrono>
+#include <dumbnose/lock.hpp>
+
+#if defined(_WIN32)
 #include <dumbnose/waiter.hpp>
+#elif defined(__linux__)
+#include <cerrno>
+#include <cstdint>
+#include <system_error>
+#include <poll.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+#include <dumbnose/noncopyable.hpp>
+#include <dumbnose/aux_/futex_sync.hpp>
+#endif
 
 
 namespace dumbnose {
 
 
+#if defined(_WIN32)
+
 class waitable_timer {
 	friend class waiter;
 
@@ -21,6 +37,13 @@ public:
 		if(!SetWaitableTimer(timer_,&due,0,0,0,0)) throw windows_exception("Could not set waitable timer");
 	}
 
+	template<class rep_t, class period_t>
+	void set(std::chrono::duration<rep_t,period_t> due_in) {
+		LARGE_INTEGER due;
+		due.QuadPart=-std::chrono::duration_cast<std::chrono::duration<long long,std::ratio<1,10000000> > >(due_in).count();
+		if(!SetWaitableTimer(timer_,&due,0,0,0,0)) throw windows_exception("Could not set waitable timer");
+	}
+
 	void wait(unsigned int wait_time=INFINITE) const {
 		DWORD status = WaitForSingleObject(timer_,wait_time);
 		if(status!=WAIT_OBJECT_0) throw windows_exception("Wait for timer failed");
@@ -51,5 +74,79 @@ private:
 	}
 };
 
+#elif defined(__linux__)
+
+//
+// One-shot, auto-reset timer over a timerfd, so waiter can wait on it
+// together with events and semaphores.
+//
+class waitable_timer : dumbnose::noncopyable {
+	friend class waiter;
+
+public:
+	waitable_timer() {
+		timer_ = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+		if(timer_<0) throw std::system_error(errno, std::system_category(), "Could not create waitable timer");
+	}
+
+	~waitable_timer() {
+		close(timer_);
+	}
+
+	void set_hours(unsigned int hours) {
+		set(std::chrono::hours(hours));
+	}
+
+	template<class rep_t, class period_t>
+	void set(std::chrono::duration<rep_t,period_t> due_in) {
+		long long ns = std::chrono::duration_cast<std::chrono::nanoseconds>(due_in).count();
+		if(ns<1) ns = 1;	// zero would disarm the timer
+
+		itimerspec spec = {};
+		spec.it_value.tv_sec = static_cast<time_t>(ns / 1000000000);
+		spec.it_value.tv_nsec = static_cast<long>(ns % 1000000000);
+		if(timerfd_settime(timer_, 0, &spec, nullptr)!=0)
+			throw std::system_error(errno, std::system_category(), "Could not set waitable timer");
+	}
+
+	void wait(unsigned int wait_time=infinite_wait) const {
+		aux::futex_deadline deadline = aux::deadline_after_ms(wait_time);
+
+		for(;;) {
+			if(try_take()) return;
+
+			int timeout = -1;
+			if(deadline) {
+				auto remaining = std::chrono::ceil<std::chrono::milliseconds>(*deadline-std::chrono::steady_clock::now()).count();
+				timeout = remaining>0 ? static_cast<int>(remaining) : 0;
+			}
+
+			pollfd fd = { timer_, POLLIN, 0 };
+			int result = poll(&fd, 1, timeout);
+			if(result==0) {
+				if(try_take()) return;
+				throw std::system_error(std::make_error_code(std::errc::timed_out), "Wait for timer failed");
+			}
+			if(result<0 && errno!=EINTR)
+				throw std::system_error(errno, std::system_category(), "Wait for timer failed");
+		}
+	}
+
+private:
+	// waiter protocol
+	int wait_fd() const {
+		return timer_;
+	}
+
+	bool try_take() const {
+		std::uint64_t expirations = 0;
+		return read(timer_, &expirations, sizeof(expirations))==sizeof(expirations);
+	}
+
+	int timer_;
+};
+
+#endif
+
 
-} // namespace dumbnose
\ No newline at end of file
+} // namespace dumbnose
@@ -1,9 +1,22 @@
 #pragma once
 
 #include <dumbnose/null_type.hpp>
+#include <atomic>
+#include <functional>
+
+#if defined(__linux__)
+#include <cerrno>
+#include <cstdint>
+#include <system_error>
+#include <poll.h>
+#include <dumbnose/aux_/wait_reactor.hpp>
+#endif
 
 namespace dumbnose {
 
+
+#if defined(_WIN32)
+
 //
 // 
 //
@@ -26,28 +39,64 @@ public:
 		return wait_any_impl(1,handles);
 	}
 
-	template<typename lock1_t, typename lock2_t>
-	static unsigned short wait_any(lock1_t& lock1, lock2_t& lock2)
+	// Returns the 1-based position of the object that was signaled
+	template<typename... locks_t>
+	static unsigned short wait_any(locks_t&... locks)
 	{
-		HANDLE handles[2];
-		handles[0] = lock1.handle();
-		handles[1] = lock2.handle();
+		static_assert(sizeof...(locks_t)>0 && sizeof...(locks_t)<=MAXIMUM_WAIT_OBJECTS, "wait_any takes 1 to 64 objects");
+		HANDLE handles[] = { locks.handle()... };
 
-		return wait_any_impl(2,handles);
+		return wait_any_impl(static_cast<unsigned short>(sizeof...(locks_t)),handles);
 	}
 
-	template<typename lock1_t, typename lock2_t, typename lock3_t>
-	static unsigned short wait_any(lock1_t& lock1, lock2_t& lock2, lock3_t& lock3)
+	//
+	// Run callback on a system thread-pool thread once lock is signaled.
+	// Like a wait, this acquires the object (an auto-reset event or a
+	// semaphore count is consumed).  One-shot, and no thread is blocked
+	// while the wait is pending.
+	//
+	template<typename lock_t>
+	static void register_wait(lock_t& lock, std::function<void()> callback)
 	{
-		HANDLE handles[3];
-		handles[0] = lock1.handle();
-		handles[1] = lock2.handle();
-		handles[2] = lock3.handle();
-
-		return wait_any_impl(3,handles);
+		register_wait_impl(lock.handle(), std::move(callback));
 	}
 
 private:
+	struct registered_wait
+	{
+		std::function<void()> callback_;
+		HANDLE wait_handle_;
+		std::atomic<int> owners_;	// the registering thread and the callback; the last one cleans up
+	};
+
+	static void register_wait_impl(HANDLE handle, std::function<void()> callback)
+	{
+		registered_wait* wait = new registered_wait{std::move(callback), NULL, {2}};
+
+		if(!RegisterWaitForSingleObject(&wait->wait_handle_, handle, &registered_wait_callback, wait, INFINITE, WT_EXECUTEONLYONCE)) {
+			delete wait;
+			throw windows_exception("RegisterWaitForSingleObject failed");
+		}
+
+		release_registered_wait(wait);
+	}
+
+	static void CALLBACK registered_wait_callback(void* context, BOOLEAN /*timed_out*/)
+	{
+		registered_wait* wait = static_cast<registered_wait*>(context);
+		wait->callback_();
+		release_registered_wait(wait);
+	}
+
+	static void release_registered_wait(registered_wait* wait)
+	{
+		if(wait->owners_.fetch_sub(1)!=1) return;
+
+		// non-blocking form, so this is safe from inside the callback
+		UnregisterWaitEx(wait->wait_handle_, NULL);
+		delete wait;
+	}
+
 	static unsigned short wait_any_impl(unsigned short count, HANDLE handles[])
 	{
 
@@ -60,5 +109,73 @@ private:
 
 };
 
+#elif defined(__linux__)
+
+//
+// Linux implementation over poll/epoll.  event, semaphore and
+// waitable_timer take part through an eventfd or timerfd; the objects
+// still sync in user space and only create the descriptor once something
+// waits on them here.  mutex can be signaled but not waited on.
+//
+class waiter
+{
+public:
+
+	// Signal lock1, then wait for lock2 without losing a pulse of lock2 in between
+	template<typename lock1_t, typename lock2_t>
+	static unsigned short signal_and_wait(lock1_t& lock1, lock2_t& lock2)
+	{
+		auto ticket = lock2.wait_ticket();
+		lock1.signal();
+		lock2.wait_from(ticket);
+
+		return 0;	// WAIT_OBJECT_0
+	}
+
+	template<typename lock_t>
+	static unsigned short wait(lock_t& lock)
+	{
+		return wait_any(lock);
+	}
+
+	// Returns the 1-based position of the object that was taken
+	template<typename... locks_t>
+	static unsigned short wait_any(locks_t&... locks)
+	{
+		static_assert(sizeof...(locks_t)>0, "wait_any needs at least one object");
+
+		for(;;) {
+			// wait_fd() also brings each descriptor up to date
+			pollfd fds[] = { {locks.wait_fd(), POLLIN, 0}... };
+
+			unsigned short taken = 0, position = 0;
+			((++position, taken==0 && locks.try_take() ? taken = position : 0), ...);
+			if(taken) return taken;
+
+			if(poll(fds, sizeof...(locks_t), -1)<0 && errno!=EINTR)
+				throw std::system_error(errno, std::system_category(), "wait_any failed");
+		}
+	}
+
+	//
+	// Run callback on the reactor thread once lock is signaled.  Like a
+	// wait, this acquires the object (an auto-reset event or a semaphore
+	// count is consumed).  One-shot, and no thread is blocked while the
+	// wait is pending.
+	//
+	template<typename lock_t>
+	static void register_wait(lock_t& lock, std::function<void()> callback)
+	{
+		lock_t* object = &lock;
+		aux::wait_reactor::shared().add(lock.wait_fd(), [object]{
+			if(object->try_take()) return true;
+			object->wait_fd();	// clear a stale readable state before re-arming
+			return false;
+		}, std::move(callback));
+	}
+};
+
+#endif
+
 
 } // namespace dumbnose
@@ -0,0 +1,320 @@
+#pragma once
+
+//
+//	work_stealing_pool
+//
+//	Fixed set of worker threads, each owning a chase_lev_deque.  Work
+//	submitted from a worker goes onto that worker's own deque and is run
+//	LIFO while it is still hot in cache; idle workers steal FIFO from the
+//	other end of a random victim's deque.  Work submitted from outside the
+//	pool goes through a shared injection queue.  Idle workers spin for a
+//	while and then sleep on a futex, and submitters only pay for a wake-up
+//	when somebody is actually asleep.
+//
+//	Each task is a single heap node (no shared_ptr control block).  An
+//	exception escaping a task handed to submit() terminates the process,
+//	as it would on a std::thread, whether a worker or a thread helping in
+//	parallel_for runs it.  parallel_for rethrows the first exception
+//	thrown by the body in the calling thread.
+//
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include <dumbnose/noncopyable.hpp>
+#include <dumbnose/chase_lev_deque.hpp>
+#include <dumbnose/mpmc_queue.hpp>
+#include <dumbnose/aux_/futex.hpp>
+#include <dumbnose/aux_/spin_wait.hpp>
+
+
+namespace dumbnose {
+
+
+class work_stealing_pool : dumbnose::noncopyable
+{
+public:
+	explicit work_stealing_pool(unsigned int thread_count = std::thread::hardware_concurrency(),
+								std::size_t injection_capacity = 4096)
+		: injection_(injection_capacity)
+	{
+		if(thread_count==0) thread_count = 1;
+
+		// all deques must exist before any worker starts stealing
+		for(unsigned int i=0 ; i<thread_count ; ++i) {
+			workers_.emplace_back(new worker_t(this, i));
+		}
+
+		for(unsigned int i=0 ; i<thread_count ; ++i) {
+			threads_.emplace_back(&work_stealing_pool::run_worker, this, workers_[i].get());
+		}
+	}
+
+	// Runs everything already submitted, then stops the workers
+	~work_stealing_pool()
+	{
+		wait_idle();
+
+		stopping_.store(true, std::memory_order_seq_cst);
+		epoch_.fetch_add(1, std::memory_order_seq_cst);
+		aux::futex_wake_all(epoch_);
+
+		for(std::thread& thread : threads_) thread.join();
+	}
+
+	unsigned int thread_count() const { return static_cast<unsigned int>(workers_.size()); }
+
+	// True if the calling thread is one of this pool's workers
+	bool on_worker_thread() const { return current_worker()!=nullptr; }
+
+	template<class func_t>
+	void submit(func_t&& func)
+	{
+		schedule(new task_impl<typename std::decay<func_t>::type>(std::forward<func_t>(func)));
+	}
+
+	//
+	// Calls func(i) for every i in [first, last).  The range is split in
+	// halves down to grain-sized pieces; the calling thread runs the first
+	// piece itself and then helps with the rest until all are done.
+	//
+	template<class index_t, class func_t>
+	void parallel_for(index_t first, index_t last, const func_t& func, index_t grain = 1)
+	{
+		if(!(first<last)) return;
+		if(grain<1) grain = 1;
+
+		// shared with the pieces: the last one still wakes pending_ after this call may have returned
+		std::shared_ptr<parallel_for_state> state = std::make_shared<parallel_for_state>();
+		run_range(first, last, grain, func, state);
+		help_until_done(*state);
+
+		if(state->error_) std::rethrow_exception(state->error_);
+	}
+
+	// Blocks until every submitted task has finished
+	void wait_idle()
+	{
+		std::unique_lock<std::mutex> lock(idle_lock_);
+		idle_cv_.wait(lock, [this]{ return outstanding_.load(std::memory_order_acquire)==0; });
+	}
+
+private:
+	struct task_base
+	{
+		virtual ~task_base() {}
+		virtual void run() = 0;
+	};
+
+	template<class func_t>
+	struct task_impl : task_base
+	{
+		template<class arg_t>
+		explicit task_impl(arg_t&& func) : func_(std::forward<arg_t>(func)) {}
+
+		void run() override { func_(); }
+
+		func_t func_;
+	};
+
+	struct worker_t
+	{
+		worker_t(work_stealing_pool* pool, unsigned int index) : pool_(pool), index_(index), seed_(index*2654435761u+1) {}
+
+		work_stealing_pool* pool_;
+		unsigned int index_;
+		std::uint32_t seed_;
+		chase_lev_deque<task_base*> deque_;
+	};
+
+	struct parallel_for_state
+	{
+		aux::futex_word pending_{1};
+		std::once_flag error_once_;
+		std::exception_ptr error_;
+	};
+
+	static worker_t*& current_slot()
+	{
+		static thread_local worker_t* current = nullptr;
+		return current;
+	}
+
+	worker_t* current_worker() const
+	{
+		worker_t* current = current_slot();
+		return (current!=nullptr && current->pool_==this) ? current : nullptr;
+	}
+
+	void schedule(task_base* task)
+	{
+		outstanding_.fetch_add(1, std::memory_order_relaxed);
+
+		worker_t* self = current_worker();
+		if(self!=nullptr) {
+			self->deque_.push(task);
+		} else {
+			injection_.push(task);
+		}
+
+		wake_one();
+	}
+
+	void wake_one()
+	{
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		if(sleepers_.load(std::memory_order_relaxed)==0) return;
+
+		epoch_.fetch_add(1, std::memory_order_seq_cst);
+		aux::futex_wake_one(epoch_);
+	}
+
+	// noexcept: a task's exception terminates here rather than leaving outstanding_ counted
+	void run_task(task_base* task) noexcept
+	{
+		task->run();
+		delete task;
+
+		if(outstanding_.fetch_sub(1, std::memory_order_acq_rel)==1) {
+			// went idle; the empty critical section orders us after any waiter's check
+			{ std::lock_guard<std::mutex> lock(idle_lock_); }
+			idle_cv_.notify_all();
+		}
+	}
+
+	// Own deque first (LIFO), then the injection queue, then steal (FIFO)
+	task_base* find_task(worker_t* self)
+	{
+		task_base* task = nullptr;
+		if(self!=nullptr && self->deque_.pop(task)) return task;
+		if(injection_.try_pop(task)) return task;
+
+		return steal(self);
+	}
+
+	task_base* steal(worker_t* self)
+	{
+		std::size_t count = workers_.size();
+		std::size_t start = 0;
+		if(self!=nullptr) {
+			// xorshift; cheap per-worker randomization of the victim order
+			self->seed_ ^= self->seed_ << 13;
+			self->seed_ ^= self->seed_ >> 17;
+			self->seed_ ^= self->seed_ << 5;
+			start = self->seed_ % count;
+		}
+
+		task_base* task = nullptr;
+		for(std::size_t i=0 ; i<count ; ++i) {
+			worker_t* victim = workers_[(start+i) % count].get();
+			if(victim!=self && victim->deque_.steal(task)) return task;
+		}
+
+		return nullptr;
+	}
+
+	void run_worker(worker_t* self)
+	{
+		current_slot() = self;
+
+		aux::spin_wait spinner;
+		for(;;) {
+			task_base* task = find_task(self);
+			if(task!=nullptr) {
+				run_task(task);
+				spinner.reset();
+				continue;
+			}
+
+			if(stopping_.load(std::memory_order_acquire)) break;
+			if(spinner.spin()) continue;
+
+			// announce we are going to sleep, then look one last time
+			sleepers_.fetch_add(1, std::memory_order_seq_cst);
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			std::uint32_t seen = epoch_.load(std::memory_order_seq_cst);
+
+			task = find_task(self);
+			if(task==nullptr && !stopping_.load(std::memory_order_acquire)) aux::futex_wait(epoch_, seen);
+			sleepers_.fetch_sub(1, std::memory_order_relaxed);
+
+			if(task!=nullptr) run_task(task);
+			spinner.reset();
+		}
+
+		current_slot() = nullptr;
+	}
+
+	template<class index_t, class func_t>
+	void run_range(index_t first, index_t last, index_t grain, const func_t& func, std::shared_ptr<parallel_for_state> const & state)
+	{
+		// hand off the upper halves, keep the lowest piece for this thread
+		while(last-first > grain) {
+			index_t middle = first + (last-first)/2;
+			state->pending_.fetch_add(1, std::memory_order_relaxed);
+			submit([this, middle, last, grain, &func, state]{ run_range(middle, last, grain, func, state); });
+			last = middle;
+		}
+
+		try {
+			for(index_t i=first ; i<last ; ++i) func(i);
+		} catch(...) {
+			std::call_once(state->error_once_, [&]{ state->error_ = std::current_exception(); });
+		}
+
+		// func is not touched past here, so it may go out of scope as soon as pending_ reaches 0
+		if(state->pending_.fetch_sub(1, std::memory_order_acq_rel)==1) aux::futex_wake_all(state->pending_);
+	}
+
+	//
+	// Run pool work until state is finished.  Workers never sleep here, or
+	// every worker could end up waiting on tasks sitting in their own
+	// deques.  Outside threads spin, then sleep until the last piece ends.
+	//
+	void help_until_done(parallel_for_state& state)
+	{
+		worker_t* self = current_worker();
+
+		aux::spin_wait spinner;
+		for(;;) {
+			std::uint32_t pending = state.pending_.load(std::memory_order_acquire);
+			if(pending==0) return;
+
+			task_base* task = find_task(self);
+			if(task!=nullptr) {
+				run_task(task);
+				spinner.reset();
+			} else if(spinner.spin()) {
+				continue;
+			} else if(self!=nullptr) {
+				std::this_thread::yield();
+			} else {
+				aux::futex_wait(state.pending_, pending);
+			}
+		}
+	}
+
+	std::vector<std::unique_ptr<worker_t> > workers_;
+	std::vector<std::thread> threads_;
+	mpmc_queue<task_base*> injection_;
+
+	alignas(aux::cache_line_size) std::atomic<std::size_t> outstanding_{0};
+	alignas(aux::cache_line_size) aux::futex_word epoch_{0};
+	aux::futex_word sleepers_{0};
+	std::atomic<bool> stopping_{false};
+
+	std::mutex idle_lock_;
+	std::condition_variable idle_cv_;
+};
+
+
+} // namespace dumbnose